@@ -1,7 +1,9 @@
 #include "marian.h"
 
 #include "common/cli_wrapper.h"
+#include "data/shortlist.h"
 
+#include <regex>
 #include <sstream>
 
 int main(int argc, char** argv) {
@@ -13,17 +15,57 @@ int main(int argc, char** argv) {
   {
     auto cli = New<cli::CLIWrapper>(
         options,
-        "Convert a model in the .npz format to a mmap-able binary model",
+        "Convert a model in the .npz format to a mmap-able binary model, "
+        "or a lexical shortlist to a mmap-able binary shortlist",
         "Allowed options",
         "Examples:\n"
-        "  ./marian-conv -f model.npz -t model.bin");
+        "  ./marian-conv -f model.npz -t model.bin\n"
+        "  ./marian-conv -f model.npz -t model.bin --gemm-type int8packed\n"
+        "  ./marian-conv --shortlist lex.s2t 100 100 0 --vocabs src.yml trg.yml -t lex.bin");
     cli->add<std::string>("--from,-f", "Input model", "model.npz");
     cli->add<std::string>("--to,-t", "Output model", "model.bin");
+    cli->add<std::string>("--gemm-type,-g",
+        "Store the weight matrices of transformer layers prepared for this --gemm-type of the decoder: "
+        "float32, intrinint16, fp16packed, int8packed. Requires the .bin format",
+        "float32");
+    cli->add<std::vector<std::string>>("--shortlist",
+        "Convert this lexical shortlist instead of a model: path first best prune, as for marian-decoder");
+    cli->add<std::vector<std::string>>("--vocabs,-v",
+        "Source and target vocabulary of the shortlist");
     cli->parse(argc, argv);
   }
+
+  if(options->hasAndNotEmpty("shortlist")) {
+    auto vocabPaths = options->get<std::vector<std::string>>("vocabs");
+    ABORT_IF(vocabPaths.size() != 2, "Converting a shortlist requires a source and a target vocabulary");
+    auto srcVocab = New<Vocab>(options, 0);
+    srcVocab->load(vocabPaths[0]);
+    auto trgVocab = New<Vocab>(options, 1);
+    trgVocab->load(vocabPaths[1]);
+
+    data::LexicalShortlistGenerator shortlist(options, srcVocab, trgVocab);
+    shortlist.save(options->get<std::string>("to"));
+
+    LOG(info, "Finished");
+    return 0;
+  }
+
   auto modelFrom = options->get<std::string>("from");
   auto modelTo = options->get<std::string>("to");
 
+  auto gemmType = options->get<std::string>("gemm-type");
+  Type packedType = Type::float32;
+  if(gemmType == "intrinint16")
+    packedType = Type::intrinint16;
+  else if(gemmType == "fp16packed")
+    packedType = Type::packed16;
+  else if(gemmType == "int8packed")
+    packedType = Type::packed8;
+  else
+    ABORT_IF(gemmType != "float32", "Unknown --gemm-type {}", gemmType);
+  ABORT_IF(packedType != Type::float32 && !io::isBin(modelTo),
+           "Weights of type {} can only be stored in the .bin format", packedType);
+
   LOG(info, "Outputting {}", modelTo);
 
   YAML::Node config;
@@ -37,7 +79,34 @@ int main(int argc, char** argv) {
 
   graph->load(modelFrom);
   graph->forward();
-  graph->save(modelTo, configStr.str());
+
+  std::vector<io::Item> items;
+  graph->save(items);
+
+  if(packedType != Type::float32) {
+    // Weights of the attention and feed-forward layers of transformers are only used as the B
+    // matrix of affine(), which can use them in packed form. Embeddings and output layers are
+    // kept, as they are also used for lookups and shortlists.
+    std::regex packable("(encoder|decoder)_l[0-9]+_(self|context|ffn)_W([qkvo]|[0-9]+)");
+    std::map<std::string, Expr> packed;
+    for(auto p : *graph->params())
+      if(std::regex_match(p->name(), packable))
+        packed[p->name()] = packWeights(p, packedType);
+    graph->forward();
+
+    for(auto& item : items) {
+      auto it = packed.find(item.name);
+      if(it == packed.end())
+        continue;
+      auto mem = it->second->val()->memory();
+      item.type = packedType;
+      item.bytes.assign(mem->data<char>(), mem->data<char>() + mem->size());
+    }
+    LOG(info, "Stored {} weight matrices as {}", packed.size(), packedType);
+  }
+
+  io::addMetaToItems(configStr.str(), "special:model.yml", items);
+  io::saveItems(modelTo, items);
 
   // graph->saveBinary(vm["bin"].as<std::string>());
 
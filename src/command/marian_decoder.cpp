@@ -10,11 +10,13 @@ int main(int argc, char** argv) {
   using namespace marian;
 
   auto options = parseOptions(argc, argv, cli::mode::translation);
+  GraphProfiler::global()->start(options);
   auto task = New<Translate<BeamSearch>>(options);
 
   timer::Timer timer;
   task->run();
   LOG(info, "Total time: {:.5f}s wall", timer.elapsed());
+  GraphProfiler::global()->finish();
 
   return 0;
 }
@@ -8,10 +8,12 @@ int main(int argc, char** argv) {
   using namespace marian;
 
   auto options = parseOptions(argc, argv, cli::mode::scoring);
+  GraphProfiler::global()->start(options);
 
   timer::Timer timer;
   New<Rescore<Rescorer>>(options)->run();
   LOG(info, "Total time: {:.5f}s wall", timer.elapsed());
+  GraphProfiler::global()->finish();
 
   return 0;
 }
@@ -6,6 +6,8 @@
 
 #include "3rd_party/simple-websocket-server/server_ws.hpp"
 
+#include <csignal>
+
 typedef SimpleWeb::SocketServer<SimpleWeb::WS> WSServer;
 
 int main(int argc, char **argv) {
@@ -13,6 +15,7 @@ int main(int argc, char **argv) {
 
   // Initialize translation task
   auto options = parseOptions(argc, argv, cli::mode::server, true);
+  GraphProfiler::global()->start(options);
   auto task = New<TranslateService<BeamSearch>>(options);
 
   // Initialize web server
@@ -49,13 +52,29 @@ int main(int argc, char **argv) {
     LOG(error, "Connection error: ({}) {}", ec.value(), ec.message());
   };
 
-  // Start server thread
-  std::thread serverThread([&server]() {
-    LOG(info, "Server is listening on port {}", server.config.port);
-    server.start();
+  // Stop the server on SIGINT and SIGTERM, so that the translation task is destroyed and can
+  // save its translation cache
+  server.io_service = std::make_shared<SimpleWeb::asio::io_service>();
+  SimpleWeb::asio::signal_set signals(*server.io_service, SIGINT, SIGTERM);
+  signals.async_wait([&server](const SimpleWeb::error_code &ec, int signal) {
+    if(!ec) {
+      LOG(info, "Received signal {}, stopping server", signal);
+      server.stop();
+      server.io_service->stop();
+    }
   });
 
-  serverThread.join();
+  // Start server threads. With continuous batching, several requests are handled at the same
+  // time, so that their sentences can be translated together.
+  LOG(info, "Server is listening on port {}", server.config.port);
+  server.start();
+  std::vector<std::thread> serverThreads;
+  for(size_t i = 0; i < task->maxConcurrentRequests(); ++i)
+    serverThreads.emplace_back([&server]() { server.io_service->run(); });
+
+  for(auto &serverThread : serverThreads)
+    serverThread.join();
+  GraphProfiler::global()->finish();
 
   return 0;
 }
@@ -17,6 +17,7 @@ int main(int argc, char** argv) {
   using namespace marian;
 
   auto options = parseOptions(argc, argv, cli::mode::training);
+  GraphProfiler::global()->start(options);
 
   // selects MultiNodeGraphGroup family
   //
@@ -68,5 +69,6 @@ int main(int argc, char** argv) {
     }
   }
 
+  GraphProfiler::global()->finish();
   return 0;
 }
@@ -56,6 +56,7 @@ void loadItems(const void* current, std::vector<io::Item>& items, bool mapped) {
   for(int i = 0; i < numHeaders; ++i) {
     if(items[i].mapped) {
       items[i].ptr = get<char>(current, headers[i].dataLength);
+      items[i].mappedBytes = headers[i].dataLength;
     } else {
       size_t len = headers[i].dataLength;
       items[i].bytes.resize(len);
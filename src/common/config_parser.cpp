@@ -82,6 +82,12 @@ void ConfigParser::addOptionsGeneral(cli::CLIWrapper& cli) {
   cli.add<std::string>("--dump-config",
     "Dump current (modified) configuration to stdout and exit. Possible values: full, minimal, expand")
     ->implicit_val("full");
+  cli.add<std::string>("--profile",
+    "Write the time of every graph operation to Chrome trace file given by  arg "
+    "and log a summary per operation type at the end");
+  cli.add<size_t>("--profile-events",
+    "Maximum number of events written to the --profile trace file; later events are only summarized",
+    1000000);
   // clang-format on
 }
 
@@ -90,6 +96,11 @@ void ConfigParser::addOptionsServer(cli::CLIWrapper& cli) {
   cli.add<size_t>("--port,-p",
       "Port number for web socket server",
       8080);
+  cli.add<size_t>("--translation-cache",
+      "Cache translations of up to  arg  MB of sentences and reuse them for repeated input. 0 disables the cache",
+      0);
+  cli.add<std::string>("--translation-cache-file",
+      "Load the translation cache from this file at start and save it there at exit");
   // clang-format on
 }
 
@@ -515,6 +526,15 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
       3);
   cli.add<float>("--word-penalty",
       "Subtract (arg * translation length) from translation score");
+  cli.add<bool>("--beam-early-stop",
+      "Stop decoding a sentence once no unfinished hypothesis can beat its best finished one "
+      "under the length normalization and word penalty. Not used with --n-best");
+  cli.add<float>("--beam-threshold-relative",
+      "Prune beam entries with a probability below arg times that of the best entry. 0 means off",
+      0.f);
+  cli.add<float>("--beam-threshold-absolute",
+      "Prune beam entries whose score is more than arg below that of the best entry. 0 means off",
+      0.f);
   cli.add<bool>("--allow-unk",
       "Allow unknown words to appear in output");
   cli.add<bool>("--n-best",
@@ -531,12 +551,39 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
       "Optimize speed aggressively sacrificing memory or precision");
   cli.add<bool>("--skip-cost",
       "Ignore model cost during translation, not recommended for beam-size > 1");
+  cli.add<bool>("--replay-steps",
+      "Build the graph of a decoding step once and replay it while beam and batch size do not change. "
+      "Only supported for RNN models (s2s) without factors and --alignment");
+  cli.add<bool>("--no-shortterm-memoization",
+      "Do not look for identical nodes when building the graph of a decoding step. Builds steps faster "
+      "for models that never repeat an expression within a step");
+  cli.add<bool>("--fuse-elementwise",
+      "Compute chains of elementwise operations, and the matrix products they are applied to, in one "
+      "pass over memory. CPU only");
+  cli.add<size_t>("--continuous-batching",
+      "Decode up to arg sentences together and admit new mini-batches into the running beam search "
+      "as soon as sentences finish. marian-server then handles up to arg requests at the same time. "
+      "Only supported for RNN models (s2s) and transformers with self-attention, without factors, "
+      "--transformer-train-positions, --alignment and --shortlist. 0 means off",
+      0);
+  cli.add<bool>("--parallel-ensemble",
+      "Run each model of an ensemble on its own graph and thread, so that they are computed concurrently. "
+      "CPU only; every model reserves its own --workspace. Not supported for factored vocabularies");
   cli.add<std::string>("--gemm-type",
       "Select GEMM options: auto, mklfp32, intrinint16, fp16packed, int8packed",
       "auto");
+  cli.add<std::string>("--gemm-isa",
+      "Instruction set of the intrinint16 GEMM kernels: auto (newest supported by the CPU), sse4.1, "
+      "avx2, avx512bw, avx512vnni",
+      "auto");
+  cli.add<std::string>("--gemm-autotune-file",
+      "Preload the decisions of --gemm-type auto from this file and store new ones there, so that later runs "
+      "on the same CPU with the same number of threads do not tune again");
 
   cli.add<std::vector<std::string>>("--shortlist",
      "Use softmax shortlist: path first best prune");
+  cli.add<bool>("--shortlist-per-sentence",
+     "Generate one shortlist per sentence instead of one per batch. Not supported for factored vocabularies");
   cli.add<std::vector<float>>("--weights",
       "Scorer weights");
   cli.add<bool>("--output-sampling",
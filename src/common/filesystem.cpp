@@ -1,12 +1,20 @@
 #include "filesystem.h"
+#include "common/logging.h"
 
 #ifndef _MSC_VER
 // don't include these on Windows:
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#else
+#include <windows.h>
 #endif
 
+#include <cerrno>
+#include <cstring>
+
 namespace marian {
 namespace filesystem {
 
@@ -27,5 +35,44 @@ bool is_fifo(std::string const& path) {
   return is_fifo(path.c_str());
 }
 
+#ifdef _MSC_VER
+MemoryMapping::MemoryMapping(const Path& p) : size_(fileSize(p)) {
+  std::string fileName = p.string();
+  file_ = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  ABORT_IF(file_ == INVALID_HANDLE_VALUE, "Error {} opening file '{}'", GetLastError(), fileName);
+  if(size_ > 0) {
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    ABORT_IF(mapping_ == NULL, "Error {} mapping file '{}'", GetLastError(), fileName);
+    data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    ABORT_IF(data_ == NULL, "Error {} mapping file '{}'", GetLastError(), fileName);
+  }
+}
+
+MemoryMapping::~MemoryMapping() {
+  if(data_)
+    UnmapViewOfFile(data_);
+  if(mapping_)
+    CloseHandle(mapping_);
+  CloseHandle(file_);
+}
+#else
+MemoryMapping::MemoryMapping(const Path& p) : size_(fileSize(p)) {
+  std::string fileName = p.string();
+  int fd = open(fileName.c_str(), O_RDONLY);
+  ABORT_IF(fd == -1, "Error {} ('{}') opening file '{}'", errno, strerror(errno), fileName);
+  if(size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ABORT_IF(data == MAP_FAILED, "Error {} ('{}') mapping file '{}'", errno, strerror(errno), fileName);
+    data_ = data;
+  }
+  close(fd); // the mapping stays valid
+}
+
+MemoryMapping::~MemoryMapping() {
+  if(data_)
+    munmap(const_cast<void*>(data_), size_);
+}
+#endif
+
 } // end of namespace marian::filesystem
 } // end of namespace marian
@@ -95,6 +95,10 @@ namespace filesystem {
     return p.getImpl().size();
   }
 
+  static inline time_t lastWriteTime(const Path& p) {
+    return p.getImpl().mtime();
+  }
+
   static inline bool isDirectory(const Path& p) {
     return p.getImpl().is_directory();
   }
@@ -105,5 +109,26 @@ namespace filesystem {
 
   using FilesystemError = Pathie::PathieError;
 
+  // Read-only memory mapping of a whole file. The pages are shared by all processes that map
+  // the same file and are only loaded when accessed.
+  class MemoryMapping {
+    private:
+      const void* data_{nullptr};
+      size_t size_{0};
+#ifdef _MSC_VER
+      void* file_{nullptr};    // HANDLE
+      void* mapping_{nullptr}; // HANDLE
+#endif
+
+    public:
+      MemoryMapping(const Path& p);
+      ~MemoryMapping();
+      MemoryMapping(const MemoryMapping&) = delete;
+      MemoryMapping& operator=(const MemoryMapping&) = delete;
+
+      const void* data() const { return data_; }
+      size_t size() const { return size_; }
+  };
+
 }
 }
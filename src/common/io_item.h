@@ -12,6 +12,7 @@ struct Item {
   std::vector<char> bytes;
   const char* ptr{0};
   bool mapped{false};
+  size_t mappedBytes{0}; // size of the data at ptr, from the header of the file
 
   std::string name;
   Shape shape;
@@ -26,7 +27,7 @@ struct Item {
 
   size_t size() const {
     if(mapped)
-      return shape.elements() * sizeOf(type);
+      return mappedBytes;
     else
       return bytes.size();
   }
@@ -9,7 +9,9 @@ enum class TypeClass : size_t {
   signed_type = 0x100,
   unsigned_type = 0x200,
   float_type = 0x400,
-  size_mask = 0x0FF
+  packed_type = 0x800, // matrices in the layout of one GEMM implementation, see requiredBytes() in tensors/backend.h
+  size_mask = 0x00F,
+  variant_mask = 0x0F0 // distinguishes packed types of the same element size
 };
 
 constexpr inline size_t operator+(TypeClass typeClass, size_t val) {
@@ -28,7 +30,12 @@ enum class Type : size_t {
   uint64 = TypeClass::unsigned_type + 8u,
 
   float32 = TypeClass::float_type + 4u,
-  float64 = TypeClass::float_type + 8u
+  float64 = TypeClass::float_type + 8u,
+
+  // weights prepared by marian-conv --gemm-type for the corresponding --gemm-type
+  intrinint16 = TypeClass::packed_type + 0x10u + 2u, // int16, quantized and transposed for cpu::int16
+  packed16 = TypeClass::packed_type + 0x20u + 2u,    // fp16, packed for FBGEMM
+  packed8 = TypeClass::packed_type + 0x30u + 1u      // int8 with per-column scales, packed for FBGEMM
 };
 
 static inline size_t operator&(TypeClass typeClass, Type type) {
@@ -55,6 +62,10 @@ static inline bool isFloat(Type type) {
   return (TypeClass::float_type & type) != 0;
 }
 
+static inline bool isPacked(Type type) {
+  return (TypeClass::packed_type & type) != 0;
+}
+
 template <typename T>
 inline bool matchType(Type type);
 
@@ -91,6 +102,10 @@ static inline std::ostream& operator<<(std::ostream& out, Type type) {
 
     case Type::float32: out << "float32"; break;
     case Type::float64: out << "float64"; break;
+
+    case Type::intrinint16: out << "intrinint16"; break;
+    case Type::packed16: out << "packed16"; break;
+    case Type::packed8: out << "packed8"; break;
   }
   return out;
 }
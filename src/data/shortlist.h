@@ -3,35 +3,87 @@
 #include "common/config.h"
 #include "common/definitions.h"
 #include "common/file_stream.h"
+#include "common/filesystem.h"
+#include "common/hash.h"
 
+#include <fstream>
+#include <mutex>
 #include <random>
 #include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace marian {
 namespace data {
 
 class Shortlist {
 private:
-  std::vector<WordIndex> indices_;    // // [packed shortlist index] -> word index, used to select columns from output embeddings
+  std::vector<WordIndex> indices_;    // [packed shortlist index] -> word index, used to select columns from output embeddings
+                                      // per-sentence short lists: [batch entry, packed shortlist index], each padded to size()
+  std::vector<size_t> lengths_;       // [batch entry] unpadded length of each short list; empty if the batch shares one
+
+  size_t numLists() const { return lengths_.empty() ? 1 : lengths_.size(); }
+  size_t length(size_t batchIdx) const { return lengths_.empty() ? indices_.size() : lengths_[batchIdx]; }
 
 public:
   Shortlist(const std::vector<WordIndex>& indices)
     : indices_(indices) {}
 
+  // One short list per batch entry. Lists are padded with their last word to the longest
+  // one; the output layer masks out the padding.
+  Shortlist(const std::vector<std::vector<WordIndex>>& indicesPerSentence) {
+    size_t dimShortlist = 0;
+    for(const auto& indices : indicesPerSentence)
+      dimShortlist = std::max(dimShortlist, indices.size());
+    indices_.reserve(indicesPerSentence.size() * dimShortlist);
+    for(const auto& indices : indicesPerSentence) {
+      indices_.insert(indices_.end(), indices.begin(), indices.end());
+      indices_.resize(indices_.size() + dimShortlist - indices.size(), indices.empty() ? 0 : indices.back());
+      lengths_.push_back(indices.size());
+    }
+  }
+
+  bool isPerSentence() const { return !lengths_.empty(); }
+  size_t dimBatch() const { return lengths_.size(); } // number of per-sentence short lists
+  const std::vector<size_t>& lengths() const { return lengths_; }
+
+  size_t size() const { return indices_.size() / numLists(); } // number of columns in the output layer
+
   const std::vector<WordIndex>& indices() const { return indices_; }
   WordIndex reverseMap(int idx) { return indices_[idx]; }
-  
+  WordIndex reverseMap(int batchIdx, int idx) { return isPerSentence() ? indices_[batchIdx * size() + idx] : indices_[idx]; }
+
+  // Per-sentence short lists only have a common position for words they all contain at the same
+  // index, e.g. the most frequent words at their beginning. Otherwise -1 is returned.
   int tryForwardMap(WordIndex wIdx) {
-    auto first = std::lower_bound(indices_.begin(), indices_.end(), wIdx);
-    if(first != indices_.end() && *first == wIdx)         // check if element not less than wIdx has been found and if equal to wIdx
-      return (int)std::distance(indices_.begin(), first); // return coordinate if found
-    else
-      return -1;                                          // return -1 if not found
+    int idx = -1;
+    for(size_t i = 0; i < numLists(); ++i) {
+      auto begin = indices_.begin() + i * size();
+      auto end = begin + length(i);
+      auto first = std::lower_bound(begin, end, wIdx);
+      if(first == end || *first != wIdx)                  // check if element not less than wIdx has been found and if equal to wIdx
+        return -1;                                        // return -1 if not found
+      if(i > 0 && idx != (int)std::distance(begin, first))
+        return -1;
+      idx = (int)std::distance(begin, first);             // return coordinate if found
+    }
+    return idx;
   }
 
+  // per-sentence short lists of the given batch entries, for when finished ones are dropped
+  Ptr<Shortlist> select(const std::vector<IndexType>& batchIndices) const {
+    ABORT_IF(!isPerSentence(), "Only per-sentence short lists can be selected from");
+    std::vector<std::vector<WordIndex>> indicesPerSentence;
+    for(auto batchIdx : batchIndices) {
+      auto begin = indices_.begin() + batchIdx * size();
+      indicesPerSentence.emplace_back(begin, begin + lengths_[batchIdx]);
+    }
+    return New<Shortlist>(indicesPerSentence);
+  }
 };
 
 class ShortlistGenerator {
@@ -129,13 +181,88 @@ private:
   size_t srcIdx_;
   size_t trgIdx_;
   bool shared_{false};
+  bool perSentence_{false}; // one short list per sentence instead of one per batch
 
   size_t firstNum_{100};
   size_t bestNum_{100};
 
-  std::vector<std::unordered_map<WordIndex, float>> data_; // [WordIndex src] -> [WordIndex tgt] -> P_trans(tgt|src) --@TODO: rename data_ accordingly
+  // Binary shortlist format, see save(): a Header followed by the arrays wordToOffset and
+  // shortLists of the same names as the members below.
+  static const uint64_t BINARY_SHORTLIST_MAGIC = 0x4c5453414d52414dULL; // "MARMASTL"
+  static const uint64_t BINARY_SHORTLIST_VERSION = 2;
+
+  struct Header {
+    uint64_t magic;            // BINARY_SHORTLIST_MAGIC
+    uint64_t version;          // BINARY_SHORTLIST_VERSION
+    uint64_t firstNum;         // number of most frequent target words that are always added
+    uint64_t bestNum;          // maximum number of target words per source word
+    uint64_t wordToOffsetSize; // number of source words + 1
+    uint64_t shortListsSize;   // total number of target words in all short lists
+    uint64_t srcVocabSize;     // sizes of the vocabularies that the word indices refer to
+    uint64_t trgVocabSize;
+  };
+
+  // Pruned short lists in CSR format: the target words of source word s are
+  // shortLists_[wordToOffset_[s], wordToOffset_[s + 1]), in order of descending probability.
+  // Both point into the vectors below for text lexicons, or into the mapped file for binary ones.
+  const uint64_t* wordToOffset_{nullptr};
+  size_t wordToOffsetSize_{0};
+  const WordIndex* shortLists_{nullptr};
+  size_t shortListsSize_{0};
+
+  std::vector<uint64_t> wordToOffsetData_;
+  std::vector<WordIndex> shortListsData_;
+  Ptr<filesystem::MemoryMapping> mapping_;
+
+  // Short lists are generated with bitsets over the target vocabulary and cached by their sorted
+  // set of source words. Generators are shared by all devices, hence the mutex.
+  struct WordsHash {
+    size_t operator()(const std::vector<WordIndex>& words) const {
+      size_t seed = words.size();
+      for(auto word : words)
+        util::hash_combine(seed, word);
+      return seed;
+    }
+  };
+  static const size_t MAX_CACHED_SHORTLISTS = 256;
+
+  std::mutex mutex_;
+  std::vector<uint64_t> firstNumBits_; // the firstNum_ most frequent target words
+  std::vector<uint64_t> bits_;         // words of the short list that is being generated
+  std::unordered_map<std::vector<WordIndex>, Ptr<Shortlist>, WordsHash> cache_;
+
+  static inline uint64_t countTrailingZeros(uint64_t x) { // x != 0
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return i;
+#else
+    return __builtin_ctzll(x);
+#endif
+  }
+
+  void setBit(std::vector<uint64_t>& bits, WordIndex i) const {
+    if(i < trgVocab_->size()) // e.g. source words with shared vocabularies of different size
+      bits[i / 64] |= (uint64_t)1 << (i % 64);
+  }
 
-  void load(const std::string& fname) {
+  void initBitsets() {
+    firstNumBits_.assign((trgVocab_->size() + 63) / 64, 0);
+    for(WordIndex i = 0; i < firstNum_ && i < trgVocab_->size(); ++i)
+      setBit(firstNumBits_, i);
+  }
+
+  static bool isBinaryShortlist(const std::string& fname) {
+    uint64_t magic = 0;
+    std::ifstream in(fname, std::ios::binary);
+    return in.read((char*)&magic, sizeof(magic)) && magic == BINARY_SHORTLIST_MAGIC;
+  }
+
+  // [WordIndex src] -> [WordIndex tgt] -> P_trans(tgt|src)
+  typedef std::vector<std::unordered_map<WordIndex, float>> Lexicon;
+
+  Lexicon load(const std::string& fname) {
+    Lexicon lexicon;
     io::InputFileStream in(fname);
 
     std::string src, trg;
@@ -148,15 +275,18 @@ private:
       auto sId = (*srcVocab_)[src].toWordIndex();
       auto tId = (*trgVocab_)[trg].toWordIndex();
 
-      if(data_.size() <= sId)
-        data_.resize(sId + 1);
-      data_[sId][tId] = prob;
+      if(lexicon.size() <= sId)
+        lexicon.resize(sId + 1);
+      lexicon[sId][tId] = prob;
     }
+    return lexicon;
   }
 
-  void prune(float threshold = 0.f) {
-    size_t i = 0;
-    for(auto& probs : data_) {
+  // keep the bestNum_ most probable target words above threshold per source word
+  void prune(const Lexicon& lexicon, float threshold = 0.f) {
+    wordToOffsetData_.assign(1, 0);
+    shortListsData_.clear();
+    for(auto& probs : lexicon) {
       std::vector<std::pair<float, WordIndex>> sorter;
       for(auto& it : probs)
         sorter.emplace_back(it.second, it.first);
@@ -164,16 +294,83 @@ private:
       std::sort(
           sorter.begin(), sorter.end(), std::greater<std::pair<float, WordIndex>>()); // sort by prob
 
-      probs.clear();
+      size_t num = 0;
       for(auto& it : sorter) {
-        if(probs.size() < bestNum_ && it.first > threshold)
-          probs[it.second] = it.first;
+        if(num < bestNum_ && it.first > threshold)
+          shortListsData_.push_back(it.second);
         else
           break;
+        ++num;
       }
+      wordToOffsetData_.push_back(shortListsData_.size());
+    }
 
-      ++i;
+    wordToOffset_     = wordToOffsetData_.data();
+    wordToOffsetSize_ = wordToOffsetData_.size();
+    shortLists_       = shortListsData_.data();
+    shortListsSize_   = shortListsData_.size();
+  }
+
+  // map a binary shortlist into memory; the pages are shared between processes
+  void loadBinary(const std::string& fname) {
+    mapping_ = New<filesystem::MemoryMapping>(fname);
+    ABORT_IF(mapping_->size() < sizeof(Header), "Binary shortlist {} is too short", fname);
+
+    const Header* header = (const Header*)mapping_->data();
+    ABORT_IF(header->version != BINARY_SHORTLIST_VERSION,
+             "Binary shortlist versions do not match: {} (file) != {} (expected)",
+             header->version,
+             (uint64_t)BINARY_SHORTLIST_VERSION);
+    ABORT_IF(header->srcVocabSize != srcVocab_->size() || header->trgVocabSize != trgVocab_->size(),
+             "Binary shortlist {} was created for vocabularies of size {} and {}, not {} and {}",
+             fname,
+             header->srcVocabSize,
+             header->trgVocabSize,
+             srcVocab_->size(),
+             trgVocab_->size());
+    firstNum_         = header->firstNum;
+    bestNum_          = header->bestNum;
+    wordToOffsetSize_ = header->wordToOffsetSize;
+    shortListsSize_   = header->shortListsSize;
+    ABORT_IF(mapping_->size() != sizeof(Header) + wordToOffsetSize_ * sizeof(uint64_t) + shortListsSize_ * sizeof(WordIndex),
+             "Binary shortlist {} has the wrong size",
+             fname);
+
+    wordToOffset_ = (const uint64_t*)(header + 1);
+    shortLists_   = (const WordIndex*)(wordToOffset_ + wordToOffsetSize_);
+  }
+
+  // short list of the given source words; mutex_ must be held
+  Ptr<Shortlist> generate(std::vector<WordIndex>& srcWords) {
+    // unique words, sorted, as they also identify the short list in the cache
+    std::sort(srcWords.begin(), srcWords.end());
+    srcWords.erase(std::unique(srcWords.begin(), srcWords.end()), srcWords.end());
+
+    auto cached = cache_.find(srcWords);
+    if(cached != cache_.end())
+      return cached->second;
+
+    // start with the firstNum most frequent words and add aligned target words
+    bits_ = firstNumBits_;
+    for(auto i : srcWords) {
+      if(shared_)
+        setBit(bits_, i);
+      if(i + 1 < wordToOffsetSize_)
+        for(auto j = wordToOffset_[i]; j < wordToOffset_[i + 1]; j++)
+          setBit(bits_, shortLists_[j]);
     }
+
+    // selected indices in ascending order
+    std::vector<WordIndex> indices;
+    for(size_t block = 0; block < bits_.size(); ++block)
+      for(uint64_t bits = bits_[block]; bits != 0; bits &= bits - 1) // clear lowest set bit
+        indices.push_back((WordIndex)(block * 64 + countTrailingZeros(bits)));
+
+    auto shortlist = New<Shortlist>(indices);
+    if(cache_.size() >= MAX_CACHED_SHORTLISTS)
+      cache_.clear();
+    cache_.emplace(srcWords, shortlist);
+    return shortlist;
   }
 
 public:
@@ -188,29 +385,51 @@ public:
         trgVocab_(trgVocab),
         srcIdx_(srcIdx),
         trgIdx_(trgIdx),
-        shared_(shared) {
+        shared_(shared),
+        perSentence_(options_->get<bool>("shortlist-per-sentence", false)) {
     std::vector<std::string> vals = options_->get<std::vector<std::string>>("shortlist");
 
     ABORT_IF(vals.empty(), "No path to filter path given");
     std::string fname = vals[0];
 
-    firstNum_ = vals.size() > 1 ? std::stoi(vals[1]) : 100;
-    bestNum_ = vals.size() > 2 ? std::stoi(vals[2]) : 100;
-    float threshold = vals.size() > 3 ? std::stof(vals[3]) : 0;
-    std::string dumpPath = vals.size() > 4 ? vals[4] : "";
-
-    LOG(info,
-        "[data] Loading lexical shortlist as {} {} {} {}",
-        fname,
-        firstNum_,
-        bestNum_,
-        threshold);
+    if(isBinaryShortlist(fname)) {
+      loadBinary(fname);
+      LOG(info, "[data] Mapped binary lexical shortlist {} {} {}", fname, firstNum_, bestNum_);
+      if(vals.size() > 1)
+        LOG(warn, "[data] Using first and best from binary shortlist {}, other parameters are ignored", fname);
+    } else {
+      firstNum_ = vals.size() > 1 ? std::stoi(vals[1]) : 100;
+      bestNum_ = vals.size() > 2 ? std::stoi(vals[2]) : 100;
+      float threshold = vals.size() > 3 ? std::stof(vals[3]) : 0;
+      std::string dumpPath = vals.size() > 4 ? vals[4] : "";
+
+      LOG(info,
+          "[data] Loading lexical shortlist as {} {} {} {}",
+          fname,
+          firstNum_,
+          bestNum_,
+          threshold);
+
+      prune(load(fname), threshold);
+
+      if(!dumpPath.empty())
+        dump(dumpPath);
+    }
 
-    load(fname);
-    prune(threshold);
+    initBitsets();
+  }
 
-    if(!dumpPath.empty())
-      dump(dumpPath);
+  // Writes the pruned short lists in the binary format, which can be given to --shortlist
+  // instead of the text lexicon.
+  void save(const std::string& fname) const {
+    LOG(info, "[data] Saving binary shortlist to {}", fname);
+    io::OutputFileStream out(fname);
+    Header header{BINARY_SHORTLIST_MAGIC, BINARY_SHORTLIST_VERSION,
+                  firstNum_, bestNum_, wordToOffsetSize_, shortListsSize_,
+                  srcVocab_->size(), trgVocab_->size()};
+    out.write(&header);
+    out.write(wordToOffset_, wordToOffsetSize_);
+    out.write(shortLists_, shortListsSize_);
   }
 
   virtual void dump(const std::string& prefix) override {
@@ -222,9 +441,9 @@ public:
 
     // Dump translation pairs from dictionary
     io::OutputFileStream outDic(prefix + ".dic");
-    for(WordIndex srcId = 0; srcId < data_.size(); srcId++) {
-      for(auto& it : data_[srcId]) {
-        auto trgId = it.first;
+    for(WordIndex srcId = 0; srcId + 1 < wordToOffsetSize_; srcId++) {
+      for(auto i = wordToOffset_[srcId]; i < wordToOffset_[srcId + 1]; i++) {
+        auto trgId = shortLists_[i];
         outDic << (*srcVocab_)[Word::fromWordIndex(srcId)] << "\t" << (*trgVocab_)[Word::fromWordIndex(trgId)] << std::endl;
       }
     }
@@ -232,35 +451,30 @@ public:
 
   virtual Ptr<Shortlist> generate(Ptr<data::CorpusBatch> batch) override {
     auto srcBatch = (*batch)[srcIdx_];
-    // auto trgBatch = (*batch)[trgIdx_];
+    const auto& data = srcBatch->data();
 
-    // add firstNum most frequent words
-    std::unordered_set<WordIndex> indexSet;
-    for(WordIndex i = 0; i < firstNum_ && i < trgVocab_->size(); ++i)
-      indexSet.insert(i);
+    if(!perSentence_) {
+      std::vector<WordIndex> srcWords;
+      srcWords.reserve(data.size());
+      for(auto i : data)
+        srcWords.push_back(i.toWordIndex());
 
-    // add all words from ground truth
-    // for(auto i : trgBatch->data())
-    //  indexSet.insert(i.toWordIndex());
-
-    // collect unique words form source
-    std::unordered_set<WordIndex> srcSet;
-    for(auto i : srcBatch->data())
-      srcSet.insert(i.toWordIndex());
-
-    // add aligned target words
-    for(auto i : srcSet) {
-      if(shared_)
-        indexSet.insert(i);
-      for(auto& it : data_[i])
-        indexSet.insert(it.first);
+      std::lock_guard<std::mutex> lock(mutex_);
+      return generate(srcWords);
     }
 
-    // turn into vector and sort (selected indices)
-    std::vector<WordIndex> indices(indexSet.begin(), indexSet.end());
-    std::sort(indices.begin(), indices.end());
-
-    return New<Shortlist>(indices);
+    // collect the words of each sentence without padding; data is [width, dimBatch]
+    size_t dimBatch = srcBatch->batchSize();
+    std::vector<std::vector<WordIndex>> srcWordsPerSentence(dimBatch);
+    for(size_t i = 0; i < data.size(); ++i)
+      if(srcBatch->mask()[i] != 0)
+        srcWordsPerSentence[i % dimBatch].push_back(data[i].toWordIndex());
+
+    std::vector<std::vector<WordIndex>> indicesPerSentence;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto& srcWords : srcWordsPerSentence)
+      indicesPerSentence.push_back(generate(srcWords)->indices());
+    return New<Shortlist>(indicesPerSentence);
   }
 };
 
@@ -0,0 +1,152 @@
+#include "graph/auto_tuner.h"
+#include "common/filesystem.h"
+#include "tensors/cpu/sharp/int_gemm.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace marian {
+
+const int AutoTunerState::SETTLE_SECONDS;
+
+Ptr<AutoTunerState> AutoTunerState::global() {
+  static Ptr<AutoTunerState> state = New<AutoTunerState>();
+  return state;
+}
+
+void AutoTunerState::useFile(const std::string& fileName, size_t numThreads) {
+  auto context = fmt::format("{}, {} kernels, {} threads",
+                             cpu::int16::cpuBrand(),
+                             cpu::int16::isaName(cpu::int16::getIsa()),
+                             numThreads);
+
+  flush(); // decisions for the previous file
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(fileName == fileName_ && context == context_)
+    return;
+  fileName_ = fileName;
+  context_ = context;
+  otherContexts_ = YAML::Node(YAML::NodeType::Map);
+
+  if(!filesystem::exists(fileName)) {
+    LOG(info, "[autotuner] {} does not exist yet, new decisions will be stored there", fileName);
+    return;
+  }
+
+  // a damaged file only costs the time to tune again, and is replaced by the next save()
+  std::unordered_map<size_t, size_t> decisions;
+  YAML::Node otherContexts(YAML::NodeType::Map);
+  try {
+    YAML::Node file = YAML::LoadFile(fileName);
+    for(const auto& it : file) {
+      auto key = it.first.as<std::string>();
+      if(key != context_) {
+        otherContexts[key] = it.second;
+        continue;
+      }
+      for(const auto& decision : it.second)
+        decisions[decision.first.as<size_t>()] = decision.second.as<size_t>();
+    }
+  } catch(const YAML::Exception& e) {
+    LOG(warn, "[autotuner] Ignoring {}, which cannot be read: {}", fileName, e.what());
+    return;
+  }
+
+  otherContexts_ = otherContexts;
+  done_.insert(decisions.begin(), decisions.end());
+  LOG(info, "[autotuner] Loaded {} decisions for {} from {}", decisions.size(), context_, fileName);
+}
+
+void AutoTunerState::save() {
+  std::lock_guard<std::mutex> fileLock(fileMutex_);
+  std::string fileName;
+  YAML::Node file;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!dirty_ || fileName_.empty())
+      return;
+    YAML::Node decisions(YAML::NodeType::Map);
+    for(const auto& it : done_)
+      decisions[it.first] = it.second;
+    file = YAML::Clone(otherContexts_);
+    file[context_] = decisions;
+    fileName = fileName_;
+    dirty_ = false;
+  }
+
+  // write to a temporary file first, so that other processes never read a partial file
+  std::string tempName = fileName + ".tmp";
+  {
+    std::ofstream out(tempName);
+    out << file;
+  }
+  if(std::rename(tempName.c_str(), fileName.c_str()) != 0)
+    LOG(warn, "[autotuner] Error {} ({}) renaming {} to {}", errno, strerror(errno), tempName, fileName);
+}
+
+bool AutoTunerState::getStat(size_t hash, Stat& stat) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = stats_.find(hash);
+  if(it == stats_.end())
+    return false;
+  stat = it->second;
+  return true;
+}
+
+void AutoTunerState::addStat(size_t hash, double seconds, size_t maxRuns) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = stats_.find(hash);
+  if(it != stats_.end()) {
+    if(it->second.runs < maxRuns) {
+      it->second.time += seconds;
+      it->second.runs += 1;
+    }
+  } else {
+    stats_.emplace(hash, Stat({seconds, 1}));
+  }
+}
+
+bool AutoTunerState::getDecision(size_t hash, size_t& bestHash) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = done_.find(hash);
+  if(it == done_.end())
+    return false;
+  bestHash = it->second;
+  return true;
+}
+
+void AutoTunerState::decide(const std::vector<size_t>& hashes, size_t bestHash) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for(auto hash : hashes)
+    done_[hash] = bestHash;
+  if(!fileName_.empty()) {
+    lastDecision_ = std::chrono::steady_clock::now();
+    dirty_ = true;
+  }
+}
+
+void AutoTunerState::undecide(const std::vector<size_t>& hashes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for(auto hash : hashes) {
+    done_.erase(hash);
+    stats_.erase(hash);
+  }
+}
+
+void AutoTunerState::saveIfSettled() {
+  if(!dirty_)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(std::chrono::steady_clock::now() - lastDecision_ < std::chrono::seconds(SETTLE_SECONDS))
+      return;
+  }
+  save();
+}
+
+void AutoTunerState::flush() {
+  save();
+}
+
+}  // namespace marian
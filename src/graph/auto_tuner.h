@@ -1,14 +1,83 @@
 #pragma once
 
+#include "3rd_party/yaml-cpp/yaml.h"
+#include "common/definitions.h"
 #include "common/timer.h"
 
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace marian {
 
+// Statistics and decisions of the autotuners, keyed by the hash of an algorithm for a specific
+// operation size. One instance is shared by the autotuners of all threads, so that each
+// operation size is only tuned once per process. The decisions can be stored in a file and
+// preloaded in later runs (see --gemm-autotune-file); they are kept per CPU model, kernel
+// instruction set and thread count, as the fastest algorithm depends on all of them. New decisions
+// are written to the file once no further decision has been made for SETTLE_SECONDS, and at exit.
+class AutoTunerState {
+public:
+  // This structure represents the collected statistics.
+  // time: total accumulated time of this operator execution with the given algorithm
+  // runs: total time this algorithm was executed
+  struct Stat {
+    double time;
+    size_t runs;
+  };
+
+private:
+  static const int SETTLE_SECONDS = 10;
+
+  std::mutex mutex_;
+  std::unordered_map<size_t, Stat> stats_;
+  std::unordered_map<size_t, size_t> done_; // hash of an algorithm -> hash of the fastest algorithm for the same operation
+
+  std::string fileName_;
+  std::string context_;  // CPU model, instruction set and thread count the decisions belong to
+  YAML::Node otherContexts_; // decisions from the file for other contexts, written back unchanged
+
+  std::atomic<bool> dirty_{false}; // decisions that are not in the file yet
+  std::chrono::steady_clock::time_point lastDecision_;
+  std::mutex fileMutex_;           // keeps writes of the file in order, taken before mutex_
+
+  // writes the decisions to the file if there are new ones; the file is written without
+  // holding mutex_, so that autotuners are not blocked
+  void save();
+
+public:
+  ~AutoTunerState() { flush(); }
+
+  // instance shared by the autotuners of all threads
+  static Ptr<AutoTunerState> global();
+
+  // Preloads the decisions for this machine and numThreads from fileName, if it exists, and stores
+  // new decisions there. Does nothing if already called with the same arguments.
+  void useFile(const std::string& fileName, size_t numThreads);
+
+  bool getStat(size_t hash, Stat& stat);
+  // Adds a run to the statistics of an algorithm unless it already has maxRuns runs
+  void addStat(size_t hash, double seconds, size_t maxRuns);
+
+  bool getDecision(size_t hash, size_t& bestHash);
+  // Records bestHash as the fastest of the given algorithms for one operation
+  void decide(const std::vector<size_t>& hashes, size_t bestHash);
+  // Drops the decisions for the given algorithms, to tune them again
+  void undecide(const std::vector<size_t>& hashes);
+
+  // Writes new decisions to the file if the last one was made SETTLE_SECONDS ago. Cheap if there
+  // is nothing to write, so it is called on every use of an autotuner.
+  void saveIfSettled();
+  // Writes new decisions to the file right away
+  void flush();
+};
+
 class AutoTunerRecorder {
 public:
   virtual void start(size_t hash) = 0;
@@ -27,6 +96,8 @@ private:
 
   UPtr<timer::CPUTimer> timer_;
 
+  Ptr<AutoTunerState> state_;
+
   // This structure holds a hash key an algorithm function (e.g. int16, packed gemm, mkl gemm)
   // for a specific operation size
   // hash: a unique hash key for each operation size
@@ -37,53 +108,76 @@ private:
     Algorithm algorithm;
   };
 
-  // This structure represents the collected statistics.
-  // time: total accumulated time of this operator execution with the given algorithm
-  // runs: total time this algorithm was executed
-  struct Stat {
-    double time;
-    size_t runs;
-  };
-
-  std::unordered_map<size_t, Stat> stats_;
+  // decisions of state_ that this autotuner has seen, for looking them up without locking
   std::unordered_map<size_t, size_t> done_;
 
   std::vector<HashedAlgorithm> algorithms_;
 
+  bool decided(size_t hash, size_t& bestHash) {
+    auto doneIt = done_.find(hash);
+    if(doneIt != done_.end()) {
+      bestHash = doneIt->second;
+      return true;
+    }
+    if(state_->getDecision(hash, bestHash)) {
+      done_[hash] = bestHash;
+      return true;
+    }
+    return false;
+  }
+
+  bool decided(size_t hash) {
+    size_t bestHash;
+    return decided(hash, bestHash);
+  }
+
   size_t choose() {
+    state_->saveIfSettled();
+
+    std::vector<size_t> hashes;
+    for(auto& a : algorithms_)
+      hashes.push_back(a.hash);
+
+    // Decisions are stored as the hash of the fastest algorithm, which may not be available in this
+    // call (e.g. a decision from a file written by a binary with FBGEMM); tune again in that case.
+    for(size_t i = 0; i < algorithms_.size(); ++i) {
+      size_t bestHash;
+      if(decided(algorithms_[i].hash, bestHash)) {
+        for(size_t j = 0; j < algorithms_.size(); ++j)
+          if(algorithms_[j].hash == bestHash)
+            return j;
+        for(auto hash : hashes)
+          done_.erase(hash);
+        state_->undecide(hashes);
+        break;
+      }
+    }
+
     size_t best = 0;
     double bestTime = std::numeric_limits<double>::max();
 
     for(size_t i = 0; i < algorithms_.size(); ++i) {
-      auto doneIt = done_.find(algorithms_[i].hash);
-      if(doneIt != done_.end())
-        return doneIt->second;
-
-      auto it = stats_.find(algorithms_[i].hash);
-      if(it != stats_.end()) {
-        auto& stat = it->second;
-
-        // collect more stats
-        if(stat.runs < collectStatMax)
-          return i;
-
-        if(stat.time < bestTime) {
-          bestTime = stat.time;
-          best = i;
-        }
-      } else {
-        // collect more stats
+      AutoTunerState::Stat stat;
+      // collect more stats
+      if(!state_->getStat(algorithms_[i].hash, stat) || stat.runs < collectStatMax)
         return i;
+
+      if(stat.time < bestTime) {
+        bestTime = stat.time;
+        best = i;
       }
     }
 
-    for(auto& a : algorithms_)
-      done_[a.hash] = best;
+    for(auto hash : hashes)
+      done_[hash] = algorithms_[best].hash;
+    state_->decide(hashes, algorithms_[best].hash);
 
     return best;
   }
 
 public:
+  AutoTuner(Ptr<AutoTunerState> state = AutoTunerState::global()) : state_(state) {}
+
   void insert(const HashedAlgorithm& ha) { algorithms_.push_back(ha); }
 
   void clear() { algorithms_.clear(); }
@@ -91,27 +185,20 @@ public:
   Return run(Args... args) { return algorithms_[choose()].algorithm(args...); }
 
   void start(size_t hash) override {
-    if(!timer_ && done_.count(hash) == 0)
+    if(!timer_ && !decided(hash))
       timer_.reset(new timer::CPUTimer());
   }
 
   void stop(size_t hash, bool stop) override {
-    if(stop && done_.count(hash) == 0) {
-      timer_->stop();
-
-      typedef std::chrono::duration<double> sec;
-      sec seconds = std::chrono::nanoseconds(timer_->elapsed().user);
-
-      auto it = stats_.find(hash);
-      if(it != stats_.end()) {
-        if(it->second.runs < collectStatMax) {
-          it->second.time += seconds.count();
-          it->second.runs += 1;
-        }
-      } else {
-        stats_.emplace(hash, Stat({seconds.count(), 1}));
+    // another thread may have decided since start(), so reset the timer in any case
+    if(stop && timer_) {
+      if(!decided(hash)) {
+        timer_->stop();
+
+        typedef std::chrono::duration<double> sec;
+        sec seconds = std::chrono::nanoseconds(timer_->elapsed().user);
+        state_->addStat(hash, seconds.count(), collectStatMax);
       }
-
       timer_.reset(nullptr);
     }
   }
@@ -0,0 +1,226 @@
+#include "graph/elementwise_fusion.h"
+#include "graph/expression_graph.h"
+#include "graph/node_operators_binary.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace marian {
+
+const size_t ElementwiseFusion::NONE;
+const int ElementwiseFusion::TILE;
+const int ElementwiseFusion::MIN_COLS;
+
+namespace {
+
+NaryNodeOp* asElementwise(const Expr& node) {
+  auto op = dynamic_cast<NaryNodeOp*>(node.get());
+  return op && node->value_type() == Type::float32 && op->isElementwise() ? op : nullptr;
+}
+
+bool isProduct(const Expr& node) {
+  if(!dynamic_cast<DotNodeOp*>(node.get()) && !dynamic_cast<AffineNodeOp*>(node.get()))
+    return false;
+  for(auto& child : node->children())
+    if(child->value_type() != Type::float32)
+      return false;
+  return node->value_type() == Type::float32;
+}
+
+}  // namespace
+
+ElementwiseFusion::ElementwiseFusion(std::list<Expr>& nodes) {
+  // A node can be merged into the node that reads it if that is its only reader and nothing but
+  // the list and the reader holds a reference to it. Nothing is copied before this is checked.
+  std::unordered_map<Chainable<Tensor>*, size_t> reads;
+  for(auto& node : nodes)
+    for(auto& child : node->children())
+      reads[child.get()]++;
+
+  std::unordered_set<Chainable<Tensor>*> mergeable;
+  for(auto& node : nodes) {
+    auto it = reads.find(node.get());
+    if(it != reads.end() && it->second == 1 && node.use_count() == 2 && !node->memoize()
+       && !node->marked_for_debug())
+      mergeable.insert(node.get());
+  }
+
+  // Grow the groups along the nodes; the group of an elementwise node takes over the groups of
+  // the children that can be merged into it.
+  std::unordered_map<Chainable<Tensor>*, Group> open; // by last node
+  for(auto& node : nodes) {
+    auto op = asElementwise(node);
+    if(!op)
+      continue;
+
+    Group group;
+    for(auto& child : node->children()) {
+      if(!mergeable.count(child.get()) || child->shape() != node->shape())
+        continue;
+      auto it = open.find(child.get());
+      if(it != open.end()) {
+        if(it->second.head && group.head)
+          continue; // only one product can be computed into the output
+        if(it->second.head)
+          group.head = it->second.head;
+        group.nodes.insert(group.nodes.end(), it->second.nodes.begin(), it->second.nodes.end());
+        group.ops.insert(group.ops.end(), it->second.ops.begin(), it->second.ops.end());
+        open.erase(it);
+      } else if(!group.head && isProduct(child)) {
+        group.head = child;
+      }
+    }
+    group.nodes.push_back(node);
+    group.ops.push_back(op);
+    open[node.get()] = std::move(group);
+  }
+
+  std::unordered_set<Chainable<Tensor>*> removed;
+  for(auto& it : open) {
+    auto& group = it.second;
+    if(group.nodes.size() + (group.head ? 1 : 0) < 2 || !finalize(group))
+      continue;
+    if(group.head)
+      removed.insert(group.head.get());
+    for(size_t i = 0; i + 1 < group.nodes.size(); ++i)
+      removed.insert(group.nodes[i].get());
+    groups_.emplace(it.first, std::move(group));
+  }
+
+  nodes.remove_if([&](const Expr& node) { return removed.count(node.get()) > 0; });
+}
+
+// Assigns the slots of the values in a tile: inputs first, then the output of the head, then one
+// per node. Returns false if the inputs cannot be read in tiles of the output.
+bool ElementwiseFusion::finalize(Group& group) {
+  std::unordered_map<Chainable<Tensor>*, size_t> slots;
+  auto inputSlot = [&](const Expr& input) {
+    auto it = slots.find(input.get());
+    if(it != slots.end())
+      return it->second;
+    group.inputs.push_back(input);
+    return slots[input.get()] = group.inputs.size() - 1;
+  };
+
+  group.bias = NONE;
+  if(group.head && dynamic_cast<AffineNodeOp*>(group.head.get()))
+    group.bias = inputSlot(group.head->child(2));
+  for(auto& node : group.nodes)
+    for(auto& child : node->children())
+      if(child != group.head && std::find(group.nodes.begin(), group.nodes.end(), child) == group.nodes.end())
+        inputSlot(child);
+
+  size_t numInputs = group.inputs.size();
+  if(group.head)
+    slots[group.head.get()] = numInputs;
+  for(size_t i = 0; i < group.nodes.size(); ++i)
+    slots[group.nodes[i].get()] = numInputs + 1 + i;
+
+  group.args.resize(group.nodes.size());
+  for(size_t i = 0; i < group.nodes.size(); ++i)
+    for(auto& child : group.nodes[i]->children())
+      group.args[i].push_back(slots[child.get()]);
+
+  // The inputs have to broadcast to the output, as in Element(). If none broadcasts, the output
+  // is one long row.
+  const auto& shape = group.nodes.back()->shape();
+  group.flat = true;
+  for(auto& input : group.inputs) {
+    const auto& inShape = input->shape();
+    if(input->value_type() != Type::float32 || inShape.size() > shape.size())
+      return false;
+    for(int i = 1; i <= inShape.size(); ++i)
+      if(inShape[-i] != 1 && inShape[-i] != shape[-i])
+        return false;
+    group.flat = group.flat && inShape.elements() == shape.elements();
+  }
+
+  group.cols = group.flat ? (int)shape.elements() : shape[-1];
+  group.rows = (int)shape.elements() / group.cols;
+  return group.rows == 1 || group.cols >= MIN_COLS;
+}
+
+bool ElementwiseFusion::forward(Expr node) {
+  auto it = groups_.find(node.get());
+  if(it == groups_.end())
+    return false;
+  run(node, it->second);
+  groups_.erase(it); // releases the merged nodes and the inputs
+  return true;
+}
+
+void ElementwiseFusion::run(Expr node, Group& group) {
+  Tensor out = node->val();
+  if(group.head) {
+    auto affine = std::dynamic_pointer_cast<AffineNodeOp>(group.head);
+    if(affine)
+      affine->setAddBias(false);
+    group.head->val() = out;
+    group.head->forward();
+    group.head->val() = nullptr; // the output belongs to node
+  }
+
+  // Row offsets of the inputs from the strides of the dimensions they do not broadcast. Inputs
+  // that broadcast along the columns are copied into the buffer.
+  const auto& shape = node->shape();
+  int dims = group.flat ? 0 : shape.size() - 1;
+  size_t numInputs = group.inputs.size();
+  std::vector<std::vector<int>> rowStrides(numInputs, std::vector<int>(dims, 0));
+  std::vector<bool> broadcastCols(numInputs);
+  std::vector<float*> data(numInputs);
+  for(size_t k = 0; k < numInputs; ++k) {
+    const auto& inShape = group.inputs[k]->shape();
+    int offset = shape.size() - inShape.size();
+    for(int d = std::max(offset, 0); d < dims; ++d)
+      rowStrides[k][d] = inShape[d - offset] == 1 ? 0 : inShape.stride(d - offset);
+    broadcastCols[k] = !group.flat && inShape[-1] == 1 && group.cols > 1;
+    data[k] = group.inputs[k]->val()->data();
+  }
+
+  std::vector<float> buffer((numInputs + group.nodes.size()) * TILE);
+  std::vector<float*> slots(numInputs + 1 + group.nodes.size());
+  std::vector<std::vector<float*>> args(group.nodes.size());
+  for(size_t i = 0; i < group.nodes.size(); ++i)
+    args[i].resize(group.args[i].size());
+
+  std::vector<int> rowOffsets(numInputs);
+  for(int r = 0; r < group.rows; ++r) {
+    for(size_t k = 0; k < numInputs; ++k) {
+      int offset = 0;
+      for(int d = dims - 1, index = r; d >= 0; index /= shape[d], --d)
+        offset += (index % shape[d]) * rowStrides[k][d];
+      rowOffsets[k] = offset;
+    }
+
+    for(int c = 0; c < group.cols; c += TILE) {
+      int n = std::min(TILE, group.cols - c);
+      float* outTile = out->data() + (size_t)r * group.cols + c;
+
+      for(size_t k = 0; k < numInputs; ++k) {
+        if(broadcastCols[k]) {
+          slots[k] = buffer.data() + k * TILE;
+          std::fill(slots[k], slots[k] + n, data[k][rowOffsets[k]]);
+        } else {
+          slots[k] = data[k] + rowOffsets[k] + c;
+        }
+      }
+
+      // the product is already in the output
+      slots[numInputs] = outTile;
+      if(group.bias != NONE) {
+        using namespace functional;
+        cpu::ElementContiguous(_1 = _1 + _2, n, outTile, slots[group.bias]);
+      }
+
+      for(size_t i = 0; i < group.nodes.size(); ++i) {
+        float* result = i + 1 == group.nodes.size() ? outTile : buffer.data() + (numInputs + i) * TILE;
+        for(size_t j = 0; j < args[i].size(); ++j)
+          args[i][j] = slots[group.args[i][j]];
+        group.ops[i]->forwardElementwise(result, args[i].data(), n);
+        slots[numInputs + 1 + i] = result;
+      }
+    }
+  }
+}
+
+}  // namespace marian
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/allocator.h"
+#include "tensors/tensor.h"
+
+#include "graph/chainable.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+struct NaryNodeOp;
+
+/**
+ * @brief Merges connected elementwise operations into one pass over memory (CPU inference)
+ *
+ * Chains such as bias, activation and residual connection run as separate nodes, and each of them
+ * reads and writes a tensor of the full size. The fusion groups elementwise nodes (see
+ * NaryNodeOp::isElementwise()) whose value is only read by another elementwise node of the same
+ * shape. Only the last node of a group is run; it computes all operations of the group for one
+ * tile of the output at a time and keeps the intermediate values of the tile in a small buffer.
+ * Inputs from outside of the group are read in place, broadcasting as in Element().
+ *
+ * A matrix product (dot, affine) that is only read by the group is computed into the output of
+ * the group first, and the elementwise operations are applied to it in place. For affine, the
+ * bias is added in the same loop instead of by a second product with a column of ones.
+ *
+ * The intermediate nodes of a group never get a value, so nodes are only merged if nothing
+ * outside of the graph holds a reference to them. This is only correct without a backward step
+ * and while no GraphTrace is recorded, which replays single nodes.
+ */
+class ElementwiseFusion {
+private:
+  struct Group {
+    Expr head;                              // matrix product computed into the output, or nullptr
+    std::vector<Expr> nodes;                // elementwise nodes in the order in which they run
+    std::vector<NaryNodeOp*> ops;           // ... as operations
+    std::vector<Expr> inputs;               // values from outside of the group
+    std::vector<std::vector<size_t>> args;  // per node, slots of its children (see run())
+    size_t bias;                            // input with the bias of an affine head, or NONE
+    bool flat;                              // no input broadcasts
+    int rows;                               // the output is processed as rows x cols values
+    int cols;
+  };
+
+  static const size_t NONE = (size_t)-1;
+  static const int TILE = 512;   // values per pass over the operations of a group
+  static const int MIN_COLS = 16; // smaller rows are not worth a loop per operation
+
+  std::unordered_map<Chainable<Tensor>*, Group> groups_; // by last node
+
+  bool finalize(Group& group);
+  void run(Expr node, Group& group);
+
+public:
+  // Finds the groups among nodes, which are in the order in which they run, and removes all
+  // nodes from the list except for the last one of each group
+  ElementwiseFusion(std::list<Expr>& nodes);
+
+  // Computes the group if node is the last node of one, otherwise returns false
+  bool forward(Expr node);
+};
+
+}  // namespace marian
@@ -6,7 +6,10 @@
 namespace marian {
 
 ExpressionGraph::ExpressionGraph(bool inference)
-    : inferenceOnly_(inference), backend_(nullptr) {}
+    : inferenceOnly_(inference), backend_(nullptr) {
+  if(GraphProfiler::global()->enabled())
+    profiler_ = GraphProfiler::global();
+}
 
 void ExpressionGraph::setDevice(DeviceId deviceId, Ptr<Device> device) {
   if(!backend_) {
@@ -38,8 +41,8 @@ void ExpressionGraph::save(std::vector<io::Item>& ioItems) {
         pName = pName.substr(namespace_.size() + 2);
     }
 
-    ABORT_IF(p.second->val()->type() != Type::float32,
-             "Only float32 supported at the moment");
+    ABORT_IF(p.second->val()->type() != Type::float32 && !isPacked(p.second->val()->type()),
+             "Only float32 and packed types supported at the moment");
 
     Tensor val = p.second->val();
 
@@ -6,10 +6,15 @@
 #include "tensors/tensor_allocator.h"
 
 #include "graph/chainable.h"
+#include "graph/elementwise_fusion.h"
+#include "graph/memory_plan.h"
+#include "graph/node_pool.h"
+#include "graph/profiler.h"
 #include "graph/node_initializers.h"
 #include "graph/node_operators.h"
 #include "graph/parameters.h"
 
+#include <algorithm>
 #include <map>
 #include <unordered_set>
 
@@ -110,6 +115,51 @@ public:
   void clearLongtermMemory() { longterm_->clear(); }
 };
 
+/**
+ * Forward nodes recorded during one call of ExpressionGraph::forwardNext() (see startTrace()).
+ *
+ * The nodes keep their children and tensors, so that the same computation can be run again
+ * by ExpressionGraph::replay() without building new nodes. New data enters through named
+ * constants (setInput()). Results of a run that the next run reads, e.g. decoder states, are fed
+ * back by the caller, who copies them into the values of the nodes they are read from before
+ * replaying again.
+ */
+class GraphTrace {
+private:
+  std::vector<Expr> nodes_;
+  Ptr<MemoryPlan> plan_;
+
+public:
+  void push_back(Expr node) { nodes_.push_back(node); }
+
+  const std::vector<Expr>& nodes() const { return nodes_; }
+
+  // Packs the intermediate values of the recorded nodes into one arena, see MemoryPlan. Must be
+  // called after all references to values that are read after a run, e.g. to feed them back, have
+  // been taken. The current intermediate values are lost.
+  Ptr<MemoryPlan> planMemory(Ptr<Allocator> allocator) {
+    plan_ = New<MemoryPlan>(nodes_, allocator);
+    plan_->apply();
+    return plan_;
+  }
+
+  // Overwrite the values of all recorded constants with the given name.
+  template <typename T>
+  void setInput(const std::string& name, const std::vector<T>& values) {
+    size_t found = 0;
+    for(auto& node : nodes_) {
+      if(node->type() == "const" && node->name() == name) {
+        ABORT_IF(node->shape().elements() != values.size(),
+                 "Replayed input '{}' has {} values, recorded shape is {}",
+                 name, values.size(), node->shape());
+        node->val()->set(values);
+        found++;
+      }
+    }
+    ABORT_IF(found == 0, "Input '{}' does not occur in recorded graph", name);
+  }
+};
+
 class ExpressionGraph : public std::enable_shared_from_this<ExpressionGraph> {
 private:
   size_t count_{0};
@@ -136,6 +186,13 @@ private:
 
   bool throwNaN_{false};
 
+  Ptr<GraphTrace> trace_; // set between startTrace() and stopTrace()
+
+  Ptr<NodePool> nodePool_{New<NodePool>()}; // memory of the nodes, see Expression()
+  Ptr<GraphProfiler> profiler_;             // set with --profile
+  bool shorttermMemoization_{true};
+  bool elementwiseFusion_{false};
+
 protected:
   // Delete, copy and move constructors
   ExpressionGraph(const ExpressionGraph&) = delete;
@@ -151,6 +208,29 @@ public:
   void setInference(bool inference) { inferenceOnly_ = inference; }
   bool isInference() { return inferenceOnly_; }
 
+  /**
+   * @brief Whether add() looks for an identical node built since the last forward step
+   *
+   * This short-term memoization hashes every new node and keeps it in a lookup table. Graphs
+   * that never build the same expression twice, like those of most decoders, can switch it off
+   * to build their nodes faster. Memoized nodes (constants and parameters during inference) are
+   * looked up either way.
+   */
+  void setShorttermMemoization(bool memoize) { shorttermMemoization_ = memoize; }
+
+  /**
+   * @brief Whether forward() merges chains of elementwise operations into single passes
+   *
+   * Only applies to inference on CPU, see ElementwiseFusion. Not applied to the steps that are
+   * recorded for replay().
+   */
+  void setElementwiseFusion(bool fuse) { elementwiseFusion_ = fuse; }
+
+  Ptr<NodePool> nodePool() { return nodePool_; }
+
+  // Reports the time of every node to the given profiler; graphs use the global one with --profile
+  void setProfiler(Ptr<GraphProfiler> profiler) { profiler_ = profiler; }
+
   ~ExpressionGraph() {
     clear();
     params_->clear();
@@ -218,11 +298,23 @@ public:
     // @TODO: check if allocation works properly
     tensors_->clearShorttermMemory();
 
+    double callBegin = profiler_ ? profiler_->now() : 0;
+    UPtr<ElementwiseFusion> fusion;
+    if(elementwiseFusion_ && inferenceOnly_ && !trace_ && backend_->getDeviceId().type == DeviceType::cpu)
+      fusion.reset(new ElementwiseFusion(nodesForward_)); // removes the merged nodes
+    size_t numNodes = nodesForward_.size();
     while(!nodesForward_.empty()) {
       auto v = nodesForward_.front();
-      v->allocate();
+      double begin = profiler_ ? profiler_->now() : 0;
+      size_t elements = v->allocate();
       v->init();
-      v->forward();
+      if(!fusion || !fusion->forward(v))
+        v->forward();
+
+      if(profiler_) {
+        backend_->synchronize();
+        profiler_->record(v, /*backward=*/false, begin, elements * sizeOf(v->value_type()));
+      }
 
       checkNan(v->val());
 
@@ -232,10 +324,50 @@ public:
         std::cerr << v->val()->debug() << std::endl;
       }
 
-      if(inferenceOnly_)
+      // During inference, a node is only referenced by the nodes that consume it, by
+      // nodesForward_ and by whoever holds it outside of the graph (e.g. decoder states).
+      // Dropping the children after the forward step therefore destroys each intermediate node
+      // right after its last consumer has run, and ~Node() returns its value to the allocator.
+      // Memoized nodes are kept alive by the long-term memory, parameters by the ParameterTree.
+      if(trace_)
+        trace_->push_back(v); // recorded nodes keep their children for replay()
+      else if(inferenceOnly_)
         v->children().clear();
       nodesForward_.pop_front();
     }
+
+    if(profiler_)
+      profiler_->recordCall("forward", callBegin, numNodes);
+  }
+
+  /**
+   * @brief Records the nodes that are executed by the following calls of forwardNext()
+   *
+   * Used during translation to build the graph of a decoding step only once and then run it
+   * again for later steps with replay(), as long as shapes stay the same.
+   */
+  void startTrace() { trace_ = New<GraphTrace>(); }
+
+  Ptr<GraphTrace> stopTrace() {
+    auto trace = trace_;
+    trace_ = nullptr;
+    return trace;
+  }
+
+  // Runs the forward step of all recorded nodes again, without allocating or building anything.
+  void replay(Ptr<GraphTrace> trace) {
+    double callBegin = profiler_ ? profiler_->now() : 0;
+    for(auto& v : trace->nodes()) {
+      double begin = profiler_ ? profiler_->now() : 0;
+      v->forward();
+      if(profiler_) {
+        backend_->synchronize();
+        profiler_->record(v, /*backward=*/false, begin, /*bytes=*/0);
+      }
+      checkNan(v->val());
+    }
+    if(profiler_)
+      profiler_->recordCall("replay", callBegin, trace->nodes().size());
   }
 
   void backward(bool zero = true) {
@@ -265,18 +397,30 @@ public:
 
     tensors_->clearShorttermMemory();
 
+    double callBegin = profiler_ ? profiler_->now() : 0;
+    size_t numNodes = nodesBackward_.size();
     while(!nodesBackward_.empty()) {
       auto v = nodesBackward_.back();
       nodesBackward_.pop_back();
 
+      double begin = profiler_ ? profiler_->now() : 0;
+      size_t bytes = 0; // gradients allocated for the children
       for(auto&& child : v->children()) {
-        if(child->trainable() && child->type() != "param")
+        if(child->trainable() && child->type() != "param") {
+          if(!child->grad())
+            bytes += child->shape().elements() * sizeOf(child->value_type());
           child->set_zero_adjoint();
+        }
       }
 
       if(v->trainable())
         v->backward();
 
+      if(profiler_) {
+        backend_->synchronize();
+        profiler_->record(v, /*backward=*/true, begin, bytes);
+      }
+
       checkNan(v->grad());
 
       if(v->trainable() && v->marked_for_debug()) {
@@ -286,6 +430,9 @@ public:
 
       v->children().clear();
     }
+
+    if(profiler_)
+      profiler_->recordCall("backward", callBegin, numNodes);
   }
 
   std::string graphviz() {
@@ -311,10 +458,13 @@ public:
     dot.close();
   }
 
+  // Parameters that were loaded keep the type they were stored with, e.g. the packed types
+  // written by marian-conv --gemm-type.
   Expr param(const std::string& pname,
              const Shape& shape,
              const NodeInitializer& init,
-             bool fixed = false) {
+             bool fixed = false,
+             Type value_type = Type::float32) {
     std::string name = pname;
     if(!namespace_.empty())
       name = namespace_ + "::" + name;
@@ -344,7 +494,7 @@ public:
     ABORT_IF(get(name), "Non-parameter with name '{}' already exists", name);
 
     // create parameter node (adds to tape)
-    p = Expression<ParamNode>(shared_from_this(), shape, init, fixed);
+    p = Expression<ParamNode>(shared_from_this(), shape, init, fixed, value_type);
 
     // set name and id and add to list of parameters
     p->set_name(name);
@@ -401,7 +551,7 @@ public:
   Ptr<Parameters>& params() { return params_; }
 
   Expr add(Expr node) {
-    auto found = tensors_->findOrRemember(node);
+    auto found = shorttermMemoization_ || node->memoize() ? tensors_->findOrRemember(node) : nullptr;
     if(found) {
       return found;
     } else {
@@ -447,6 +597,7 @@ public:
     nodesBackward_.clear();
 
     topNodes_.clear();
+    trace_ = nullptr;
 
     tensors_->clear();
   }
@@ -466,7 +617,7 @@ public:
       // skip over special parameters starting with "special:"
       if(pName.substr(0, 8) == "special:")
         continue;
-      param(pName, item.shape, inits::from_item(item));
+      param(pName, item.shape, inits::from_item(item), /*fixed=*/false, item.type);
     }
     if(markReloaded)
       setReloaded(true);
@@ -510,9 +661,44 @@ public:
   }
 };
 
+// The graph of the first argument of a node constructor that is an expression, a vector of
+// expressions or a graph, nullptr if there is none
+inline Ptr<ExpressionGraph> graphOf() { return nullptr; }
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const Expr& a, const Rest&...);
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const std::vector<Expr>& nodes, const Rest&... rest);
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const Ptr<ExpressionGraph>& graph, const Rest&...);
+template <class A, typename... Rest>
+Ptr<ExpressionGraph> graphOf(const A&, const Rest&... rest);
+
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const Expr& a, const Rest&...) {
+  return a->graph();
+}
+
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const std::vector<Expr>& nodes, const Rest&... rest) {
+  return nodes.empty() ? graphOf(rest...) : nodes.front()->graph();
+}
+
+template <typename... Rest>
+Ptr<ExpressionGraph> graphOf(const Ptr<ExpressionGraph>& graph, const Rest&...) {
+  return graph;
+}
+
+template <class A, typename... Rest>
+Ptr<ExpressionGraph> graphOf(const A&, const Rest&... rest) {
+  return graphOf(rest...);
+}
+
 template <class T, typename... Args>
 Expr Expression(Args&&... args) {
-  auto e = Expr(new T(std::forward<Args>(args)...));
+  auto graph = graphOf(args...);
+  auto e = graph ? Expr(std::allocate_shared<T>(NodePoolAllocator<T>(graph->nodePool()),
+                                                std::forward<Args>(args)...))
+                 : Expr(new T(std::forward<Args>(args)...));
   return e->graph()->add(e);
 }
 }  // namespace marian
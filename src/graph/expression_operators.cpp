@@ -389,6 +389,9 @@ Expr dot(Expr a, Expr b, bool transA, bool transB, float scale) {
   auto device = a->graph()->getDeviceId().type;
   float clipValue = a->graph()->getBackend()->getClip();
 
+  ABORT_IF(isPacked(b->value_type()),
+           "Weights of type {} are only supported by affine()", b->value_type());
+
   // Currently only true when command line options
   // --optimize --cpu-thread=N with N > 0 are set.
   if(device == DeviceType::cpu && a->graph()->getBackend()->isOptimized()
@@ -410,11 +413,37 @@ Expr bdot(Expr a, Expr b, bool transA, bool transB, float scale) {
   return Expression<DotBatchedNodeOp>(a, b, transA, transB, scale);
 }
 
+// affine() with weights that were stored in a packed type by marian-conv --gemm-type. They are
+// used as they are, independent of --gemm-type.
+static Expr affinePacked(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
+  ABORT_IF(a->graph()->getDeviceId().type != DeviceType::cpu,
+           "Weights of type {} are only supported on the CPU", b->value_type());
+  ABORT_IF(transB, "Weights of type {} cannot be transposed", b->value_type());
+
+  float clipValue = a->graph()->getBackend()->getClip();
+  int k = b->shape()[-2];
+  int n = b->shape()[-1];
+  switch(b->value_type()) {
+    case Type::intrinint16: // stored as [n, k], as dotInt16 computes A * B.T
+      return cpu::int16::affine(
+          cpu::int16::quantize(transA ? transpose(a) : a, clipValue), reshape(b, {n, k}), bias, scale);
+    case Type::packed16:
+      return cpu::variant::affine(clip(a, clipValue), b, b->shape(), bias, transA, transB, scale);
+    case Type::packed8:
+      return cpu::variant::affine(clip(a, clipValue), b, b->shape(), bias, transA, transB, scale, cpu::variant::PackType::Int8);
+    default:
+      ABORT("Weights of type {} are not supported by affine()", b->value_type());
+  }
+}
+
 Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
   auto device = a->graph()->getDeviceId().type;
 
   float clipValue = a->graph()->getBackend()->getClip();
 
+  if(isPacked(b->value_type()))
+    return affinePacked(a, b, bias, transA, transB, scale);
+
   if(device == DeviceType::cpu && a->graph()->getBackend()->isOptimized()) {
     GemmType gemmType = a->graph()->getBackend()->getGemmType();
     // When gemmType is set to 'auto', an autotuner decides the best algorithm available.
@@ -483,6 +512,31 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
               true);
         };
         tuner->insert({hashPack, algPack});
+
+        // add int8 packed GEMM algorithm variant to the autotuner
+        size_t hashPackInt8 = hash;
+        util::hash_combine(hashPackInt8, 4);
+        auto recPackInt8 = [=](Expr e, bool stop = false) {
+          e->record(tuner, hashPackInt8, stop);
+          return e;
+        };
+
+        auto algPackInt8 = [=]() {
+          auto packed = cpu::variant::pack(b, cpu::variant::PackMatrix::B, transB, clipValue, cpu::variant::PackType::Int8);
+
+          return recPackInt8(
+              cpu::variant::affine(
+                  clip(a, clipValue),
+                  packed,
+                  b->shape(),
+                  bias,
+                  transA,
+                  transB,
+                  scale,
+                  cpu::variant::PackType::Int8),
+              true);
+        };
+        tuner->insert({hashPackInt8, algPackInt8});
       }
 #endif // USE_FBGEMM
 
@@ -545,15 +599,18 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
             cpu::int16::quantize(transB ? b : transpose(b), clipValue),
             bias,
             scale);
-      } else if(gemmType == GemmType::FbFp16Packed) {
+      } else if(gemmType == GemmType::FbFp16Packed || gemmType == GemmType::FbInt8Packed) {
 #if USE_FBGEMM
         // 07/10/2019 - Use packed GEMM only if the cpu architecture supports AVX2
         // one of the fbgemm's sub modules, cpuinfo (https://github.com/pytorch/cpuinfo).
         // It looks at the cpu register
         // (https://github.com/pytorch/cpuinfo/blob/master/src/x86/isa.c#L391),
         // and this cpu lookup is executed only once and the state is kept in FBGEMM.
+        // fp16 and int8 use the same packing scheme: the weights are packed once, as the pack
+        // node of a memoized matrix is memoized as well.
         if(fbgemm::fbgemmHasAvx2Support() && b->memoize()) {
-          auto packed = cpu::variant::pack(b, cpu::variant::PackMatrix::B, transB, clipValue);
+          auto packType = gemmType == GemmType::FbInt8Packed ? cpu::variant::PackType::Int8 : cpu::variant::PackType::Fp16;
+          auto packed = cpu::variant::pack(b, cpu::variant::PackMatrix::B, transB, clipValue, packType);
 
           return cpu::variant::affine(
               clip(a, clipValue),
@@ -562,7 +619,8 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
               bias,
               transA,
               transB,
-              scale);
+              scale,
+              packType);
         } else {
           int rows = a->shape().elements() / a->shape()[-1];
           Expr ones = a->graph()->ones({rows, 1});
@@ -606,6 +664,60 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
   }
 }
 
+Expr prepareAffineWeights(Expr b, bool transB) {
+  auto graph = b->graph();
+  if(graph->getDeviceId().type != DeviceType::cpu || !graph->getBackend()->isOptimized())
+    return nullptr;
+
+  float clipValue = graph->getBackend()->getClip();
+  switch(graph->getBackend()->getGemmType()) {
+    case GemmType::IntrinInt16:
+      return cpu::int16::quantize(transB ? b : transpose(b), clipValue);
+#if USE_FBGEMM
+    case GemmType::FbFp16Packed:
+      if(fbgemm::fbgemmHasAvx2Support())
+        return cpu::variant::pack(b, cpu::variant::PackMatrix::B, transB, clipValue);
+      return nullptr;
+    case GemmType::FbInt8Packed:
+      if(fbgemm::fbgemmHasAvx2Support())
+        return cpu::variant::pack(b, cpu::variant::PackMatrix::B, transB, clipValue, cpu::variant::PackType::Int8);
+      return nullptr;
+#endif  // USE_FBGEMM
+    default: // with auto, the autotuner picks the algorithm per product
+      return nullptr;
+  }
+}
+
+Expr affinePrepared(Expr a, Expr preparedB, const Shape& bShape, Expr bias, bool transA, bool transB, float scale) {
+  auto backend = a->graph()->getBackend();
+  float clipValue = backend->getClip();
+  switch(backend->getGemmType()) {
+    case GemmType::IntrinInt16:
+      return cpu::int16::affine(cpu::int16::quantize(transA ? transpose(a) : a, clipValue), preparedB, bias, scale);
+#if USE_FBGEMM
+    case GemmType::FbFp16Packed:
+      return cpu::variant::affine(clip(a, clipValue), preparedB, bShape, bias, transA, transB, scale);
+    case GemmType::FbInt8Packed:
+      return cpu::variant::affine(clip(a, clipValue), preparedB, bShape, bias, transA, transB, scale, cpu::variant::PackType::Int8);
+#endif  // USE_FBGEMM
+    default:
+      ABORT("GemmType..{} has no prepared weights", backend->getGemmType());
+  }
+}
+
+Expr packWeights(Expr b, Type packedType) {
+  switch(packedType) {
+    case Type::intrinint16:
+      return cpu::int16::quantize(transpose(b), /*clipValue=*/0.f);
+    case Type::packed16:
+      return cpu::variant::pack(b, cpu::variant::PackMatrix::B, /*transpose=*/false, /*clipValue=*/0.f);
+    case Type::packed8:
+      return cpu::variant::pack(b, cpu::variant::PackMatrix::B, /*transpose=*/false, /*clipValue=*/0.f, cpu::variant::PackType::Int8);
+    default:
+      ABORT("{} is not a packed type", packedType);
+  }
+}
+
 // multiply a CSR matrix A with a matrix B
 // A[i,j] is at A_values[A_offsets[i]+k], where k is position of j in A_indices[A_offsets[i]:A_offsets[i+1]]
 // @TODO: Define a proper sparse tensor type.
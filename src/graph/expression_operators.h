@@ -115,6 +115,26 @@ Expr affine(Expr a,
             bool transB = false,
             float scalar = 1.f);
 
+// Weight matrix b of affine() converted once into the format of the GEMM type of an optimized CPU
+// backend (quantized for intrinint16, packed for fp16packed). This is for weights that are reused
+// by many products but are not memoized, e.g. shortlisted output embeddings within one batch.
+// Returns nullptr if there is no such format; otherwise use the result with affinePrepared().
+Expr prepareAffineWeights(Expr b, bool transB = false);
+
+// affine() with weights from prepareAffineWeights(); bShape is the shape of the original b
+Expr affinePrepared(Expr a,
+                    Expr preparedB,
+                    const Shape& bShape,
+                    Expr c,
+                    bool transA = false,
+                    bool transB = false,
+                    float scalar = 1.f);
+
+// Weight matrix b of affine() in the packed type for the corresponding GEMM type (intrinint16,
+// packed16 or packed8), for storing it in a model; see marian-conv --gemm-type. affine() uses
+// parameters of these types as they are.
+Expr packWeights(Expr b, Type packedType);
+
 Expr csr_dot(const Shape& A_shape, Expr Avalues, Expr Aindices, Expr Aoffsets, Expr B, bool transA = false);
 Expr dot_csr(Expr A, const Shape& B_shape, Expr B_values, Expr B_indices, Expr B_offsets, bool transB = false);
 
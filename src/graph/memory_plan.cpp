@@ -0,0 +1,123 @@
+#include "graph/memory_plan.h"
+#include "graph/node_operators_unary.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace marian {
+
+namespace {
+
+// Views own no memory, they read the value of their first child.
+bool isView(const Expr& node) {
+  return std::dynamic_pointer_cast<ReshapeNodeOp>(node)
+         || std::dynamic_pointer_cast<SliceViewNodeOp>(node);
+}
+
+}  // namespace
+
+MemoryPlan::MemoryPlan(const std::vector<Expr>& nodes, Ptr<Allocator> allocator)
+    : allocator_(allocator) {
+  const size_t NONE = (size_t)-1;
+
+  std::unordered_map<Chainable<Tensor>*, size_t> positions;
+  for(size_t i = 0; i < nodes.size(); ++i)
+    positions[nodes[i].get()] = i;
+
+  // For each node, the node that owns its memory (itself or, for views, the viewed node), the
+  // last position at which that memory is read, and the references from within the trace: one
+  // from the trace itself, one per consumer, and the member of a view that holds the viewed node.
+  std::vector<size_t> owners(nodes.size()), lasts(nodes.size());
+  std::vector<long> internalRefs(nodes.size(), 1);
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    owners[i] = i;
+    lasts[i] = i;
+    for(auto& child : nodes[i]->children()) {
+      auto it = positions.find(child.get());
+      if(it == positions.end())
+        continue;
+      internalRefs[it->second]++;
+      size_t owner = owners[it->second];
+      if(owner != NONE)
+        lasts[owner] = std::max(lasts[owner], i);
+    }
+    if(isView(nodes[i])) {
+      auto it = positions.find(nodes[i]->child(0).get());
+      owners[i] = it != positions.end() ? owners[it->second] : NONE;
+      if(it != positions.end())
+        internalRefs[it->second]++;
+    }
+  }
+
+  // Nodes that are referenced from outside, directly or through a view, must keep their values.
+  std::vector<bool> kept(nodes.size(), false);
+  for(size_t i = 0; i < nodes.size(); ++i)
+    if(owners[i] != NONE && nodes[i].use_count() > internalRefs[i])
+      kept[owners[i]] = true;
+
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    const auto& node = nodes[i];
+    if(owners[i] != i || !node->val() || !allocator_->owns(node->val()->memory()))
+      continue; // views and values that are not in the workspace, e.g. memoized ones
+    size_t bytes = node->val()->memory()->size();
+    if(kept[i] || node->type() == "const" || node->memoize()) {
+      keptBytes_ += bytes;
+    } else {
+      slots_.push_back({node, i, lasts[i], bytes, 0});
+      plannedBytes_ += bytes;
+    }
+  }
+
+  assignOffsets();
+}
+
+MemoryPlan::~MemoryPlan() {
+  if(arena_)
+    allocator_->free(arena_);
+}
+
+void MemoryPlan::assignOffsets() {
+  std::vector<Slot*> order;
+  for(auto& slot : slots_)
+    order.push_back(&slot);
+  std::stable_sort(order.begin(), order.end(), [](const Slot* a, const Slot* b) {
+    return a->bytes > b->bytes;
+  });
+
+  // Place each value at the lowest offset that is free during its lifetime. Slots are aligned
+  // already, since their sizes come from the allocator.
+  std::vector<Slot*> placed; // sorted by offset
+  for(auto slot : order) {
+    size_t offset = 0;
+    for(auto other : placed) {
+      if(other->last < slot->first || slot->last < other->first)
+        continue; // lifetimes do not overlap
+      if(other->offset >= offset + slot->bytes)
+        break; // fits into the gap before other
+      offset = std::max(offset, other->offset + other->bytes);
+    }
+    slot->offset = offset;
+    arenaBytes_ = std::max(arenaBytes_, offset + slot->bytes);
+    placed.insert(std::upper_bound(placed.begin(), placed.end(), slot,
+                                   [](const Slot* a, const Slot* b) { return a->offset < b->offset; }),
+                  slot);
+  }
+}
+
+void MemoryPlan::apply() {
+  if(slots_.empty())
+    return;
+
+  // free the old values first, so that the arena can take their place
+  for(auto& slot : slots_)
+    allocator_->free(slot.node->val()->memory());
+  arena_ = allocator_->alloc(arenaBytes_);
+
+  for(auto& slot : slots_) {
+    auto& val = slot.node->val();
+    val.reset(new TensorBase(allocator_->view(arena_, slot.offset, slot.bytes),
+                             val->shape(), val->type(), val->getBackend()));
+  }
+}
+
+}  // namespace marian
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/allocator.h"
+#include "tensors/tensor.h"
+
+#include "graph/chainable.h"
+
+#include <vector>
+
+namespace marian {
+
+/**
+ * @brief Static assignment of the values of recorded nodes (see GraphTrace) to one arena
+ *
+ * The lifetime of an intermediate value reaches from the node that computes it to its last
+ * consumer among the recorded nodes, including consumers of views (reshape(), sliceView()) of it.
+ * Values with disjoint lifetimes may share memory, so the arena only has to hold the largest set
+ * of values that are alive at the same time. Offsets are assigned greedily, largest values first,
+ * at the lowest offset that does not overlap a value with an overlapping lifetime.
+ *
+ * Values that must outlive a run of the recorded nodes keep their own memory: constants, which
+ * are the inputs of the trace, memoized nodes and parameters, and nodes that are still referenced
+ * from outside of the trace, e.g. the decoder states and scores that are read after a replay.
+ *
+ * The plan is applied once after recording, which moves the planned values into the arena and
+ * returns their old memory to the allocator. Replaying the trace then allocates nothing, and the
+ * memory it needs is exactly peakBytes().
+ */
+class MemoryPlan {
+public:
+  struct Slot {
+    Expr node;
+    size_t first;  // position of the node
+    size_t last;   // position of its last consumer
+    size_t bytes;
+    size_t offset;
+  };
+
+private:
+  std::vector<Slot> slots_;
+  size_t arenaBytes_{0};
+  size_t plannedBytes_{0};
+  size_t keptBytes_{0};
+
+  Ptr<Allocator> allocator_;
+  Ptr<MemoryPiece> arena_;
+
+  void assignOffsets();
+
+public:
+  // Computes the plan for nodes in the order in which they are run. Values that are not owned by
+  // allocator (e.g. memoized ones) are not planned.
+  MemoryPlan(const std::vector<Expr>& nodes, Ptr<Allocator> allocator);
+  ~MemoryPlan();
+
+  // Moves the planned values into a newly allocated arena. Their current contents are lost.
+  void apply();
+
+  const std::vector<Slot>& slots() const { return slots_; }
+  size_t numPlanned() const { return slots_.size(); }
+  size_t arenaBytes() const { return arenaBytes_; }     // memory of all planned values after packing
+  size_t plannedBytes() const { return plannedBytes_; } // ... and before
+  size_t keptBytes() const { return keptBytes_; }       // memory of the recorded values that are not planned
+  size_t peakBytes() const { return arenaBytes_ + keptBytes_; }
+};
+
+}  // namespace marian
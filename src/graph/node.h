@@ -181,6 +181,17 @@ struct NaryNodeOp : public Node {
 
   std::vector<Expr>& children() override { return children_; }
 
+  // Elementwise operations return true here if ElementwiseFusion may merge them with the
+  // elementwise operations around them, see graph/elementwise_fusion.h
+  virtual bool isElementwise() { return false; }
+
+  // Computes n consecutive values of the output from the values at the same positions of the
+  // children, one array per child (CPU). out may be one of the arrays, so each value has to be
+  // read before the output at its position is written.
+  virtual void forwardElementwise(float* /*out*/, float* const* /*in*/, int /*n*/) {
+    ABORT("Operation {} is not elementwise", type());
+  }
+
   virtual size_t hash() override {
     if(!hash_) {
       std::size_t seed = util::hash<std::string>()(name());
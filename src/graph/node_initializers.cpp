@@ -1,10 +1,12 @@
 #include "graph/node_initializers.h"
 #include "layers/word2vec_reader.h"
+#include "tensors/cpu/sharp/packed_gemm.h"
 #include "tensors/tensor_operators.h"
 
 #include <stdint.h>
 #include <algorithm>
 #include <iterator>
+#include <numeric>
 #include <random>
 
 namespace marian {
@@ -170,18 +172,37 @@ NodeInitializer from_word2vec(const std::string& file,
 }
 
 NodeInitializer from_item(const io::Item& item) {
+  if(isPacked(item.type)) {
+    // fails for packed types this build cannot use, e.g. FBGEMM types without FBGEMM
+    size_t bytes = requiredBytes(item.shape, item.type);
+    // the layout of packed int8 matrices depends on the CPU they were packed on
+    if(item.type == Type::packed8)
+      cpu::variant::CheckPackInt8((const uint8_t*)item.data());
+    ABORT_IF(item.size() != bytes, "Item {} of type {} has {} bytes, expected {}", item.name, item.type, item.size(), bytes);
+  }
+
   if(item.mapped) {
     return [item](Tensor t) {
-      // @TODO: implement other types, for now croak loudly.
       ABORT_IF(t->getBackend()->getDeviceId().type != DeviceType::cpu,
                "Memory mapping only works for CPU tensors");
-      ABORT_IF(!matchType<float>(t->type()),
-               "Tensor type and type for mapping do not match");
-      auto mp = New<MemoryPiece>((uint8_t*)item.ptr, t->size() * sizeof(float));
+      ABORT_IF(t->type() != item.type,
+               "Tensor type ({}) and type for mapping ({}) do not match", t->type(), item.type);
+      auto mp = New<MemoryPiece>((uint8_t*)item.ptr, requiredBytes(t->shape(), t->type()));
       t->reset(mp);
     };
   } else {
     return [item](Tensor t) {
+      ABORT_IF(t->type() != item.type,
+               "Tensor type ({}) and type for mapping ({}) do not match", t->type(), item.type);
+      if(isPacked(item.type)) {
+        // packed matrices are copied as they are; their layout is specific to the CPU kernels
+        ABORT_IF(t->getBackend()->getDeviceId().type != DeviceType::cpu,
+                 "Parameters of type {} are only supported on the CPU", item.type);
+        size_t bytes = requiredBytes(t->shape(), t->type());
+        ABORT_IF(item.bytes.size() < bytes, "Item {} has {} bytes, expected {}", item.name, item.bytes.size(), bytes);
+        std::copy(item.bytes.begin(), item.bytes.begin() + bytes, t->data<char>());
+        return;
+      }
       // @TODO: implement other types, for now croak loudly.
       ABORT_IF(!matchType<float>(t->type()),
                "Tensor type and type for mapping do not match");
@@ -197,15 +218,27 @@ NodeInitializer sinusoidalPositionEmbeddings(int start) {
     int dimEmb   = t->shape()[-1];
     int dimWords = (int)t->size() / dimEmb;
 
+    std::vector<int> positions(dimWords);
+    std::iota(positions.begin(), positions.end(), start);
+    sinusoidalPositionEmbeddings(positions)(t);
+  };
+}
+
+NodeInitializer sinusoidalPositionEmbeddings(const std::vector<int>& positions) {
+  return [positions](Tensor t) {
+    int dimEmb   = t->shape()[-1];
+    int dimWords = (int)t->size() / dimEmb;
+    ABORT_IF(dimWords != (int)positions.size(), "Expected {} positions, got {}", dimWords, positions.size());
+
     float numTimescales = (float)dimEmb / 2;
     float logTimescaleIncrement = std::log(10000.f) / (numTimescales - 1.f);
 
     std::vector<float> vPos(dimEmb * dimWords, 0);
-    for(int p = start; p < dimWords + start; ++p) {
+    for(int w = 0; w < dimWords; ++w) {
       for(int i = 0; i < numTimescales; ++i) {
-        float v = p * std::exp(i * -logTimescaleIncrement);
-        vPos[(p - start) * dimEmb + i                     ] = std::sin(v);
-        vPos[(p - start) * dimEmb + (int)numTimescales + i] = std::cos(v); // @TODO: is int vs. float correct for num_timescales?
+        float v = positions[w] * std::exp(i * -logTimescaleIncrement);
+        vPos[w * dimEmb + i                     ] = std::sin(v);
+        vPos[w * dimEmb + (int)numTimescales + i] = std::cos(v); // @TODO: is int vs. float correct for num_timescales?
       }
     }
 
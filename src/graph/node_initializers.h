@@ -68,6 +68,13 @@ NodeInitializer from_word2vec(const std::string& file,
  */
 NodeInitializer sinusoidalPositionEmbeddings(int start);
 
+/**
+ * Computes the sinusoidal position embeddings of the given
+ * positions, one row of the tensor each, e.g. for a decoding
+ * step whose batch entries are at different positions.
+ */
+NodeInitializer sinusoidalPositionEmbeddings(const std::vector<int>& positions);
+
 }  // namespace inits
 
 }  // namespace marian
@@ -25,8 +25,9 @@ void ConstantNode::init() {
 ParamNode::ParamNode(Ptr<ExpressionGraph> graph,
                      const Shape& shape,
                      const NodeInitializer& init,
-                     bool fixed)
-    : Node(graph, shape),  // TODO: add value_type
+                     bool fixed,
+                     Type value_type)
+    : Node(graph, shape, value_type),
       init_(new NodeInitializer(init)),
       initialized_(false) {
   setTrainable(!fixed);
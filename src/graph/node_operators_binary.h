@@ -138,6 +138,7 @@ private:
   bool transA_;
   bool transB_;
   float scalar_;
+  bool addBias_{true};
 
 public:
   AffineNodeOp(const std::vector<Expr>& nodes,
@@ -181,10 +182,15 @@ public:
                transB_,
                0.f,
                scalar_);
-          Prod(val_, child(3)->val(), child(2)->val(), false, false, 1.f, 1.f))
+          if(addBias_)
+            Prod(val_, child(3)->val(), child(2)->val(), false, false, 1.f, 1.f))
     };
   }
 
+  // ElementwiseFusion adds the bias itself, in the loop that also computes the elementwise
+  // operations applied to the result
+  void setAddBias(bool addBias) { addBias_ = addBias; }
+
   NodeOps backwardOps() override {
     // D is the adjoint, the matrix of derivatives
     // df/dA += alpha * dot(D, op(B).T)
@@ -683,6 +689,13 @@ struct PlusNodeOp : public ElementBinaryNodeOp {
         NodeOp(Element(_1 = _2 + _3, val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 + _3, n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -703,6 +716,13 @@ struct MinusNodeOp : public ElementBinaryNodeOp {
         NodeOp(Element(_1 = _2 - _3, val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 - _3, n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -723,6 +743,13 @@ struct MultNodeOp : public ElementBinaryNodeOp {
         NodeOp(Element(_1 = _2 * _3, val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 * _3, n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -743,6 +770,13 @@ struct DivNodeOp : public ElementBinaryNodeOp {
         NodeOp(Element(_1 = _2 / _3, val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 / _3, n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -790,6 +824,13 @@ struct LogAddExpNodeOp : public ElementBinaryNodeOp {
         _1 = logaddexp(_2, _3), val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = logaddexp(_2, _3), n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -820,6 +861,13 @@ struct MaximumNodeOp : public ElementBinaryNodeOp {
         Element(_1 = max(_2, _3), val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = max(_2, _3), n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -848,6 +896,13 @@ struct MinimumNodeOp : public ElementBinaryNodeOp {
         Element(_1 = min(_2, _3), val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = min(_2, _3), n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
 
@@ -879,6 +934,13 @@ struct CmpNodeOp : public ElementBinaryNodeOp {
              val_, child(0)->val(), child(1)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = ((((_2 > _3) - (_2 < _3)) == (float)cmp_) != not_), n, out, in[0], in[1]);
+  }
+
   NodeOps backwardOps() override { return {}; }
 
   const std::string type() override {
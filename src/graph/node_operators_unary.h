@@ -35,6 +35,13 @@ public:
     return {NodeOp(Element(_1 = _2 + scalar_, val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 + scalar_, n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(_1, child(0)->grad(), adj_))};
@@ -74,6 +81,13 @@ public:
     return {NodeOp(Element(_1 = scalar_ * _2, val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = scalar_ * _2, n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(scalar_ * _1, child(0)->grad(), adj_))};
@@ -113,6 +127,13 @@ public:
     return {NodeOp(Element(_1 = clip(_2, clip_), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = clip(_2, clip_), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(
@@ -149,6 +170,13 @@ struct SigmoidNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = sigmoid(_2), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = sigmoid(_2), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(_1 * _2 * (1.0f - _2), child(0)->grad(), adj_, val_))};
@@ -234,6 +262,19 @@ struct TanhNodeOp : public NaryNodeOp {
     }
   }
 
+  // more than three children are summed in several passes over the output
+  bool isElementwise() override { return children_.size() <= 3; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    switch(children_.size()) {
+      case 1: cpu::ElementContiguous(_1 = tanh(_2), n, out, in[0]); break;
+      case 2: cpu::ElementContiguous(_1 = tanh(_2 + _3), n, out, in[0], in[1]); break;
+      case 3: cpu::ElementContiguous(_1 = tanh(_2 + _3 + _4), n, out, in[0], in[1], in[2]); break;
+      default: ABORT("Elementwise tanh supports up to three children");
+    }
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     NodeOps ops;
@@ -261,6 +302,13 @@ struct ReLUNodeOp : public UnaryNodeOp {
                            ))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = ReLU(_2), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     // dJ/dx += dJ/df * binarystep(x)
@@ -307,6 +355,13 @@ struct PReLUNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = PReLU(_2, alpha_), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = PReLU(_2, alpha_), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(
@@ -356,6 +411,13 @@ struct SwishNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = _2 * sigmoid(b_ * _2), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 * sigmoid(b_ * _2), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     // dJ/dx += dJ/df * (b*f(x) + sigmoid(b*x) * (1 - b*f(x)))
@@ -561,6 +623,13 @@ struct LogNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = log(_2), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = log(_2), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {// NodeOp(Add(_1 * (1.f / _2), child(0)->grad(), adj_,
@@ -579,6 +648,13 @@ struct ExpNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = exp(_2), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = exp(_2), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(_1 * exp(_2), child(0)->grad(), adj_, child(0)->val()))};
@@ -597,6 +673,13 @@ struct SqrtNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = sqrt(_2 + epsilon_), val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = sqrt(_2 + epsilon_), n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(0.5f * (1.f / _1) * _2, child(0)->grad(), val_, adj_))};
@@ -633,6 +716,13 @@ struct SquareNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = _2 * _2, val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = _2 * _2, n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {
@@ -650,6 +740,13 @@ struct NegNodeOp : public UnaryNodeOp {
     return {NodeOp(Element(_1 = -_2, val_, child(0)->val()))};
   }
 
+  bool isElementwise() override { return true; }
+
+  void forwardElementwise(float* out, float* const* in, int n) override {
+    using namespace functional;
+    cpu::ElementContiguous(_1 = -_2, n, out, in[0]);
+  }
+
   NodeOps backwardOps() override {
     using namespace functional;
     return {NodeOp(Add(-_1, child(0)->grad(), adj_))};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common/definitions.h"
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace marian {
+
+/**
+ * @brief Free lists of node memory for one ExpressionGraph
+ *
+ * Expression() allocates each node together with its reference count from the pool of its graph
+ * (NodePoolAllocator). When a node is destroyed, e.g. after graph->clear() has dropped the last
+ * references to the nodes of a step, its memory goes back to the free list of its size and is
+ * reused by the nodes of the next step. Nodes may be destroyed on other threads than the one
+ * that builds the graph, hence the lock. Memory is only returned to the system when the pool is
+ * destroyed, which happens after the graph and all of its nodes are gone.
+ */
+class NodePool {
+private:
+  static const size_t GRANULE = 16;     // bytes, sizes are rounded up to multiples of this
+  static const size_t MAX_BYTES = 1024; // larger blocks are not pooled
+
+  std::mutex mutex_;
+  std::vector<void*> free_[MAX_BYTES / GRANULE + 1];
+
+  static size_t sizeClass(size_t bytes) { return (bytes + GRANULE - 1) / GRANULE; }
+
+public:
+  ~NodePool() {
+    for(auto& blocks : free_)
+      for(auto block : blocks)
+        ::operator delete(block);
+  }
+
+  void* allocate(size_t bytes) {
+    if(bytes > MAX_BYTES)
+      return ::operator new(bytes);
+    size_t c = sizeClass(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(!free_[c].empty()) {
+        void* block = free_[c].back();
+        free_[c].pop_back();
+        return block;
+      }
+    }
+    return ::operator new(c * GRANULE);
+  }
+
+  void deallocate(void* block, size_t bytes) {
+    if(bytes > MAX_BYTES) {
+      ::operator delete(block);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_[sizeClass(bytes)].push_back(block);
+  }
+};
+
+// Allocator for std::allocate_shared() that takes memory from a NodePool and keeps it alive
+template <class T>
+class NodePoolAllocator {
+private:
+  template <class U>
+  friend class NodePoolAllocator;
+
+  Ptr<NodePool> pool_;
+
+public:
+  typedef T value_type;
+
+  NodePoolAllocator(Ptr<NodePool> pool) : pool_(pool) {}
+
+  template <class U>
+  NodePoolAllocator(const NodePoolAllocator<U>& other) : pool_(other.pool_) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(pool_->allocate(n * sizeof(T))); }
+
+  void deallocate(T* p, size_t n) { pool_->deallocate(p, n * sizeof(T)); }
+
+  template <class U>
+  bool operator==(const NodePoolAllocator<U>& other) const { return pool_ == other.pool_; }
+
+  template <class U>
+  bool operator!=(const NodePoolAllocator<U>& other) const { return pool_ != other.pool_; }
+};
+
+}  // namespace marian
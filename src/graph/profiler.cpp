@@ -0,0 +1,197 @@
+#include "graph/profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace marian {
+
+namespace {
+
+const size_t FLUSH_BYTES = 1 << 20;
+
+std::string shapeString(const Shape& shape) {
+  std::stringstream ss;
+  for(int i = 0; i < shape.size(); ++i)
+    ss << (i > 0 ? "x" : "") << shape[i];
+  return ss.str();
+}
+
+// s as a JSON string literal; node names are chosen by the model code and may contain anything
+std::string jsonString(const std::string& s) {
+  std::stringstream ss;
+  ss << '"';
+  for(char c : s) {
+    switch(c) {
+      case '"':  ss << "\\\""; break;
+      case '\\': ss << "\\\\"; break;
+      case '\n': ss << "\\n"; break;
+      case '\r': ss << "\\r"; break;
+      case '\t': ss << "\\t"; break;
+      default:
+        if((unsigned char)c < 0x20)
+          ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+        else
+          ss << c;
+    }
+  }
+  ss << '"';
+  return ss.str();
+}
+
+bool isMatrixProduct(const std::string& type) {
+  return type == "dot" || type == "bdot" || type == "affine" || type == "dotInt16"
+         || type == "affineInt16" || type == "fp16packed" || type == "int8packed";
+}
+
+}  // namespace
+
+Ptr<GraphProfiler> GraphProfiler::global() {
+  static Ptr<GraphProfiler> profiler = New<GraphProfiler>();
+  return profiler;
+}
+
+void GraphProfiler::start(Ptr<Options> options) {
+  if(!options->hasAndNotEmpty("profile"))
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  fileName_ = options->get<std::string>("profile");
+  maxEvents_ = options->get<size_t>("profile-events");
+  out_.reset(new io::OutputFileStream(fileName_));
+  *out_ << "[";
+  epoch_ = std::chrono::steady_clock::now();
+  enabled_ = true;
+  LOG(info, "[profiler] Writing up to {} operator events to {}", maxEvents_, fileName_);
+}
+
+void GraphProfiler::finish() {
+  if(!enabled_)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = false;
+  for(const auto& thread : threads_) {
+    std::stringstream name;
+    name << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.second
+         << ", \"args\": {\"name\": \"thread " << thread.second << "\"}}";
+    buffer_ += (numEvents_++ > 0 ? ",\n" : "\n") + name.str();
+  }
+  flush();
+  *out_ << "\n]\n";
+  out_.reset();
+
+  std::vector<std::pair<std::string, Stat>> stats(stats_.begin(), stats_.end());
+  std::sort(stats.begin(), stats.end(), [](const std::pair<std::string, Stat>& a, const std::pair<std::string, Stat>& b) {
+    return a.second.forwardTime + a.second.backwardTime > b.second.forwardTime + b.second.backwardTime;
+  });
+  double total = 0;
+  for(const auto& stat : stats)
+    total += stat.second.forwardTime + stat.second.backwardTime;
+
+  LOG(info, "[profiler] Operators by total time, trace written to {}:", fileName_);
+  LOG(info, "[profiler] {:>20} {:>10} {:>12} {:>10} {:>12} {:>7} {:>10} {:>9} {:>10}",
+      "type", "forward", "forward ms", "backward", "backward ms", "time %", "GFLOP", "GFLOP/s", "MB");
+  for(const auto& stat : stats) {
+    const auto& s = stat.second;
+    double time = s.forwardTime + s.backwardTime;
+    LOG(info, "[profiler] {:>20} {:>10} {:>12.3f} {:>10} {:>12.3f} {:>7.2f} {:>10.3f} {:>9.2f} {:>10.2f}",
+        stat.first, s.forwardCount, s.forwardTime / 1e3, s.backwardCount, s.backwardTime / 1e3,
+        total > 0 ? 100. * time / total : 0., s.flops / 1e9, time > 0 ? s.flops / time / 1e3 : 0.,
+        s.bytes / (1024. * 1024.));
+  }
+}
+
+size_t GraphProfiler::threadId() {
+  auto it = threads_.find(std::this_thread::get_id());
+  if(it != threads_.end())
+    return it->second;
+  size_t id = threads_.size() + 1;
+  threads_[std::this_thread::get_id()] = id;
+  return id;
+}
+
+void GraphProfiler::writeEvent(const std::string& name, const std::string& category, double begin, double end,
+                               const std::string& args) {
+  size_t tid = threadId();
+  if(numEvents_ >= maxEvents_) {
+    if(numEvents_ == maxEvents_) {
+      LOG(info, "[profiler] Written {} events, further operators are only aggregated", maxEvents_);
+      numEvents_++;
+    }
+    return;
+  }
+  std::stringstream event;
+  event << (numEvents_++ > 0 ? ",\n" : "\n") << "{\"name\": " << jsonString(name) << ", \"cat\": " << jsonString(category)
+        << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid << ", \"ts\": " << std::fixed << begin
+        << ", \"dur\": " << end - begin << ", \"args\": {" << args << "}}";
+  buffer_ += event.str();
+  if(buffer_.size() > FLUSH_BYTES)
+    flush();
+}
+
+void GraphProfiler::flush() {
+  *out_ << buffer_ << std::flush;
+  buffer_.clear();
+}
+
+void GraphProfiler::record(Expr node, bool backward, double begin, size_t bytes) {
+  double end = now();
+  auto type = node->type();
+  double flops = estimateFlops(node, backward);
+
+  std::stringstream args;
+  std::string inputs;
+  for(size_t i = 0; i < node->children().size(); ++i)
+    inputs += (i > 0 ? " " : "") + shapeString(node->children()[i]->shape());
+  args << "\"id\": " << node->getId() << ", \"node\": " << jsonString(node->name())
+       << ", \"shape\": " << jsonString(shapeString(node->shape())) << ", \"inputs\": " << jsonString(inputs)
+       << ", \"bytes\": " << bytes << ", \"flops\": " << std::fixed << flops;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(!enabled_)
+    return;
+  auto& stat = stats_[type];
+  if(backward) {
+    stat.backwardCount++;
+    stat.backwardTime += end - begin;
+  } else {
+    stat.forwardCount++;
+    stat.forwardTime += end - begin;
+  }
+  stat.flops += flops;
+  stat.bytes += bytes;
+  writeEvent(type, backward ? "backward" : "forward", begin, end, args.str());
+}
+
+void GraphProfiler::recordCall(const std::string& name, double begin, size_t numNodes) {
+  double end = now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(!enabled_)
+    return;
+  writeEvent(name, "graph", begin, end, "\"nodes\": " + std::to_string(numNodes));
+}
+
+double GraphProfiler::estimateFlops(Expr node, bool backward) {
+  auto type = node->type();
+  if(type == "const" || type == "param" || type == "reshape" || type == "sliceView")
+    return 0;
+
+  double outputs = (double)node->shape().elements();
+  if(!isMatrixProduct(type) || node->children().empty() || node->shape().size() < 2
+     || node->child(0)->shape().size() < 2)
+    return outputs;
+
+  // The shared dimension is the one of the first operand that is not the rows of the result,
+  // which also holds for a transposed operand.
+  auto a = node->child(0)->shape();
+  int rows = node->shape()[-2];
+  double shared = a[-2] == rows ? a[-1] : a[-2];
+  double flops = 2 * outputs * shared;
+  if(type == "affine" || type == "affineInt16")
+    flops += outputs; // bias
+  return backward ? 2 * flops : flops; // gradients of both operands
+}
+
+}  // namespace marian
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/file_stream.h"
+#include "common/options.h"
+#include "tensors/tensor.h"
+
+#include "graph/chainable.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace marian {
+
+/**
+ * @brief Operator-level profile of all expression graphs, enabled with --profile
+ *
+ * ExpressionGraph reports the wall time of every node it runs in forward(), backward() and
+ * replay(), together with the bytes it allocated and an estimate of its floating point
+ * operations. The events are written to a trace file in the Chrome trace event format (JSON
+ * array), which can be opened in chrome://tracing or Perfetto, along with one enclosing event
+ * per forward, backward and replay call. The file is written while profiling; if the process is
+ * interrupted before finish(), only the closing bracket is missing, which both viewers accept.
+ *
+ * Regardless of the maximum number of written events, all nodes are aggregated per operator
+ * type; finish() logs these aggregates, most expensive first.
+ *
+ * On GPU, each node is followed by a synchronization to measure its time, which serializes the
+ * computation.
+ */
+class GraphProfiler {
+private:
+  struct Stat {
+    size_t forwardCount{0};
+    size_t backwardCount{0};
+    double forwardTime{0};  // microseconds
+    double backwardTime{0}; // microseconds
+    double flops{0};
+    size_t bytes{0};
+  };
+
+  std::mutex mutex_;
+  std::atomic<bool> enabled_{false};
+  std::string fileName_;
+  UPtr<io::OutputFileStream> out_;
+  std::string buffer_;     // events not yet written to out_
+  size_t maxEvents_{0};
+  size_t numEvents_{0};    // written events
+  std::chrono::steady_clock::time_point epoch_;
+  std::map<std::thread::id, size_t> threads_; // thread ids in the trace
+  std::map<std::string, Stat> stats_;         // by operator type
+
+  size_t threadId(); // mutex_ must be held
+  void writeEvent(const std::string& name, const std::string& category, double begin, double end,
+                  const std::string& args); // mutex_ must be held
+  void flush();                             // mutex_ must be held
+
+public:
+  static Ptr<GraphProfiler> global();
+
+  // Starts writing the trace to the file given by --profile, if any
+  void start(Ptr<Options> options);
+  // Logs the aggregates per operator type and closes the trace file
+  void finish();
+
+  bool enabled() const { return enabled_; }
+
+  // Microseconds since start()
+  double now() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch_).count();
+  }
+
+  // Records the forward or backward step of a node that ran from begin until now
+  void record(Expr node, bool backward, double begin, size_t bytes);
+
+  // Records a call of ExpressionGraph::forward(), backward() or replay() from begin until now
+  void recordCall(const std::string& name, double begin, size_t numNodes);
+
+  // Estimated floating point operations of a node: 2 per multiply-add for matrix products, one
+  // per output value for all other operations
+  static double estimateFlops(Expr node, bool backward);
+};
+
+}  // namespace marian
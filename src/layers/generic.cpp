@@ -96,6 +96,21 @@ namespace marian {
     return logits_[groupIndex]->loss()->val();
   }
 
+  // used for breakDown() only
+  // Logits must have been computed. Reading them element by element would mean one device-to-host
+  // copy per element, hence they are gathered on the device first.
+  std::vector<float> Logits::getFactoredLogitsValues(size_t groupIndex, const std::vector<IndexType>& flatIndices) const {
+    ABORT_IF(empty(), "Attempted to read out logits on empty Logits object");
+    std::vector<float> values;
+    if (flatIndices.empty())
+      return values;
+    auto sel = logits_[groupIndex]->loss();
+    auto gathered = index_select(reshape(sel, {sel->shape().elements()}), 0, flatIndices);
+    graph()->forwardNext();
+    gathered->val()->get(values);
+    return values;
+  }
+
   // This function assumes that the object holds one or more factor logits, which are summed up
   // into output-vocab logits according to the factored model (with correct normalization of factors).
   // This is infeasible for realistic factor sets, and therefore only implemented for 1 factor.
@@ -252,8 +267,30 @@ namespace marian {
       lazyConstruct(input->shape()[-1]);
 
       if (shortlist_ && !cachedShortWt_) { // shortlisted versions of parameters are cached within one batch, then clear()ed
-        cachedShortWt_ = index_select(Wt_, isLegacyUntransposedW ? -1 : 0, shortlist_->indices());
-        cachedShortb_  = index_select(b_ ,                             -1, shortlist_->indices());
+        if (shortlist_->isPerSentence()) {
+          // gather the rows of each batch entry's own shortlist once per batch; padding gets a bias
+          // that keeps it from being selected
+          ABORT_IF(factoredVocab_, "Per-sentence shortlists are not supported for factored vocabularies");
+          const auto& indices = shortlist_->indices();
+          int dimBatch = (int)shortlist_->dimBatch();
+          int dimShortlist = (int)shortlist_->size();
+          auto Wt = isLegacyUntransposedW ? transpose(index_select(Wt_, -1, indices)) : index_select(Wt_, 0, indices); // [dimBatch * dimShortlist, dimModel]
+          cachedShortWt_ = reshape(Wt, {dimBatch, 1, dimShortlist, Wt->shape()[-1]});
+
+          std::vector<float> paddingMask(indices.size(), 0.f);
+          for (int i = 0; i < dimBatch; i++)
+            std::fill(paddingMask.begin() + i * dimShortlist + shortlist_->lengths()[i],
+                      paddingMask.begin() + (i + 1) * dimShortlist,
+                      std::numeric_limits<float>::lowest());
+          cachedShortb_ = reshape(index_select(b_, -1, indices), {dimBatch, 1, 1, dimShortlist})
+                          + graph_->constant({dimBatch, 1, 1, dimShortlist}, inits::from_vector(paddingMask));
+        }
+        else {
+          cachedShortWt_ = index_select(Wt_, isLegacyUntransposedW ? -1 : 0, shortlist_->indices());
+          cachedShortb_  = index_select(b_ ,                             -1, shortlist_->indices());
+          // quantize or pack once per batch rather than in every decoding step
+          cachedShortWtPrepared_ = prepareAffineWeights(cachedShortWt_, /*transB=*/isLegacyUntransposedW ? false : true);
+        }
       }
 
       if (factoredVocab_) {
@@ -280,7 +317,9 @@ namespace marian {
             factorB  = slice(b_,                              -1, Slice((int)range.first, (int)range.second));
           }
           // @TODO: b_ should be a vector, not a matrix; but shotlists use cols() in, which requires a matrix
-          auto factorLogits = affine(input1, factorWt, factorB, false, /*transB=*/isLegacyUntransposedW ? false : true); // [B... x U] factor logits
+          auto factorLogits = (g == 0 && cachedShortWtPrepared_) // [B... x U] factor logits
+            ? affinePrepared(input1, cachedShortWtPrepared_, factorWt->shape(), factorB, false, /*transB=*/isLegacyUntransposedW ? false : true)
+            : affine(input1, factorWt, factorB, false, /*transB=*/isLegacyUntransposedW ? false : true);
           // optionally add lemma-dependent bias
           if (Plemma) { // [B... x U0]
             int lemmaVocabDim = Plemma->shape()[-1];
@@ -331,6 +370,14 @@ namespace marian {
         }
         return Logits(std::move(allLogits), factoredVocab_);
       }
+      else if (shortlist_ && shortlist_->isPerSentence()) {
+        // batched GEMM, each batch entry against the columns of its own shortlist
+        auto x = swapAxes(atleast_4d(input), 0, 2);                    // [beam, 1, dimBatch, dimModel] -> [dimBatch, 1, beam, dimModel]
+        auto y = bdot(x, cachedShortWt_, false, true) + cachedShortb_; // [dimBatch, 1, beam, dimShortlist]
+        return Logits(swapAxes(y, 0, 2));                              // [beam, 1, dimBatch, dimShortlist]
+      }
+      else if (shortlist_ && cachedShortWtPrepared_)
+        return Logits(affinePrepared(input, cachedShortWtPrepared_, cachedShortWt_->shape(), cachedShortb_, false, /*transB=*/isLegacyUntransposedW ? false : true));
       else if (shortlist_)
         return Logits(affine(input, cachedShortWt_, cachedShortb_, false, /*transB=*/isLegacyUntransposedW ? false : true));
       else
@@ -436,6 +483,10 @@ namespace marian {
   }
 
   Expr Embedding::applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const /*override final*/ {
+    return applyIndices(E_->graph()->indices(embIdx), shape);
+  }
+
+  Expr Embedding::applyIndices(Expr embIdx, const Shape& shape) const /*override final*/ {
     ABORT_IF(factoredVocab_, "Embedding: applyIndices must not be used with a factored vocabulary");
     auto selectedEmbs = rows(E_, embIdx);        // [(B*W) x E]
     selectedEmbs = reshape(selectedEmbs, shape); // [W, B, E]
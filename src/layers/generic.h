@@ -61,6 +61,12 @@ struct IEmbeddingLayer {
 
   // alternative from indices directly
   virtual Expr applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const = 0;
+
+  // same, with the indices given as a tensor
+  virtual Expr applyIndices(Expr embIdx, const Shape& shape) const = 0;
+
+  // factored embeddings can only be looked up from Words, not through applyIndices()
+  virtual bool isFactored() const { return false; }
 };
 
 // base class for Encoder and Decoder classes, which have embeddings and a batch index (=stream index)
@@ -128,6 +134,7 @@ public:
     };
     std::vector<MaskedFactorIndices> factorizeWords(const Words& words) const; // breaks encoded Word into individual factor indices
     Tensor getFactoredLogitsTensor(size_t factorGroup) const; // used for breakDown() only
+    std::vector<float> getFactoredLogitsValues(size_t factorGroup, const std::vector<IndexType>& flatIndices) const; // ditto; gathers the values at the given flattened indices in one go
     size_t getNumFactorGroups() const { return logits_.size(); }
     bool empty() const { return logits_.empty(); }
     Logits withCounts(const Expr& count) const; // create new Logits with 'count' implanted into all logits_
@@ -236,7 +243,8 @@ private:
   Expr lemmaEt_; // re-embedding matrix for lemmas [lemmaDimEmb x lemmaVocabSize]
   bool isLegacyUntransposedW{false}; // legacy-model emulation: W is stored in non-transposed form
   Expr cachedShortWt_;  // short-listed version, cached (cleared by clear())
-  Expr cachedShortb_;   // these match the current value of shortlist_
+  Expr cachedShortb_;   // these match the current value of shortlist_; per-sentence: [dimBatch, 1, dimShortlist, dimModel] and [dimBatch, 1, 1, dimShortlist]
+  Expr cachedShortWtPrepared_; // cachedShortWt_ in the format of the GEMM type, if it has one (see prepareAffineWeights())
   Expr cachedShortLemmaEt_;
   Ptr<FactoredVocab> factoredVocab_;
 
@@ -259,10 +267,18 @@ public:
   }
 
   void setShortlist(Ptr<data::Shortlist> shortlist) override final {
-    if (shortlist_)
+    if (shortlist_ && shortlist_->isPerSentence() && shortlist.get() != shortlist_.get()) {
+      // per-sentence shortlists shrink with the batch when finished sentences are dropped
+      ABORT_IF(!shortlist->isPerSentence(), "Output shortlist cannot be changed except after clear()");
+      shortlist_ = shortlist;
+      cachedShortWt_ = nullptr;
+      cachedShortb_  = nullptr;
+      cachedShortWtPrepared_ = nullptr;
+    }
+    else if (shortlist_)
       ABORT_IF(shortlist.get() != shortlist_.get(), "Output shortlist cannot be changed except after clear()");
     else {
-      ABORT_IF(cachedShortWt_ || cachedShortb_ || cachedShortLemmaEt_, "No shortlist but cached parameters??");
+      ABORT_IF(cachedShortWt_ || cachedShortb_ || cachedShortWtPrepared_ || cachedShortLemmaEt_, "No shortlist but cached parameters??");
       shortlist_ = shortlist;
     }
     // cachedShortWt_ and cachedShortb_ will be created lazily inside apply()
@@ -274,6 +290,7 @@ public:
     shortlist_ = nullptr;
     cachedShortWt_ = nullptr;
     cachedShortb_  = nullptr;
+    cachedShortWtPrepared_ = nullptr;
     cachedShortLemmaEt_ = nullptr;
   }
 
@@ -298,6 +315,10 @@ public:
   Expr apply(const Words& words, const Shape& shape) const override final;
 
   Expr applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const override final;
+
+  Expr applyIndices(Expr embIdx, const Shape& shape) const override final;
+
+  bool isFactored() const override final { return factoredVocab_ != nullptr; }
 };
 
 class ULREmbedding : public LayerBase, public IEmbeddingLayer {
@@ -413,5 +434,10 @@ public:
     embIdx; shape;
     ABORT("not implemented"); // @TODO: implement me
   }
+
+  Expr applyIndices(Expr embIdx, const Shape& shape) const override final {
+    embIdx; shape;
+    ABORT("not implemented"); // @TODO: implement me
+  }
 };
 }  // namespace marian
@@ -282,11 +282,12 @@ public:
   virtual Ptr<DecoderState> step(Ptr<ExpressionGraph> graph,
                                  Ptr<DecoderState> state,
                                  const std::vector<IndexType>& hypIndices,
+                                 const std::vector<IndexType>& batchIndices,
                                  const Words& words,
                                  int dimBatch,
                                  int beamSize) override {
     auto nextState = encdec_->step(
-        graph, state, hypIndices, words, dimBatch, beamSize);
+        graph, state, hypIndices, batchIndices, words, dimBatch, beamSize);
     return cost_->apply(nextState);
   }
 
@@ -308,6 +309,10 @@ public:
   };
 
   virtual data::SoftAlignment getAlignment() override { return encdec_->getAlignment(); }
+
+  virtual bool stepsAreReplayable() override { return encdec_->stepsAreReplayable(); }
+
+  virtual bool statesAreMergeable() override { return encdec_->statesAreMergeable(); }
 };
 
 }  // namespace models
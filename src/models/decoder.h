@@ -68,11 +68,27 @@ public:
     int dimEmb = opt<int>("dim-emb");
     if(words.empty())
       selectedEmbs = graph_->constant({1, 1, dimBatch, dimEmb}, inits::zeros);
+    else if(stepsAreReplayable() && !embeddingLayer->isFactored()) {
+      // named, so that a recorded decoding step can be replayed with new words
+      auto wordIndices = graph_->indices(toWordIndexVector(words));
+      wordIndices->set_name("step:words");
+      selectedEmbs = embeddingLayer->applyIndices(wordIndices, {dimBeam, 1, dimBatch, dimEmb});
+    }
     else
       selectedEmbs = embeddingLayer->apply(words, {dimBeam, 1, dimBatch, dimEmb});
     state->setTargetHistoryEmbeddings(selectedEmbs);
   }
 
+  // Whether the graph of a decoding step can be recorded once and replayed for later steps
+  // (ExpressionGraph::replay()), given the same beam and batch size. This requires that a step
+  // depends on its position only through the hypothesis indices, words and decoder states.
+  virtual bool stepsAreReplayable() const { return false; }
+
+  // Whether the states of sentences at different positions can be merged into one batch
+  // (DecoderState::merge()), so that new sentences can join a running search (continuous
+  // batching). This holds for all decoders whose steps are replayable.
+  virtual bool statesAreMergeable() const { return stepsAreReplayable(); }
+
   virtual const std::vector<Expr> getAlignments(int /*i*/ = 0) { return {}; }; // [tgt index][beam depth, max src length, batch size, 1]
 
   virtual Ptr<data::Shortlist> getShortlist() { return shortlist_; }
@@ -187,12 +187,18 @@ Ptr<DecoderState> EncoderDecoder::startState(Ptr<ExpressionGraph> graph,
 
 Ptr<DecoderState> EncoderDecoder::step(Ptr<ExpressionGraph> graph,
                                        Ptr<DecoderState> state,
-                                       const std::vector<IndexType>& hypIndices, // [beamIndex * activeBatchSize + batchIndex]
-                                       const Words& words,                       // [beamIndex * activeBatchSize + batchIndex]
+                                       const std::vector<IndexType>& hypIndices,   // [beamIndex * activeBatchSize + batchIndex]
+                                       const std::vector<IndexType>& batchIndices, // [batchIndex] entries of the previous step that are still active
+                                       const Words& words,                         // [beamIndex * activeBatchSize + batchIndex]
                                        int dimBatch,
                                        int beamSize) {
-  // create updated state that reflects reordering and dropping of hypotheses
-  state = hypIndices.empty() ? state : state->select(hypIndices, beamSize);
+  // create updated state that reflects reordering and dropping of hypotheses and finished batch entries
+  state = hypIndices.empty() ? state : state->select(hypIndices, batchIndices, beamSize);
+
+  // per-sentence shortlists have to follow the dropped batch entries
+  auto shortlist = decoders_[0]->getShortlist();
+  if(!batchIndices.empty() && shortlist && shortlist->isPerSentence())
+    decoders_[0]->setShortlist(shortlist->select(batchIndices));
 
   // Fill state with embeddings based on last prediction
   decoders_[0]->embeddingsFromPrediction(graph, state, words, dimBatch, beamSize);
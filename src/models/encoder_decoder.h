@@ -42,6 +42,7 @@ public:
   virtual Ptr<DecoderState> step(Ptr<ExpressionGraph> graph,
                                  Ptr<DecoderState> state,
                                  const std::vector<IndexType>& hypIndices,
+                                 const std::vector<IndexType>& batchIndices,
                                  const Words& words,
                                  int dimBatch,
                                  int beamSize)
@@ -56,6 +57,10 @@ public:
   virtual Ptr<data::Shortlist> getShortlist() = 0;
 
   virtual data::SoftAlignment getAlignment() = 0;
+
+  virtual bool stepsAreReplayable() = 0;
+
+  virtual bool statesAreMergeable() = 0;
 };
 
 class EncoderDecoder : public IEncoderDecoder, public LayerBase {
@@ -139,6 +144,14 @@ public:
     return softAlignments; // [tgt index][beam depth * max src length * batch size]
   };
 
+  virtual bool stepsAreReplayable() override {
+    return decoders_[0]->stepsAreReplayable();
+  }
+
+  virtual bool statesAreMergeable() override {
+    return decoders_[0]->statesAreMergeable();
+  }
+
   /*********************************************************************/
 
   virtual Ptr<DecoderState> startState(Ptr<ExpressionGraph> graph,
@@ -147,6 +160,7 @@ public:
   virtual Ptr<DecoderState> step(Ptr<ExpressionGraph> graph,
                                  Ptr<DecoderState> state,
                                  const std::vector<IndexType>& hypIndices,
+                                 const std::vector<IndexType>& batchIndices,
                                  const Words& words,
                                  int dimBatch,
                                  int beamSize) override;
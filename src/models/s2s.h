@@ -143,6 +143,7 @@ class DecoderS2S : public DecoderBase {
 private:
   Ptr<rnn::RNN> rnn_;
   Ptr<mlp::MLP> output_;
+  Expr lastContext_; // encoder context the attention mechanism in rnn_ was constructed for
 
   Ptr<rnn::RNN> constructDecoderRNN(Ptr<ExpressionGraph> graph,
                                     Ptr<DecoderState> state) {
@@ -251,8 +252,14 @@ public:
 
     auto embeddings = state->getTargetHistoryEmbeddings();
 
-    if(!rnn_)
+    // The attention mechanism caches the encoder context mapped into decoder space. If beam
+    // search has dropped or added batch entries in the encoder states, it has to be rebuilt.
+    // Language models (--type lm) have no encoder.
+    const auto& encStates = state->getEncoderStates();
+    auto context = encStates.empty() ? nullptr : encStates[0]->getContext();
+    if(!rnn_ || context != lastContext_)
       rnn_ = constructDecoderRNN(graph, state);
+    lastContext_ = context;
 
     // apply RNN to embeddings, initialized with encoder context mapped into
     // decoder space
@@ -330,6 +337,9 @@ public:
     return nextState;
   }
 
+  // a step only depends on the previous states, the words and the hypothesis indices
+  virtual bool stepsAreReplayable() const override { return true; }
+
   // helper function for guided alignment
   virtual const std::vector<Expr> getAlignments(int i = 0) override {
     auto att
@@ -339,6 +349,7 @@ public:
 
   void clear() override {
     rnn_ = nullptr;
+    lastContext_ = nullptr;
     if (output_)
       output_->clear();
   }
@@ -22,6 +22,31 @@ public:
   virtual Expr getAttended() { return context_; }
   virtual Expr getMask() { return mask_; }
 
+  // Sub-select active batch entries from encoder context and context mask.
+  // Axis -2 is the batch axis for both, RNN and Transformer encoders.
+  virtual Ptr<EncoderState> select(const std::vector<IndexType>& batchIndices) { // [batchIndex] indices of active batch entries
+    return New<EncoderState>(index_select(context_, -2, batchIndices),
+                             index_select(mask_,    -2, batchIndices),
+                             batch_);
+  }
+
+  // Append the batch entries of another encoder state, e.g. to admit new sentences into a running
+  // beam search. The shorter of the two is padded with masked-out positions along the time axis.
+  // The result refers to the corpus batch of this state.
+  virtual Ptr<EncoderState> merge(Ptr<EncoderState> other) {
+    int dimTime = std::max(context_->shape()[-3], other->context_->shape()[-3]);
+    auto pad = [dimTime](Expr x) -> Expr {
+      auto shape = x->shape();
+      if(shape[-3] == dimTime)
+        return x;
+      shape.set(-3, dimTime - shape[-3]);
+      return concatenate({x, x->graph()->constant(shape, inits::zeros)}, /*axis=*/ -3);
+    };
+    return New<EncoderState>(concatenate({pad(context_), pad(other->context_)}, /*axis=*/ -2),
+                             concatenate({pad(mask_),    pad(other->mask_)},    /*axis=*/ -2),
+                             batch_);
+  }
+
   virtual const Words& getSourceWords() {
     return batch_->front()->data();
   }
@@ -57,10 +82,11 @@ public:
   virtual void setLogProbs(Logits logProbs) { logProbs_ = logProbs; }
 
   // @TODO: should this be a constructor? Then derived classes can call this without the New<> in the loop
-  virtual Ptr<DecoderState> select(const std::vector<IndexType>& selIdx,
+  virtual Ptr<DecoderState> select(const std::vector<IndexType>& hypIndices,   // [beamIndex * activeBatchSize + batchIndex]
+                                   const std::vector<IndexType>& batchIndices, // [batchIndex]
                                    int beamSize) const {
     auto selectedState = New<DecoderState>(
-        states_.select(selIdx, beamSize, /*isBatchMajor=*/false), logProbs_, encStates_, batch_);
+        states_.select(hypIndicesExpr(hypIndices), beamSize, /*isBatchMajor=*/false), logProbs_, selectEncoderStates(batchIndices), batch_);
 
     // Set positon of new state based on the target token position of current
     // state
@@ -68,6 +94,76 @@ public:
     return selectedState;
   }
 
+  // Hypothesis indices as a named constant that is shared by all layers. A recorded decoding step
+  // (see ExpressionGraph::startTrace()) is replayed with new indices by overwriting its value.
+  // The graph is taken from the state, as decoders of language models have no encoder states.
+  Expr hypIndicesExpr(const std::vector<IndexType>& hypIndices) const {
+    auto exprs = getStateExprs();
+    if(exprs.empty())
+      return nullptr; // nothing to select
+    auto indices = exprs.front()->graph()->indices(hypIndices);
+    indices->set_name("step:hypIndices");
+    return indices;
+  }
+
+  // All tensors that carry the decoder state from one step to the next
+  std::vector<Expr> getStateExprs() const {
+    std::vector<Expr> exprs;
+    for(const auto& state : states_)
+      for(auto expr : {state.output, state.cell, state.keys, state.values})
+        if(expr)
+          exprs.push_back(expr);
+    return exprs;
+  }
+
+  // Append the batch entries of another state, e.g. to admit new sentences into a running beam
+  // search. The hypotheses of 'other' are repeated to the beam size of this state. This is only
+  // possible for decoders whose steps do not depend on the target position otherwise, see
+  // DecoderBase::stepsAreReplayable(); TransformerState implements its own merge().
+  virtual Ptr<DecoderState> merge(Ptr<DecoderState> other) const {
+    ABORT_IF(states_.size() != other->states_.size(), "Cannot merge decoder states of different depth");
+    rnn::States mergedStates;
+    for(size_t i = 0; i < states_.size(); ++i) {
+      const auto& state = states_[i];
+      const auto& otherState = other->states_[i];
+      ABORT_IF(state.keys || state.values, "Merging of attention caches is not supported");
+      auto mergeExprs = [](Expr a, Expr b) -> Expr { // [beamSize, dimTime, dimBatch, dimDepth]
+        if(!a)
+          return a;
+        a = atleast_4d(a);
+        b = atleast_4d(b);
+        if(b->shape()[-4] != a->shape()[-4])
+          b = repeat(b, a->shape()[-4], /*axis=*/ -4);
+        return concatenate({a, b}, /*axis=*/ -2);
+      };
+      mergedStates.push_back({mergeExprs(state.output, otherState.output),
+                              mergeExprs(state.cell, otherState.cell)});
+    }
+
+    auto mergedState = New<DecoderState>(mergedStates, Logits(), mergeEncoderStates(other), batch_);
+    mergedState->setPosition(getPosition());
+    return mergedState;
+  }
+
+  // encoder states with the batch entries of those of 'other' appended, see merge()
+  std::vector<Ptr<EncoderState>> mergeEncoderStates(Ptr<DecoderState> other) const {
+    std::vector<Ptr<EncoderState>> mergedEncStates;
+    for(size_t i = 0; i < encStates_.size(); ++i)
+      mergedEncStates.push_back(encStates_[i]->merge(other->encStates_[i]));
+    return mergedEncStates;
+  }
+
+  // encoder states restricted to the given batch entries; all of them if batchIndices is empty
+  std::vector<Ptr<EncoderState>> selectEncoderStates(const std::vector<IndexType>& batchIndices) const {
+    if(batchIndices.empty())
+      return encStates_;
+
+    std::vector<Ptr<EncoderState>> selectedEncStates;
+    for(auto encState : encStates_)
+      selectedEncStates.push_back(encState->select(batchIndices));
+    return selectedEncStates;
+  }
+
   virtual const rnn::States& getStates() const { return states_; }
 
   virtual Expr getTargetHistoryEmbeddings() const { return targetHistoryEmbeddings_; };
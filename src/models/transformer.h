@@ -84,6 +84,16 @@ public:
     return embeddings;
   }
 
+  // positional embeddings of a decoding step whose batch entries are at different positions
+  Expr addPositionalEmbeddings(Expr input, // [-4: beam depth, -3: 1, -2: batch size, -1: vector dim]
+                               const std::vector<int>& positions) const { // [batch size]
+    int dimEmb = input->shape()[-1];
+    auto embeddings = std::sqrt((float)dimEmb) * input;
+    auto signal = graph_->constant({1, (int)positions.size(), dimEmb},
+                                   inits::sinusoidalPositionEmbeddings(positions));
+    return embeddings + signal;
+  }
+
   virtual Expr addSpecialEmbeddings(Expr input, int start = 0, Ptr<data::CorpusBatch> /*batch*/ = nullptr) const {
     bool trainPosEmbeddings = opt<bool>("transformer-train-positions", false);
     return addPositionalEmbeddings(input, start, trainPosEmbeddings);
@@ -252,6 +262,19 @@ public:
     return output;
   }
 
+  // project keys or values (kind is "k" or "v") and split them into heads
+  Expr ProjectHeads(std::string prefix,
+                    const std::string& kind,
+                    Expr input,   // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
+                    int dimHeads) {
+    int dimModel = input->shape()[-1];
+    auto W = graph_->param(prefix + "_W" + kind, {dimModel, dimModel}, inits::glorot_uniform);
+    auto b = graph_->param(prefix + "_b" + kind, {1,        dimModel}, inits::zeros);
+
+    auto output = affine(input, W, b);    // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
+    return SplitHeads(output, dimHeads);  // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
+  }
+
   Expr MultiHead(std::string prefix,
                  int dimOut,
                  int dimHeads,
@@ -261,23 +284,12 @@ public:
                  const Expr &mask,   // [-4: batch size, -3: num heads broadcast=1, -2: max length broadcast=1, -1: max length]
                  bool cache = false,
                  bool saveAttentionWeights = false) {
-    int dimModel = q->shape()[-1];
-    // @TODO: good opportunity to implement auto-batching here or do something manually?
-    auto Wq = graph_->param(prefix + "_Wq", {dimModel, dimModel}, inits::glorot_uniform);
-    auto bq = graph_->param(prefix + "_bq", {       1, dimModel}, inits::zeros);
-    auto qh = affine(q, Wq, bq);
-    qh = SplitHeads(qh, dimHeads); // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
-
     Expr kh;
     // Caching transformation of the encoder that should not be created again.
     // @TODO: set this automatically by memoizing encoder context and
     // memoization propagation (short-term)
     if (!cache || (cache && cache_.count(prefix + "_keys") == 0)) {
-      auto Wk = graph_->param(prefix + "_Wk", {dimModel, dimModel}, inits::glorot_uniform);
-      auto bk = graph_->param(prefix + "_bk", {1,        dimModel}, inits::zeros);
-
-      kh = affine(keys, Wk, bk);     // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
-      kh = SplitHeads(kh, dimHeads); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
+      kh = ProjectHeads(prefix, "k", keys, dimHeads); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
       cache_[prefix + "_keys"] = kh;
     }
     else {
@@ -286,16 +298,31 @@ public:
 
     Expr vh;
     if (!cache || (cache && cache_.count(prefix + "_values") == 0)) {
-      auto Wv = graph_->param(prefix + "_Wv", {dimModel, dimModel}, inits::glorot_uniform);
-      auto bv = graph_->param(prefix + "_bv", {1,        dimModel}, inits::zeros);
-
-      vh = affine(values, Wv, bv); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
-      vh = SplitHeads(vh, dimHeads);
+      vh = ProjectHeads(prefix, "v", values, dimHeads); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
       cache_[prefix + "_values"] = vh;
     } else {
       vh = cache_[prefix + "_values"];
     }
 
+    return MultiHeadProjected(prefix, dimOut, dimHeads, q, kh, vh, mask, saveAttentionWeights);
+  }
+
+  // multi-head attention over keys and values that have already been projected and split into heads
+  Expr MultiHeadProjected(std::string prefix,
+                          int dimOut,
+                          int dimHeads,
+                          Expr q,          // [-4: beam depth, -3: batch size, -2: max q length, -1: vector dim]
+                          const Expr &kh,  // [-4: batch size, -3: num heads, -2: max kv length, -1: split vector dim]
+                          const Expr &vh,  // [-4: batch size, -3: num heads, -2: max kv length, -1: split vector dim]
+                          const Expr &mask,// [-4: batch size, -3: num heads broadcast=1, -2: max length broadcast=1, -1: max length]
+                          bool saveAttentionWeights = false) {
+    int dimModel = q->shape()[-1];
+    // @TODO: good opportunity to implement auto-batching here or do something manually?
+    auto Wq = graph_->param(prefix + "_Wq", {dimModel, dimModel}, inits::glorot_uniform);
+    auto bq = graph_->param(prefix + "_bq", {       1, dimModel}, inits::zeros);
+    auto qh = affine(q, Wq, bq);
+    qh = SplitHeads(qh, dimHeads); // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
+
     int dimBeam = q->shape()[-4];
 
     // apply multi-head attention to downscaled inputs
@@ -349,14 +376,31 @@ public:
                                  int startPos) {
     selfMask = transposedLogMask(selfMask);
 
-    auto values = input;
+    int dimModel = input->shape()[-1];
+    auto heads = opt<int>("transformer-heads");
+
+    // Only the new positions are projected. Keys and values of earlier steps are
+    // kept in the decoder state after projection and head splitting, so that the
+    // cost of a decoding step does not grow with the length of the prefix.
+    auto kh = ProjectHeads(prefix, "k", input, heads); // [-4: beam depth * batch size, -3: num heads, -2: new length, -1: split vector dim]
+    auto vh = ProjectHeads(prefix, "v", input, heads);
     if(startPos > 0) {
-      values = concatenate({prevdecoderLayerState.output, input}, /*axis=*/-2);
+      kh = concatenate({prevdecoderLayerState.keys,   kh}, /*axis=*/-2);
+      vh = concatenate({prevdecoderLayerState.values, vh}, /*axis=*/-2);
     }
-    decoderLayerState.output = values;
+    decoderLayerState.keys   = kh;
+    decoderLayerState.values = vh;
 
-    return LayerAttention(prefix, input, values, values, selfMask,
-                          /*cache=*/false);
+    float dropProb = inference_ ? 0 : opt<float>("transformer-dropout");
+    auto opsPre = opt<std::string>("transformer-preprocess");
+    auto output = preProcess(prefix + "_Wo", opsPre, input, dropProb);
+
+    output = MultiHeadProjected(prefix, dimModel, heads, output, kh, vh, selfMask);
+
+    auto opsPost = opt<std::string>("transformer-postprocess");
+    output = postProcess(prefix + "_Wo", opsPost, output, input, dropProb);
+
+    return output;
   }
 
   static inline
@@ -553,23 +597,99 @@ public:
 };
 
 class TransformerState : public DecoderState {
+private:
+  // [batchIndex] number of masked positions at the start of the cached keys and values of each
+  // batch entry; not 0 for sentences that have joined a running search, see merge()
+  std::vector<int> offsets_;
+
 public:
   TransformerState(const rnn::States& states,
                    Logits logProbs,
                    const std::vector<Ptr<EncoderState>>& encStates,
-                   Ptr<data::CorpusBatch> batch)
-      : DecoderState(states, logProbs, encStates, batch) {}
+                   Ptr<data::CorpusBatch> batch,
+                   const std::vector<int>& offsets)
+      : DecoderState(states, logProbs, encStates, batch), offsets_(offsets) {}
 
-  virtual Ptr<DecoderState> select(const std::vector<IndexType>& selIdx,
+  const std::vector<int>& getOffsets() const { return offsets_; }
+
+  virtual Ptr<DecoderState> select(const std::vector<IndexType>& hypIndices,   // [beamIndex * activeBatchSize + batchIndex]
+                                   const std::vector<IndexType>& batchIndices, // [batchIndex]
                                    int beamSize) const override {
+    std::vector<int> offsets = offsets_;
+    if(!batchIndices.empty()) {
+      offsets.clear();
+      for(auto batchIdx : batchIndices)
+        offsets.push_back(offsets_[batchIdx]);
+    }
+
     // Create hypothesis-selected state based on current state and hyp indices
-    auto selectedState = New<TransformerState>(states_.select(selIdx, beamSize, /*isBatchMajor=*/true), logProbs_, encStates_, batch_);
+    auto selectedState = New<TransformerState>(states_.select(hypIndicesExpr(hypIndices), beamSize, /*isBatchMajor=*/true), logProbs_, selectEncoderStates(batchIndices), batch_, offsets);
 
     // Set the same target token position as the current state
     // @TODO: This is the same as in base function.
     selectedState->setPosition(getPosition());
     return selectedState;
   }
+
+  // Append the batch entries of another state, e.g. to admit new sentences into a running beam
+  // search. The cached keys and values of the state at the earlier position are padded at the
+  // start to the later position, and the decoder masks these positions out. The hypotheses of
+  // 'other' are repeated to the beam size of this state.
+  virtual Ptr<DecoderState> merge(Ptr<DecoderState> other) const override {
+    auto otherState = std::dynamic_pointer_cast<TransformerState>(other);
+    ABORT_IF(!otherState || states_.size() != otherState->states_.size(),
+             "Cannot merge transformer states of different depth or type");
+
+    size_t position = std::max(getPosition(), other->getPosition());
+    int pad = (int)(position - getPosition());
+    int otherPad = (int)(position - other->getPosition());
+    int dimBatch = (int)offsets_.size();
+    int otherDimBatch = (int)otherState->offsets_.size();
+
+    auto padTime = [](Expr x, int length) -> Expr { // [beam depth * batch size, num heads, max length, split vector dim]
+      if(length == 0)
+        return x;
+      auto shape = x->shape();
+      shape.set(-2, length);
+      return concatenate({x->graph()->constant(shape, inits::zeros), x}, /*axis=*/ -2);
+    };
+    auto mergeExprs = [&](Expr a, Expr b) -> Expr {
+      if(!a)
+        return a;
+      a = padTime(a, pad);
+      b = padTime(b, otherPad);
+      auto shape = a->shape();
+      int dimBeam = shape[-4] / dimBatch;
+      int otherDimBeam = b->shape()[-4] / otherDimBatch;
+      ABORT_IF(otherDimBeam != 1 && otherDimBeam != dimBeam, "Cannot merge transformer states of beam size {} and {}", dimBeam, otherDimBeam);
+      a = reshape(a, {dimBeam,      dimBatch,      shape[-3] * shape[-2], shape[-1]});
+      b = reshape(b, {otherDimBeam, otherDimBatch, shape[-3] * shape[-2], shape[-1]});
+      if(otherDimBeam != dimBeam)
+        b = repeat(b, dimBeam, /*axis=*/ -4);
+      auto merged = concatenate({a, b}, /*axis=*/ -3);
+      return reshape(merged, {dimBeam * (dimBatch + otherDimBatch), shape[-3], shape[-2], shape[-1]});
+    };
+
+    rnn::States mergedStates;
+    for(size_t i = 0; i < states_.size(); ++i) {
+      const auto& layerState = states_[i];
+      const auto& otherLayerState = otherState->states_[i];
+      ABORT_IF(layerState.output || layerState.cell, "Only the states of self-attention layers can be merged");
+      mergedStates.push_back({nullptr, nullptr,
+                              mergeExprs(layerState.keys, otherLayerState.keys),
+                              mergeExprs(layerState.values, otherLayerState.values)});
+    }
+
+    std::vector<int> offsets;
+    for(auto offset : offsets_)
+      offsets.push_back(offset + pad);
+    for(auto offset : otherState->offsets_)
+      offsets.push_back(offset + otherPad);
+
+    auto mergedState = New<TransformerState>(mergedStates, Logits(), mergeEncoderStates(other), batch_, offsets);
+    mergedState->setPosition(position);
+    return mergedState;
+  }
 };
 
 class DecoderTransformer : public Transformer<DecoderBase> {
@@ -577,6 +697,7 @@ class DecoderTransformer : public Transformer<DecoderBase> {
   using Base::Base;
 private:
   Ptr<mlp::Output> output_;
+  std::vector<Expr> lastContexts_; // encoder contexts the projections in cache_ were computed from
 
 private:
   // @TODO: move this out for sharing with other models
@@ -599,9 +720,26 @@ private:
     output_ = std::dynamic_pointer_cast<mlp::Output>(outputFactory.construct(graph_)); // (construct() returns only the underlying interface)
   }
 
+  // self-attention mask of a decoding step that masks out the first offsets[i] positions of batch entry i
+  Expr offsetMask(const std::vector<int>& offsets, int dimBeam, int dimTime) const {
+    int dimBatch = (int)offsets.size();
+    std::vector<float> vMask(dimBeam * dimBatch * dimTime, 1.f);
+    for(int beam = 0; beam < dimBeam; ++beam)
+      for(int i = 0; i < dimBatch; ++i)
+        std::fill_n(vMask.begin() + (beam * dimBatch + i) * dimTime, offsets[i], 0.f);
+    return graph_->constant({1, dimBeam * dimBatch, 1, dimTime}, inits::from_vector(vMask));
+  }
+
 public:
   //DecoderTransformer(Ptr<ExpressionGraph> graph, Ptr<Options> options) : Transformer(graph, options) {}
 
+  // New sentences can join a running search if the states of all decoder layers are the cached
+  // keys and values of self-attention, and positions are not embedded by training.
+  virtual bool statesAreMergeable() const override {
+    return opt<std::string>("transformer-decoder-autoreg", "self-attention") == "self-attention"
+           && !opt<bool>("transformer-train-positions", false);
+  }
+
   virtual Ptr<DecoderState> startState(
       Ptr<ExpressionGraph> graph,
       Ptr<data::CorpusBatch> batch,
@@ -621,7 +759,7 @@ public:
     }
     else {
       rnn::States startStates;
-      return New<TransformerState>(startStates, Logits(), encStates, batch);
+      return New<TransformerState>(startStates, Logits(), encStates, batch, std::vector<int>(batch->size(), 0));
     }
   }
 
@@ -647,7 +785,22 @@ public:
     // Used for position embeddings and creating new decoder states.
     int startPos = (int)state->getPosition();
 
-    auto scaledEmbeddings = addSpecialEmbeddings(embeddings, startPos);
+    // Sentences that have joined a running search are at earlier positions of their own, and
+    // their cached keys and values start with masked positions, see TransformerState::merge().
+    std::vector<int> offsets;
+    if(auto transformerState = std::dynamic_pointer_cast<TransformerState>(state))
+      offsets = transformerState->getOffsets();
+    bool hasOffsets = std::any_of(offsets.begin(), offsets.end(), [](int offset) { return offset > 0; });
+
+    Expr scaledEmbeddings;
+    if(hasOffsets) {
+      std::vector<int> positions;
+      for(auto offset : offsets)
+        positions.push_back(startPos - offset);
+      scaledEmbeddings = addPositionalEmbeddings(embeddings, positions);
+    } else {
+      scaledEmbeddings = addSpecialEmbeddings(embeddings, startPos);
+    }
     scaledEmbeddings = atleast_nd(scaledEmbeddings, 4);
 
     // reorganize batch and timestep
@@ -667,6 +820,18 @@ public:
                             {1, dimBatch, 1, dimTrgWords}); // [ 1, batch size, 1, max length ]
       selfMask = selfMask * decoderMask;
     }
+    if(hasOffsets)
+      selfMask = offsetMask(offsets, dimBeam, startPos + dimTrgWords); // [1, beam depth * batch size, 1, max length]
+
+    // The cached projections of the encoder contexts belong to the contexts they were
+    // computed from, and are rebuilt when beam search has dropped finished sentences.
+    std::vector<Expr> contexts;
+    for(auto encoderState : state->getEncoderStates())
+      contexts.push_back(encoderState->getContext());
+    if(contexts != lastContexts_) {
+      cache_.clear();
+      lastContexts_ = contexts;
+    }
 
     std::vector<Expr> encoderContexts;
     std::vector<Expr> encoderMasks;
@@ -782,7 +947,7 @@ public:
         decoderStates, logits, state->getEncoderStates(), state->getBatch());
     } else {
       nextState = New<TransformerState>(
-        decoderStates, logits, state->getEncoderStates(), state->getBatch());
+        decoderStates, logits, state->getEncoderStates(), state->getBatch(), offsets);
     }
     nextState->setPosition(state->getPosition() + 1);
     return nextState;
@@ -798,6 +963,7 @@ public:
     if (output_)
       output_->clear();
     cache_.clear();
+    lastContexts_.clear();
     alignments_.clear();
   }
 };
@@ -12,10 +12,39 @@ struct State {
   Expr output;
   Expr cell;
 
+  // Transformer self-attention only: keys and values of all previous target positions,
+  // already projected and split into heads, so that decoding only projects the new token.
+  Expr keys;   // [beam depth * batch size, num heads, max length, split vector dim]
+  Expr values; // [beam depth * batch size, num heads, max length, split vector dim]
+
   State select(const std::vector<IndexType>& selIdx, // [beamIndex * activeBatchSize + batchIndex]
                int beamSize, bool isBatchMajor) const {
+    for(auto part : {output, cell, keys, values})
+      if(part)
+        return select(part->graph()->indices(selIdx), beamSize, isBatchMajor);
+    return *this; // nothing to select from
+  }
+
+  // same, with the indices given as a tensor so that all parts of the state share one index constant
+  State select(Expr selIdx, // [beamIndex * activeBatchSize + batchIndex]
+               int beamSize, bool isBatchMajor) const {
     return{ select(output, selIdx, beamSize, isBatchMajor),
-            select(cell,   selIdx, beamSize, isBatchMajor) };
+            select(cell,   selIdx, beamSize, isBatchMajor),
+            selectHeads(keys,   selIdx),
+            selectHeads(values, selIdx) };
+  }
+
+  // reorder a tensor whose outermost axis enumerates hypotheses in beam-major order
+  static Expr selectHeads(Expr sel, // [beamSize * dimBatch, dimHeads, dimTime, dimDepth]
+                          Expr selIdx) { // [beamIndex * activeBatchSize + batchIndex]
+    if (!sel)
+      return sel; // keep nullptr untouched
+
+    auto shape = sel->shape();
+    int dimRows = shape[-4];
+    sel = reshape(sel, { dimRows, shape.elements() / dimRows });
+    sel = rows(sel, selIdx);
+    return reshape(sel, { selIdx->shape().elements(), shape[-3], shape[-2], shape[-1] });
   }
 
   // this function is also called by Logits
@@ -26,9 +55,19 @@ struct State {
     if (!sel)
       return sel; // keep nullptr untouched
 
+    return select(sel, sel->graph()->indices(selIdx), beamSize, isBatchMajor);
+  }
+
+  static Expr select(Expr sel, // [beamSize, dimTime, dimBatch, dimDepth] or [beamSize, dimBatch, dimTime, dimDepth] (dimTime = 1 for RNN)
+                     Expr selIdx, // [beamIndex * activeBatchSize + batchIndex]
+                     int beamSize, bool isBatchMajor)
+  {
+    if (!sel)
+      return sel; // keep nullptr untouched
+
     sel = atleast_4d(sel);
 
-    int dimBatch = (int)selIdx.size() / beamSize;
+    int dimBatch = selIdx->shape().elements() / beamSize;
     int dimDepth = sel->shape()[-1];
     int dimTime  = isBatchMajor ? sel->shape()[-2] : sel->shape()[-3];
 
@@ -88,6 +127,14 @@ public:
     return selected;
   }
 
+  States select(Expr selIdx, // [beamIndex * activeBatchSize + batchIndex]
+                int beamSize, bool isBatchMajor) const {
+    States selected;
+    for(auto& state : states_)
+      selected.push_back(state.select(selIdx, beamSize, isBatchMajor));
+    return selected;
+  }
+
   void reverse() { std::reverse(states_.begin(), states_.end()); }
 
   void clear() { states_.clear(); }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <memory>
@@ -89,6 +90,9 @@ private:
 
   std::set<Gap> gaps_;
   std::unordered_map<uint8_t*, Ptr<MemoryPiece>> allocated_;
+  std::vector<Weak<MemoryPiece>> views_; // pieces within allocated memory, see view()
+  size_t liveViews_{0};                  // number of views after the last removal of expired ones
+  size_t peakBytes_{0};                  // see peakBytes()
 
   size_t align(size_t size) {
     return (size_t)(ceil(size / (float)alignment_) * alignment_);
@@ -116,6 +120,18 @@ private:
       allocated_[newPtr] = oldAllocated[it.first];
       allocated_[newPtr]->setPtr(newPtr);
     }
+
+    removeExpiredViews();
+    for(auto& weak : views_)
+      if(auto view = weak.lock())
+        view->setPtr(device_->data() + std::distance(oldData, view->data()));
+  }
+
+  void removeExpiredViews() {
+    views_.erase(std::remove_if(views_.begin(), views_.end(),
+                                [](const Weak<MemoryPiece>& view) { return view.expired(); }),
+                 views_.end());
+    liveViews_ = views_.size();
   }
 
   Gap getGap(size_t size) {
@@ -214,9 +230,32 @@ public:
     auto ptr = gap.data();
     auto mp = New<MemoryPiece>(ptr, bytes);
     allocated_[ptr] = mp;
+    peakBytes_ = std::max(peakBytes_, allocatedBytes());
     return mp;
   }
 
+  /**
+   * Returns a piece of bytes at offset within the allocated piece mp, e.g. a slot of a
+   * MemoryPlan arena. The view is not freed on its own and must not be used after mp is freed,
+   * but it is moved along with mp when the allocator grows.
+   */
+  Ptr<MemoryPiece> view(Ptr<MemoryPiece> mp, size_t offset, size_t bytes) {
+    ABORT_IF(offset + bytes > mp->size(),
+             "View of {} bytes at offset {} exceeds allocated piece of {} bytes",
+             bytes, offset, mp->size());
+    if(views_.size() >= 2 * liveViews_ + 1024)
+      removeExpiredViews();
+    auto view = New<MemoryPiece>(mp->data() + offset, bytes);
+    views_.push_back(view);
+    return view;
+  }
+
+  // Whether mp was returned by alloc() and has not been freed yet
+  bool owns(Ptr<MemoryPiece> mp) {
+    auto it = allocated_.find(mp->data());
+    return it != allocated_.end() && it->second == mp;
+  }
+
   bool free(uint8_t* ptr, size_t bytes) {
     bytes = align(bytes);
 
@@ -235,6 +274,11 @@ public:
   }
 
   bool free(Ptr<MemoryPiece> mp) {
+    // views point into allocated memory, but do not own it
+    auto it = allocated_.find(mp->data());
+    if(it != allocated_.end() && it->second != mp)
+      return false;
+
     if(free(mp->data(), mp->size())) {
       mp->set(nullptr, 0);
       return true;
@@ -246,7 +290,10 @@ public:
     available_ = 0;
     gaps_.clear();
     allocated_.clear();
+    views_.clear();
+    liveViews_ = 0;
     insertGap({device_->data(), device_->size()}, false);
+    peakBytes_ = 0;
   }
 
   Ptr<MemoryPiece> memory() {
@@ -255,6 +302,12 @@ public:
 
   size_t size() { return device_->size(); }
 
+  // Bytes that are currently allocated, and the most that were allocated at the same time since
+  // the last clear() or resetPeakBytes()
+  size_t allocatedBytes() { return device_->size() - available_; }
+  size_t peakBytes() { return peakBytes_; }
+  void resetPeakBytes() { peakBytes_ = allocatedBytes(); }
+
   size_t available() { return available_; }
 
   DeviceId getDeviceId() { return device_->getDeviceId(); }
@@ -6,9 +6,31 @@
 #endif
 
 #include "tensors/cpu/backend.h"
+#include "tensors/cpu/sharp/packed_gemm.h"
 
 namespace marian {
 
+size_t requiredBytes(const Shape& shape, Type type) {
+  if(!isPacked(type))
+    return shape.elements() * sizeOf(type);
+
+#if !USE_FBGEMM
+  ABORT_IF(type == Type::packed16 || type == Type::packed8,
+           "Weights of type {} need a build with FBGEMM (cmake -DUSE_FBGEMM=on). "
+           "Convert the original model again without --gemm-type or with --gemm-type intrinint16 for this build",
+           type);
+#endif
+
+  int rows = (int)(shape.elements() / shape[-1]);
+  int cols = shape[-1];
+  switch(type) {
+    case Type::intrinint16: return shape.elements() * sizeof(int16_t);
+    case Type::packed16:    return cpu::variant::PackFp32Layout(rows, cols).packsize;
+    case Type::packed8:     return cpu::variant::PackInt8Size(rows, cols);
+    default: ABORT("Unknown packed type {}", type);
+  }
+}
+
 Ptr<Backend> BackendByDeviceId(DeviceId deviceId, size_t seed) {
 #ifdef CUDA_FOUND
   if(deviceId.type == DeviceType::gpu)
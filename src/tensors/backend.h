@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common/definitions.h"
+#include "common/types.h"
 #include "tensors/rand.h"
 
 namespace marian {
@@ -13,6 +14,10 @@ typedef enum { Auto = 0,            // auto tuning between available GEMMs
                FbInt8Packed = 11    // FBGEMM based int8 GEMM with packing
 } GemmType;
 
+// Number of bytes of a tensor with the given shape and type. For packed types, the shape is the
+// shape of the matrix before packing and the size is that of the layout of the CPU backend.
+size_t requiredBytes(const Shape& shape, Type type);
+
 class Backend {
 protected:
   DeviceId deviceId_;
@@ -44,6 +49,9 @@ public:
   // for GPU, there's no gemm type. so, it does nothing.
   virtual void setGemmType(std::string gemmType) = 0;
   virtual GemmType getGemmType() = 0;
+  // for CPU, selects the instruction set of the int16/int8 GEMM kernels, see --gemm-isa.
+  // for GPU, it does nothing.
+  virtual void setGemmIsa(std::string isa) = 0;
 };
 
 Ptr<Backend> BackendByDeviceId(DeviceId deviceId, size_t seed);
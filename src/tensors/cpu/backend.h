@@ -5,6 +5,7 @@
 
 #include "common/config.h"
 #include "tensors/backend.h"
+#include "tensors/cpu/sharp/int_gemm.h"
 
 namespace marian {
 namespace cpu {
@@ -34,6 +35,8 @@ public:
     else ABORT("Unknown GEMM type - '{}'", gemmType);
   }
   GemmType getGemmType() override { return gemmType_; }
+  // for CPU only, selects the instruction set of the int16/int8 GEMM kernels. Does nothing for GPU.
+  void setGemmIsa(std::string isa) override { int16::setIsa(isa); }
 };
 }  // namespace cpu
 }  // namespace marian
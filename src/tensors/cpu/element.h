@@ -69,5 +69,14 @@ void Element(const Functor& functor, marian::Tensor out, Tensors... tensors) {
   E<0>::element(functor, gTensors, indices);
 }
 
+// Applies the functor to n consecutive values of out and of each of the arrays, without
+// broadcasting. out may be one of the arrays. Used by the operations that ElementwiseFusion
+// merges, see NaryNodeOp::forwardElementwise().
+template <class Functor, class... Arrays>
+void ElementContiguous(Functor functor, int n, float* out, Arrays... arrays) {
+  for(int i = 0; i < n; ++i)
+    functor(out[i], arrays[i]...);
+}
+
 }  // namespace cpu
 }  // namespace marian
@@ -19,8 +19,17 @@ enum class PackMatrix : uint8_t {
   B = 0x01
 };
 
+// Enumeration for the format of a packed matrix
+// Fp16 - fp16 values for FBGEMM's fp16 GEMM
+// Int8 - int8 values quantized per column for FBGEMM's int8 GEMM
+enum class PackType : uint8_t {
+  Fp16 = 0x00,
+  Int8 = 0x01
+};
+
 // Pack a matrix into cache utilization efficient way (block format)
 // PackMatrix packMat_: the type of packed matrix - A or B matrix
+// PackType packType_: the format of the packed matrix - fp16 or int8
 // bool transpose_: transpose
 // int nrow_: the number of rows
 // int ncol_: the number of columns
@@ -31,9 +40,11 @@ enum class PackMatrix : uint8_t {
 // int nbrow_: row index in a block
 // int nbcol_: column index in a block
 // uint64_t packsize_: the size of the packed matrix
-//                    (the number of fp16 elements + padding (1024) + extra temporary memory (256))
+//                    (the number of fp16 elements + padding (1024) + extra temporary memory (256),
+//                     or PackInt8Size() for int8)
 struct PackNodeOp : public UnaryNodeOp {
   PackMatrix packMat_;
+  PackType packType_;
   bool transpose_;
   int nrow_;
   int ncol_;
@@ -45,19 +56,23 @@ struct PackNodeOp : public UnaryNodeOp {
   int nbcol_;
   uint64_t packsize_;
 
-  PackNodeOp(Expr a, PackMatrix packMat, bool transpose, float clipValue)
-      : UnaryNodeOp(a, newShape(a, transpose), Type::uint8),
+  PackNodeOp(Expr a, PackMatrix packMat, PackType packType, bool transpose, float clipValue)
+      : UnaryNodeOp(a, newShape(a, packType, transpose), Type::uint8),
         packMat_(packMat),
+        packType_(packType),
         transpose_(transpose) {
     if(packMat != PackMatrix::B)
       ABORT("Only prepacking of B (weight matrix) is supported");
     if(clipValue != 0)
       ABORT("Clipping is not supported");
-    if(!memoize_)
-      ABORT("Only constant weight node can be packed");
+    // Weights that are not memoized are packed again whenever a new pack node is created;
+    // see prepareAffineWeights() for weights that only stay constant within one batch.
   }
 
   NodeOps forwardOps() override {
+    if(packType_ == PackType::Int8)
+      return {NodeOp(PackInt8(val_, child(0)->val(), transpose_, nrow_, ncol_))};
+
     return {NodeOp(PackFp32(val_,
                             child(0)->val(),
                             transpose_,
@@ -78,9 +93,9 @@ struct PackNodeOp : public UnaryNodeOp {
     return {NodeOp(0)};
   }
 
-  const std::string type() override { return "packMat"; }
+  const std::string type() override { return packType_ == PackType::Int8 ? "packMatInt8" : "packMat"; }
 
-  Shape newShape(Expr a, bool transpose) {
+  Shape newShape(Expr a, PackType packType, bool transpose) {
 #if USE_FBGEMM
     auto shapeMat = a->shape();
     // Should be 2D - weight matrix
@@ -88,15 +103,19 @@ struct PackNodeOp : public UnaryNodeOp {
              "Weight Matrix should be 2D");
     nrow_ = transpose ? shapeMat[1] : shapeMat[0];
     ncol_ = transpose ? shapeMat[0] : shapeMat[1];
-    kernel_ncol_blocks_ = 2;
-    brow_ = 512;
-    bcol_ = 8 * kernel_ncol_blocks_;
-    last_brow_ = nrow_ % brow_ == 0 ? brow_ : nrow_ % brow_;
-    nbrow_ = nrow_ % brow_ == 0 ? nrow_ / brow_ : (nrow_ + brow_) / brow_;
-    nbcol_ = ncol_ % bcol_ == 0 ? ncol_ / bcol_ : (ncol_ + bcol_) / bcol_;
-    const int padding = 1024;  // required by sw pipelined kernels
-    const int specialMem = 256;
-    packsize_ = ((nbrow_ * brow_) * (nbcol_ * bcol_)) * sizeof(fbgemm::float16) + padding + specialMem;
+    if(packType == PackType::Int8) {
+      packsize_ = PackInt8Size(nrow_, ncol_);
+      return Shape({(int)packsize_});
+    }
+
+    auto info = PackFp32Layout(nrow_, ncol_);
+    kernel_ncol_blocks_ = info.kernel_ncol_blocks;
+    brow_ = info.brow;
+    bcol_ = info.bcol;
+    last_brow_ = info.last_brow;
+    nbrow_ = info.nbrow;
+    nbcol_ = info.nbcol;
+    packsize_ = info.packsize;
 
     Shape outShape({(int)packsize_});
 
@@ -109,6 +128,7 @@ struct PackNodeOp : public UnaryNodeOp {
 };
 
 // Affine transform (matrix multiplication) using packed B matrix
+// PackType packType_: the format of the packed B matrix - fp16 or int8
 // float scalar_: scalar multiplier
 // size_t m_: the number of rows in A and C
 // size_t n_: the number of columns in B and C
@@ -117,6 +137,7 @@ struct PackNodeOp : public UnaryNodeOp {
 // bool transB_: transpose B
 class AffineNodeOp : public NaryNodeOp {
 private:
+  PackType packType_;
   float scalar_;
   size_t m_;
   size_t n_;
@@ -125,8 +146,9 @@ private:
   bool transB_;
 
 public:
-  AffineNodeOp(const std::vector<Expr>& nodes, Shape bShape, bool transA, bool transB, float scalar)
+  AffineNodeOp(const std::vector<Expr>& nodes, PackType packType, Shape bShape, bool transA, bool transB, float scalar)
       : NaryNodeOp(nodes, newShape(nodes[0], bShape, transA, transB), Type::float32),
+        packType_(packType),
         scalar_(scalar) {
     transA_ = transA;
     transB_ = transB;
@@ -162,6 +184,18 @@ public:
   }
 
   NodeOps forwardOps() override {
+    if(packType_ == PackType::Int8)
+      return {
+        NodeOp(GemmPackInt8(val_,
+                            child(0)->val(),
+                            child(1)->val(),
+                            child(2)->val(),
+                            m_,
+                            n_,
+                            k_,
+                            transA_))
+      };
+
     return {
       NodeOp(GemmPackFp32(val_,
                           child(0)->val(),
@@ -178,16 +212,18 @@ public:
     return {NodeOp(0)};
   }
 
-  const std::string type() override { return "fp16packed"; }
+  const std::string type() override { return packType_ == PackType::Int8 ? "int8packed" : "fp16packed"; }
 };
 
-static inline Expr affine(Expr a, Expr b, Shape bShape, Expr c, bool transA, bool transB, float scalar) {
+static inline Expr affine(Expr a, Expr b, Shape bShape, Expr c, bool transA, bool transB, float scalar,
+                          PackType packType = PackType::Fp16) {
   std::vector<Expr> nodes = {a, b, c};
-  return Expression<cpu::variant::AffineNodeOp>(nodes, bShape, transA, transB, scalar);
+  return Expression<cpu::variant::AffineNodeOp>(nodes, packType, bShape, transA, transB, scalar);
 }
 
-static inline Expr pack(Expr a, PackMatrix packMat, bool transpose, float clipValue) {
-  return Expression<cpu::variant::PackNodeOp>(a, packMat, transpose, clipValue);
+static inline Expr pack(Expr a, PackMatrix packMat, bool transpose, float clipValue,
+                        PackType packType = PackType::Fp16) {
+  return Expression<cpu::variant::PackNodeOp>(a, packMat, packType, transpose, clipValue);
 }
 
 }  // namespace variant
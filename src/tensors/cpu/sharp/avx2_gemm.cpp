@@ -0,0 +1,230 @@
+#include <immintrin.h>
+#include <stdint.h>
+#include <cassert>
+#include <cstddef>
+
+// AVX2 versions of the 16-bit and 8-bit kernels in sse_gemm.cpp and avx_gemm.cpp. This file is
+// compiled with -mavx2 only and called after checking the CPU at runtime, see int_gemm.cpp.
+// The quantized matrices have the same layout as for the other instruction sets.
+
+namespace marian {
+namespace cpu {
+namespace int16 {
+
+namespace {
+
+// Multiply 8 floats by the quantization factor and convert them to int32_t.
+inline __m256i QuantizerGrab(const float *input, const __m256 quant_mult_reg) {
+  return _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(input), quant_mult_reg));
+}
+
+// Same rounding as _mm256_cvtps_epi32 for the elements that do not fill a register.
+inline int32_t QuantizeOne(float input, float quant_mult) {
+  return _mm_cvtss_si32(_mm_set_ss(input * quant_mult));
+}
+
+// Returns [sum(sum1), sum(sum2), sum(sum3), sum(sum4)] of 32-bit integers.
+inline __m128i Reduce32(__m256i sum1, __m256i sum2, __m256i sum3, __m256i sum4) {
+  // 1 1 2 2 1 1 2 2
+  __m256i pack12 = _mm256_hadd_epi32(sum1, sum2);
+  // 3 3 4 4 3 3 4 4
+  __m256i pack34 = _mm256_hadd_epi32(sum3, sum4);
+  // 1 2 3 4 1 2 3 4
+  __m256i pack1234 = _mm256_hadd_epi32(pack12, pack34);
+  // Cut the register into halves and sum those.
+  return _mm_add_epi32(_mm256_castsi256_si128(pack1234),
+                       _mm256_extracti128_si256(pack1234, 1));
+}
+
+inline int32_t Reduce32(__m256i sum1) {
+  __m128i halves = _mm_add_epi32(_mm256_castsi256_si128(sum1),
+                                 _mm256_extracti128_si256(sum1, 1));
+  halves = _mm_hadd_epi32(halves, halves);
+  halves = _mm_hadd_epi32(halves, halves);
+  return _mm_cvtsi128_si32(halves);
+}
+
+// Convert 16-bit sums to 32-bit, see Convert32Sum() in avx_gemm.cpp
+inline __m256i Convert32Sum(__m256i sum) {
+  return _mm256_madd_epi16(sum, _mm256_set1_epi16(1));
+}
+
+// Writes the unquantized sums of Rows rows of A with one row of B. C points to the first row,
+// and consecutive rows are num_B_rows apart.
+template <int Rows>
+inline void Write(float *C, const __m256i (&sums)[Rows], float unquant_mult, int num_B_rows) {
+  int r = 0;
+  for(; r + 4 <= Rows; r += 4) {
+    int32_t reduced[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(reduced),
+                     Reduce32(sums[r], sums[r + 1], sums[r + 2], sums[r + 3]));
+    for(int i = 0; i < 4; ++i)
+      C[(r + i) * num_B_rows] = unquant_mult * static_cast<float>(reduced[i]);
+  }
+  for(; r < Rows; ++r)
+    C[r * num_B_rows] = unquant_mult * static_cast<float>(Reduce32(sums[r]));
+}
+
+// Multiplies Rows rows of A, starting at A_rows, with all rows of B. Unrolling over the rows of A
+// lets each register of B be used Rows times, see SSE_MatrixMult16().
+template <int Rows>
+void MatrixMult16Rows(const __m256i *A_rows,
+                      const __m256i *B,
+                      float *C,
+                      float unquant_mult,
+                      int num_B_rows,
+                      int sse_width) {
+  for(int j = 0; j < num_B_rows; j++) {
+    const __m256i *B_row = B + j * sse_width;
+    __m256i sums[Rows];
+    for(int r = 0; r < Rows; ++r)
+      sums[r] = _mm256_setzero_si256();
+    for(int k = 0; k < sse_width; k++) {
+      __m256i b = _mm256_load_si256(B_row + k);
+      for(int r = 0; r < Rows; ++r)
+        sums[r] = _mm256_add_epi32(sums[r], _mm256_madd_epi16(b, _mm256_load_si256(A_rows + r * sse_width + k)));
+    }
+    Write<Rows>(C + j, sums, unquant_mult, num_B_rows);
+  }
+}
+
+// Multiplies with the sign trick of Accum() in avx_gemm.cpp: maddubs multiplies unsigned with
+// signed bytes, so the sign of b is moved to a. Sums are kept in 16 bits as for AVX-512.
+template <int Rows>
+void MatrixMult8Rows(const __m256i *A_rows,
+                     const __m256i *B,
+                     float *C,
+                     float unquant_mult,
+                     int num_B_rows,
+                     int sse_width) {
+  for(int j = 0; j < num_B_rows; j++) {
+    const __m256i *B_row = B + j * sse_width;
+    __m256i sums[Rows];
+    for(int r = 0; r < Rows; ++r)
+      sums[r] = _mm256_setzero_si256();
+    for(int k = 0; k < sse_width; k++) {
+      __m256i b = _mm256_load_si256(B_row + k);
+      __m256i b_positive = _mm256_abs_epi8(b);
+      for(int r = 0; r < Rows; ++r) {
+        __m256i a = _mm256_sign_epi8(_mm256_load_si256(A_rows + r * sse_width + k), b);
+        sums[r] = _mm256_adds_epi16(sums[r], _mm256_maddubs_epi16(b_positive, a));
+      }
+    }
+    for(int r = 0; r < Rows; ++r)
+      sums[r] = Convert32Sum(sums[r]);
+    Write<Rows>(C + j, sums, unquant_mult, num_B_rows);
+  }
+}
+
+}  // namespace
+
+void AVX2_Quantize16(const float *input,
+                     int16_t *output,
+                     float quant_mult,
+                     std::size_t size) {
+  const __m256 quant_mult_reg = _mm256_set1_ps(quant_mult);
+  std::size_t size16 = size & ~15;
+  std::size_t i = 0;
+  for(; i < size16; i += 16) {
+    // Saturating pack into 16-bit works per 128-bit lane, so restore the order afterwards.
+    __m256i packed = _mm256_packs_epi32(QuantizerGrab(input + i, quant_mult_reg),
+                                        QuantizerGrab(input + i + 8, quant_mult_reg));
+    packed = _mm256_permute4x64_epi64(packed, 0xd8 /* 0, 2, 1, 3 */);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), packed);
+  }
+  for(; i < size; ++i) {
+    int32_t value = QuantizeOne(input[i], quant_mult);
+    output[i] = (int16_t)(value < -32768 ? -32768 : (value > 32767 ? 32767 : value));
+  }
+}
+
+void AVX2_Quantize8(const float *input,
+                    int8_t *output,
+                    float quant_mult,
+                    std::size_t size) {
+  // -128 is banned as in AVX_Quantize8()
+  const __m256i neg127 = _mm256_set1_epi32(-127);
+  const __m256 quant_mult_reg = _mm256_set1_ps(quant_mult);
+  const __m256i order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+  std::size_t size32 = size & ~31;
+  std::size_t i = 0;
+  for(; i < size32; i += 32) {
+    __m256i a = _mm256_max_epi32(QuantizerGrab(input + i, quant_mult_reg), neg127);
+    __m256i b = _mm256_max_epi32(QuantizerGrab(input + i + 8, quant_mult_reg), neg127);
+    __m256i c = _mm256_max_epi32(QuantizerGrab(input + i + 16, quant_mult_reg), neg127);
+    __m256i d = _mm256_max_epi32(QuantizerGrab(input + i + 24, quant_mult_reg), neg127);
+    // The packs interleave the 128-bit lanes, which leaves 4-byte groups in the order
+    // a0 b0 c0 d0 a1 b1 c1 d1; permute them back.
+    __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+    packed = _mm256_permutevar8x32_epi32(packed, order);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), packed);
+  }
+  for(; i < size; ++i) {
+    int32_t value = QuantizeOne(input[i], quant_mult);
+    output[i] = (int8_t)(value < -127 ? -127 : (value > 127 ? 127 : value));
+  }
+}
+
+// A * B^T as in SSE_MatrixMult16(). A and B must be 32-byte aligned and width a multiple of 16.
+void AVX2_MatrixMult16(const __m256i *A,
+                       const __m256i *B,
+                       float *C,
+                       float unquant_mult,
+                       int num_A_rows,
+                       int num_B_rows,
+                       int width) {
+  assert(width % 16 == 0);
+  assert(reinterpret_cast<uintptr_t>(A) % 32 == 0);
+  assert(reinterpret_cast<uintptr_t>(B) % 32 == 0);
+
+  const int sse_width = width / 16;
+  int i = 0;
+  for(; i + 4 <= num_A_rows; i += 4)
+    MatrixMult16Rows<4>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width);
+  switch(num_A_rows - i) {
+    case 3: MatrixMult16Rows<3>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+    case 2: MatrixMult16Rows<2>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+    case 1: MatrixMult16Rows<1>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+  }
+}
+
+// A * B^T of 8-bit matrices quantized by AVX2_Quantize8(). A and B must be 32-byte aligned and
+// width a multiple of 32.
+void AVX2_MatrixMult8(const __m256i *A,
+                      const __m256i *B,
+                      float *C,
+                      float unquant_mult,
+                      int num_A_rows,
+                      int num_B_rows,
+                      int width) {
+  assert(width % 32 == 0);
+  assert(reinterpret_cast<uintptr_t>(A) % 32 == 0);
+  assert(reinterpret_cast<uintptr_t>(B) % 32 == 0);
+
+  const int sse_width = width / 32;
+  int i = 0;
+  for(; i + 4 <= num_A_rows; i += 4)
+    MatrixMult8Rows<4>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width);
+  switch(num_A_rows - i) {
+    case 3: MatrixMult8Rows<3>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+    case 2: MatrixMult8Rows<2>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+    case 1: MatrixMult8Rows<1>(A + i * sse_width, B, C + i * num_B_rows, unquant_mult, num_B_rows, sse_width); break;
+  }
+}
+
+// C += bias for each row of C
+void AVX2_AddBias(float* C, const float* bias, int num_rows, int width) {
+  int vecWidth = width & ~7;
+  for(int j = 0; j < num_rows; ++j) {
+    float* row = C + (size_t)j * width;
+    int i = 0;
+    for(; i < vecWidth; i += 8)
+      _mm256_storeu_ps(row + i, _mm256_add_ps(_mm256_loadu_ps(row + i), _mm256_loadu_ps(bias + i)));
+    for(; i < width; ++i)
+      row[i] += bias[i];
+  }
+}
+
+}  // namespace int16
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,190 @@
+#pragma once
+
+// Reductions and output helpers shared by the AVX-512 kernels in avx_gemm.cpp and vnni_gemm.cpp.
+// Include this only from translation units that are compiled for AVX-512. Everything is in an
+// anonymous namespace, so that the linker can never pick these functions from a translation unit
+// that was compiled for a newer instruction set.
+
+#include <immintrin.h>
+#include <stdint.h>
+
+namespace marian {
+namespace cpu {
+namespace int16 {
+
+namespace {
+
+union FloatAccess {
+  float as_f[4];
+  __m128 as_n;
+};
+union IntAccess {
+  int32_t as_i[4];
+  __m128i as_n;
+};
+
+/* Convert 16-bit to 32-bit and add, not caring what parts are added.
+ * Implementations:
+ * 1.
+ * https://github.com/tesseract-ocr/tesseract/blob/master/src/arch/intsimdmatrixavx2.cpp#L67
+ * under Apache license: This does a multiply by 1 and horizontal add:
+ *    _mm512_madd_epi16(sum, _mm512_set1_epi16(1))
+ *   Current fastest.
+ *
+ * 2. Signed extension and fold halves:
+ *    sum = _mm512_add_epi32(
+ *      _mm512_cvtepi16_epi32(_mm512_castsi512_si256(sum)),
+ *      _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(sum, 1)));
+ *
+ * 3. Sign extend by abuse of bitshift, then add.
+ *   __m128i shift16 = _mm_set_epi32(0,0,0,16);
+ *   sum = _mm512_add_epi32(
+ *       _mm512_sra_epi32(_mm512_sll_epi32(sum, shift16), shift16),
+ *       _mm512_sra_epi32(sum, shift16));
+ */
+inline void Convert32Sum(__m512i &sum) {
+  short one = 1;
+  sum = _mm512_madd_epi16(sum, _mm512_set1_epi16(one));
+}
+
+// Two sum version.
+struct ReducedPair {
+  int32_t result[2];
+};
+inline ReducedPair Reduce16to32(__m512i sum1, __m512i sum2) {
+  Convert32Sum(sum1);
+  Convert32Sum(sum2);
+  // 1 2 1 2 1 2 1 2 1 2 1 2 1 2 1 2
+  __m512i pack12 = _mm512_add_epi32(_mm512_unpackhi_epi32(sum1, sum2),
+                                    _mm512_unpacklo_epi32(sum1, sum2));
+  // 1 2 1 2 1 2 1 2
+  __m256i halves = _mm256_add_epi32(_mm512_castsi512_si256(pack12),
+                                    _mm512_extracti64x4_epi64(pack12, (short)1));
+  // 1 2 1 2
+  IntAccess a;
+  a.as_n = _mm_add_epi32(_mm256_castsi256_si128(halves),
+                         _mm256_extracti128_si256(halves, 1));
+  ReducedPair ret;
+  ret.result[0] = a.as_i[0] + a.as_i[2];
+  ret.result[1] = a.as_i[1] + a.as_i[3];
+  return ret;
+}
+
+// Assuming sum1, sum2, sum3, and sum4 are arrays 32-bit signed integers,
+// reduce within each.
+// Returns [sum(sum1), sum(sum2), sum(sum3), sum(sum4)]
+// TODO: consider doing in 64-bit, allowing 4 more bits of quantization?
+inline __m128i Reduce32(__m512i sum1,
+                        __m512i sum2,
+                        __m512i sum3,
+                        __m512i sum4) {
+  // 1 2 1 2 1 2 1 2 1 2 1 2 1 2 1 2
+  __m512i pack12 = _mm512_add_epi32(_mm512_unpackhi_epi32(sum1, sum2),
+                                    _mm512_unpacklo_epi32(sum1, sum2));
+  // 3 4 3 4 3 4 3 4 3 4 3 4 3 4 3 4
+  __m512i pack34 = _mm512_add_epi32(_mm512_unpackhi_epi32(sum3, sum4),
+                                    _mm512_unpacklo_epi32(sum3, sum4));
+  // 1 2 3 4 1 2 3 4 1 2 3 4 1 2 3 4
+  __m512i pack1234 = _mm512_add_epi32(_mm512_unpackhi_epi64(pack12, pack34),
+                                      _mm512_unpacklo_epi64(pack12, pack34));
+  // Cut the register into halves and sum those.  1 2 3 4 1 2 3 4
+  __m256i halves = _mm256_add_epi32(_mm512_castsi512_si256(pack1234),
+                                    _mm512_extracti64x4_epi64(pack1234, (short)1));
+  // Again: cut the register into halves and sum those. 1 2 3 4
+  return _mm_add_epi32(_mm256_castsi256_si128(halves),
+                       _mm256_extracti128_si256(halves, 1));
+}
+
+// Four sum version
+inline __m128i Reduce16to32(__m512i sum1,
+                            __m512i sum2,
+                            __m512i sum3,
+                            __m512i sum4) {
+  Convert32Sum(sum1);
+  Convert32Sum(sum2);
+  Convert32Sum(sum3);
+  Convert32Sum(sum4);
+  return Reduce32(sum1, sum2, sum3, sum4);
+}
+
+// Somewhat inefficient reduce for single __m256i containing int32_t
+inline int32_t Reduce32(__m256i halves) {
+  IntAccess a;
+  a.as_n = _mm_add_epi32(_mm256_castsi256_si128(halves),
+                         _mm256_extracti128_si256(halves, 1));
+  // TODO is there a more efficient way?
+  return a.as_i[0] + a.as_i[1] + a.as_i[2] + a.as_i[3];
+}
+
+// Somewhat inefficient reduce for single __m512i containing int32_t
+inline int32_t Reduce32(__m512i sum1) {
+  // Fold register over itself.
+  return Reduce32(_mm256_add_epi32(_mm512_castsi512_si256(sum1),
+                                   _mm512_extracti64x4_epi64(sum1, (short)1)));
+}
+
+inline int32_t Reduce16to32(__m512i sum1) {
+  Convert32Sum(sum1);
+  // Fold register over itself.
+  return Reduce32(_mm256_add_epi32(_mm512_castsi512_si256(sum1),
+                                   _mm512_extracti64x4_epi64(sum1, (short)1)));
+}
+
+class ScatterPut {
+public:
+  explicit ScatterPut(float unquant_mult, int num_B_rows)
+      : unquant_mult_(unquant_mult),
+        unquant_mult_sse_(_mm_set1_ps(unquant_mult)),
+#ifdef __AVX512VL__
+        num_b_rows_scatter_(_mm_set_epi32(num_B_rows * 3 * sizeof(float),
+                                          num_B_rows * 2 * sizeof(float),
+                                          num_B_rows * 1 * sizeof(float),
+                                          num_B_rows * 0 * sizeof(float))),
+#endif
+        num_B_rows_(num_B_rows) {
+  }
+
+  inline void Write(float *base, __m128i reduced) {
+    __m128 float_sums = _mm_cvtepi32_ps(reduced);
+    float_sums = _mm_mul_ps(float_sums, unquant_mult_sse_);
+#ifdef __AVX512VL__
+    // The scatter instruction requires avx512vl
+    _mm_i32scatter_ps(base, num_b_rows_scatter_, float_sums, (short)1);
+#else
+    FloatAccess a;
+    // Get floats for each of the sums to write.
+    a.as_n = float_sums;
+    // Also note that the memory acceses on C are not consecutive, but this is a
+    // tradeoff that we have to make. We can't have consecutive accesses of A,
+    // B, *and* C. But we access A and B a lot more so it makes sense to do it
+    // this way. Scatter to outputs:
+    base[0] = a.as_f[0];
+    base[num_B_rows_] = a.as_f[1];
+    base[2 * num_B_rows_] = a.as_f[2];
+    base[3 * num_B_rows_] = a.as_f[3];
+#endif
+  }
+
+  inline void Write(float *base, ReducedPair reduced) {
+    base[0] = unquant_mult_ * static_cast<float>(reduced.result[0]);
+    base[num_B_rows_] = unquant_mult_ * static_cast<float>(reduced.result[1]);
+  }
+
+  inline void Write(float *base, int32_t reduced) {
+    base[0] = unquant_mult_ * static_cast<float>(reduced);
+  }
+
+private:
+  const float unquant_mult_;
+  const __m128 unquant_mult_sse_;
+#ifdef __AVX512VL__
+  const __m128i num_b_rows_scatter_;
+#endif
+  const int num_B_rows_;
+};
+
+}  // namespace
+
+}  // namespace int16
+}  // namespace cpu
+}  // namespace marian
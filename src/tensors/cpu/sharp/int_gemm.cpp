@@ -1,4 +1,5 @@
 #include "int_gemm.h"
+#include "common/utils.h"
 #include "tensors/tensor_allocator.h"
 #include "tensors/tensor_operators.h"
 
@@ -6,14 +7,68 @@
 #include <immintrin.h>
 #include <tmmintrin.h>
 #include <xmmintrin.h>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
 
 namespace marian {
 namespace cpu {
 namespace int16 {
 
-#ifdef __AVX512F__
+// Kernels for each instruction set, in sse_gemm.cpp, avx2_gemm.cpp, avx_gemm.cpp and
+// vnni_gemm.cpp. These files are compiled with the flags of their instruction set only, see
+// src/CMakeLists.txt, and must not be called before checking the CPU.
+void SSE_Quantize16(const float* input,
+                    __m128i* output,
+                    float quant_mult,
+                    int num_rows,
+                    int width);
+
+void SSE_AddBias(float* C, const float* bias, int num_rows, int width);
+void AVX2_AddBias(float* C, const float* bias, int num_rows, int width);
+void AVX_AddBias(float* C, const float* bias, int num_rows, int width);
+
+void SSE_MatrixMult16(const __m128i* A,
+                      const __m128i* B,
+                      float* C,
+                      float unquant_mult,
+                      int num_A_rows,
+                      int num_B_rows,
+                      int width);
+
+void AVX2_Quantize16(const float* input,
+                     int16_t* output,
+                     float quant_mult,
+                     std::size_t size);
+
+void AVX2_Quantize8(const float* input,
+                    int8_t* output,
+                    float quant_mult,
+                    std::size_t size);
+
+void AVX2_MatrixMult16(const __m256i* A,
+                       const __m256i* B,
+                       float* C,
+                       float unquant_mult,
+                       int num_A_rows,
+                       int num_B_rows,
+                       int width);
+
+void AVX2_MatrixMult8(const __m256i* A,
+                      const __m256i* B,
+                      float* C,
+                      float unquant_mult,
+                      int num_A_rows,
+                      int num_B_rows,
+                      int width);
+
 void AVX_Quantize16(const float* input,
                     int16_t* output,
                     float quant_mult,
@@ -39,81 +94,210 @@ void AVX_MatrixMult8(const __m512i* A,
                      int num_A_rows,
                      int num_B_rows,
                      int width);
-#endif
 
-void SSE_Quantize16(const float* input,
-                    __m128i* output,
-                    float quant_mult,
-                    int num_rows,
-                    int width);
+#if COMPILE_VNNI
+void VNNI_MatrixMult16(const __m512i* A,
+                       const __m512i* B,
+                       float* C,
+                       float unquant_mult,
+                       int num_A_rows,
+                       int num_B_rows,
+                       int width);
 
-void SSE_MatrixMult16(const __m128i* A,
-                      const __m128i* B,
+void VNNI_MatrixMult8(const __m512i* A,
+                      const __m512i* B,
                       float* C,
                       float unquant_mult,
                       int num_A_rows,
                       int num_B_rows,
                       int width);
+#endif
+
+namespace {
+
+void cpuid(unsigned int leaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+  __cpuidex(reinterpret_cast<int*>(regs), (int)leaf, 0);
+#else
+  __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state that the operating system saves on context switches, see XCR0
+uint64_t xgetbv() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+Isa detectCpu() {
+  unsigned int regs[4]; // eax, ebx, ecx, edx
+  cpuid(0, regs);
+  unsigned int maxLeaf = regs[0];
+
+  cpuid(1, regs);
+  bool sse41   = (regs[2] & (1u << 19)) != 0;
+  bool osxsave = (regs[2] & (1u << 27)) != 0;
+  bool avx     = (regs[2] & (1u << 28)) != 0;
+
+  // The CPU may support AVX and AVX-512 while the operating system does not save their registers
+  uint64_t xcr0 = osxsave ? xgetbv() : 0;
+  bool ymmState = (xcr0 & 0x06) == 0x06;  // SSE and AVX state
+  bool zmmState = (xcr0 & 0xe6) == 0xe6;  // and opmask and upper ZMM state
+
+  bool avx2 = false, avx512f = false, avx512bw = false, avx512vl = false, avx512vnni = false;
+  if(maxLeaf >= 7) {
+    cpuid(7, regs);
+    avx2       = (regs[1] & (1u << 5)) != 0;
+    avx512f    = (regs[1] & (1u << 16)) != 0;
+    avx512bw   = (regs[1] & (1u << 30)) != 0;
+    avx512vl   = (regs[1] & (1u << 31)) != 0;
+    avx512vnni = (regs[2] & (1u << 11)) != 0;
+  }
+
+#if COMPILE_VNNI
+  const bool vnniKernels = true;
+#else
+  const bool vnniKernels = false; // the compiler does not support VNNI, see CMakeLists.txt
+#endif
+
+  if(zmmState && avx512f && avx512bw && avx512vl)
+    return avx512vnni && vnniKernels ? Isa::AVX512VNNI : Isa::AVX512BW;
+  if(ymmState && avx && avx2)
+    return Isa::AVX2;
+  ABORT_IF(!sse41, "The int16/int8 matrix products require a CPU with SSE4.1");
+  return Isa::SSE41;
+}
+
+std::atomic<Isa>& selectedIsa() {
+  static std::atomic<Isa> isa(detectIsa());
+  return isa;
+}
+
+// Kernels work on whole registers; matrices whose width does not fill them use an older
+// instruction set with narrower registers.
+Isa isaForWidth(int width, int avx512Multiple, int avx2Multiple) {
+  Isa isa = getIsa();
+  if(isa >= Isa::AVX512BW && width % avx512Multiple != 0)
+    isa = Isa::AVX2;
+  if(isa >= Isa::AVX2 && width % avx2Multiple != 0)
+    isa = Isa::SSE41;
+  return isa;
+}
+
+}  // namespace
+
+Isa detectIsa() {
+  static const Isa isa = detectCpu();
+  return isa;
+}
+
+Isa getIsa() {
+  return selectedIsa();
+}
+
+void setIsa(const std::string& name) {
+  Isa isa = detectIsa();
+  if(name != "auto") {
+    if     (name == "sse4.1")     isa = Isa::SSE41;
+    else if(name == "avx2")       isa = Isa::AVX2;
+    else if(name == "avx512bw")   isa = Isa::AVX512BW;
+    else if(name == "avx512vnni") isa = Isa::AVX512VNNI;
+    else ABORT("Unknown instruction set - '{}'", name);
+    ABORT_IF(isa > detectIsa(),
+             "{} kernels are not supported by this CPU or binary, the newest supported are {}",
+             name, isaName(detectIsa()));
+  }
+  selectedIsa() = isa;
+  LOG_ONCE(info, "[cpu] Using {} kernels for int16/int8 matrix products ({} detected)",
+           isaName(isa), isaName(detectIsa()));
+}
+
+std::string isaName(Isa isa) {
+  switch(isa) {
+    case Isa::SSE41:      return "sse4.1";
+    case Isa::AVX2:       return "avx2";
+    case Isa::AVX512BW:   return "avx512bw";
+    case Isa::AVX512VNNI: return "avx512vnni";
+  }
+  return "unknown";
+}
+
+std::string cpuBrand() {
+  unsigned int regs[4];
+  cpuid(0x80000000, regs);
+  if(regs[0] < 0x80000004)
+    return "unknown CPU";
+
+  char brand[49] = {0};
+  for(unsigned int i = 0; i < 3; ++i) {
+    cpuid(0x80000002 + i, regs);
+    std::memcpy(brand + 16 * i, regs, 16);
+  }
+  std::string name(brand);
+  utils::trim(name);
+  return name;
+}
 
 void Quantize16(marian::Tensor out,
                 const marian::Tensor in,
                 float /*clipValue*/) {
   float quant_mult = (float)pow(2.0, BITS);
-#ifdef __AVX512F__
-  AVX_Quantize16(
-      in->data(), out->data<int16_t>(), quant_mult, in->shape().elements());
-#else
   int num_rows = in->shape().elements() / in->shape()[-1];
   int width = in->shape()[-1];
-  SSE_Quantize16(in->data(), out->data<__m128i>(), quant_mult, num_rows, width);
-#endif
+  // All kernels produce the same layout, so that A and B may be quantized by different ones
+  switch(isaForWidth(width, 16, 1)) {
+    case Isa::AVX512VNNI:
+    case Isa::AVX512BW:
+      AVX_Quantize16(in->data(), out->data<int16_t>(), quant_mult, in->shape().elements());
+      break;
+    case Isa::AVX2:
+      AVX2_Quantize16(in->data(), out->data<int16_t>(), quant_mult, in->shape().elements());
+      break;
+    case Isa::SSE41:
+      ABORT_IF(width % 8 != 0, "SSE4.1 kernels require a width that is a multiple of 8, not {}", width);
+      SSE_Quantize16(in->data(), out->data<__m128i>(), quant_mult, num_rows, width);
+      break;
+  }
 }
 
 void Quantize8(marian::Tensor out,
                const marian::Tensor in,
                float clipValue) {
-#ifdef __AVX512F__
   float quant_mult = 127.0f / clipValue;
-  AVX_Quantize8(
-      in->data(), out->data<int8_t>(), quant_mult, in->shape().elements());
-#else
-  out; in; clipValue;
-  ABORT("8-bit is currently only AVX512");
-#endif
+  switch(isaForWidth(in->shape()[-1], 16, 1)) {
+    case Isa::AVX512VNNI:
+    case Isa::AVX512BW:
+      AVX_Quantize8(in->data(), out->data<int8_t>(), quant_mult, in->shape().elements());
+      break;
+    case Isa::AVX2:
+      AVX2_Quantize8(in->data(), out->data<int8_t>(), quant_mult, in->shape().elements());
+      break;
+    case Isa::SSE41:
+      ABORT("8-bit is only supported with AVX2 or newer");
+  }
 }
 
 // This operates on floats after processing so doesn't care about int8_t vs
 // int16_t.
 void AddBias(marian::Tensor C, const marian::Tensor Bias) {
-  float* y = C->data();
-  const float* x = C->data();
-  const float* bias = Bias->data();
-
-  const int m = C->shape().elements() / C->shape()[-1];
-  const int n = C->shape()[-1];
-
-  for(int j = 0; j < m; ++j) {
-    int i = 0;
-#ifdef __AVX512F__
-    int n16 = n & ~15;
-    for(; i < n16; i += 16) {
-      __m512 ai = _mm512_loadu_ps(x + j * n + i);
-      __m512 bi = _mm512_loadu_ps(bias + i);
-      __m512 yi = _mm512_add_ps(ai, bi);
-      _mm512_storeu_ps(y + j * n + i, yi);
-    }
-#else
-    int n4 = (n / 4) * 4;
-    for(; i < n4; i += 4) {
-      __m128 ai = _mm_loadu_ps(x + j * n + i);
-      __m128 bi = _mm_loadu_ps(bias + i);
-      __m128 yi = _mm_add_ps(ai, bi);
-      _mm_storeu_ps(y + j * n + i, yi);
-    }
-#endif
-    for(; i < n; i++) {
-      y[j * n + i] = x[j * n + i] + bias[i];
-    }
+  int num_rows = C->shape().elements() / C->shape()[-1];
+  int width = C->shape()[-1];
+  switch(getIsa()) {
+    case Isa::AVX512VNNI:
+    case Isa::AVX512BW:
+      AVX_AddBias(C->data(), Bias->data(), num_rows, width);
+      break;
+    case Isa::AVX2:
+      AVX2_AddBias(C->data(), Bias->data(), num_rows, width);
+      break;
+    case Isa::SSE41:
+      SSE_AddBias(C->data(), Bias->data(), num_rows, width);
+      break;
   }
 }
 
@@ -135,23 +319,23 @@ void ProdInt16(marian::Tensor C,
   int num_A_rows = A->shape().elements() / A->shape()[-1];
   int num_B_rows = B->shape().elements() / B->shape()[-1];
   int width = B->shape()[-1];
-#ifdef __AVX512F__
-  AVX_MatrixMult16(A->data<__m512i>(),
-                   B->data<__m512i>(),
-                   fC,
-                   unquant_mult,
-                   num_A_rows,
-                   num_B_rows,
-                   width);
-#else
-  SSE_MatrixMult16(A->data<__m128i>(),
-                   B->data<__m128i>(),
-                   fC,
-                   unquant_mult,
-                   num_A_rows,
-                   num_B_rows,
-                   width);
+  switch(isaForWidth(width, 32, 16)) {
+    case Isa::AVX512VNNI:
+#if COMPILE_VNNI
+      VNNI_MatrixMult16(A->data<__m512i>(), B->data<__m512i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
 #endif
+    case Isa::AVX512BW:
+      AVX_MatrixMult16(A->data<__m512i>(), B->data<__m512i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
+    case Isa::AVX2:
+      AVX2_MatrixMult16(A->data<__m256i>(), B->data<__m256i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
+    case Isa::SSE41:
+      ABORT_IF(width % 8 != 0, "SSE4.1 kernels require a width that is a multiple of 8, not {}", width);
+      SSE_MatrixMult16(A->data<__m128i>(), B->data<__m128i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
+  }
 }
 
 void ProdInt8(marian::Tensor C,
@@ -159,7 +343,6 @@ void ProdInt8(marian::Tensor C,
               const marian::Tensor B,
               float scale,
               float clipValue) {
-#ifdef __AVX512F__
   // This would be easy...
   ABORT_IF(scale != 1, "Scale other than 1 not supported");
   float quant_mult = 127.0f / clipValue;
@@ -169,17 +352,21 @@ void ProdInt8(marian::Tensor C,
   int num_A_rows = A->shape().elements() / A->shape()[-1];
   int num_B_rows = B->shape().elements() / B->shape()[-1];
   int width = B->shape()[-1];
-  AVX_MatrixMult8(A->data<__m512i>(),
-                  B->data<__m512i>(),
-                  fC,
-                  unquant_mult,
-                  num_A_rows,
-                  num_B_rows,
-                  width);
-#else
-  C; A; B; scale; clipValue;
-  ABORT("8-bit is currently only AVX512");
+  switch(isaForWidth(width, 64, 32)) {
+    case Isa::AVX512VNNI:
+#if COMPILE_VNNI
+      VNNI_MatrixMult8(A->data<__m512i>(), B->data<__m512i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
 #endif
+    case Isa::AVX512BW:
+      AVX_MatrixMult8(A->data<__m512i>(), B->data<__m512i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
+    case Isa::AVX2:
+      AVX2_MatrixMult8(A->data<__m256i>(), B->data<__m256i>(), fC, unquant_mult, num_A_rows, num_B_rows, width);
+      break;
+    case Isa::SSE41:
+      ABORT("8-bit is only supported with AVX2 or newer and a width that is a multiple of 32, not {}", width);
+  }
 }
 
 }  // namespace int16
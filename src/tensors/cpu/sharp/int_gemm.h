@@ -2,12 +2,30 @@
 
 #include "tensors/tensor.h"
 
+#include <string>
+
 namespace marian {
 namespace cpu {
 namespace int16 {
 
 const int BITS = 10;
 
+// Instruction sets with kernels for the functions below, from oldest to newest. The kernels are
+// compiled for each of them and chosen at runtime, by default the newest one this CPU supports.
+enum class Isa { SSE41, AVX2, AVX512BW, AVX512VNNI };
+
+// Newest instruction set that is supported by this CPU and has kernels in this binary
+Isa detectIsa();
+// Instruction set of the kernels in use
+Isa getIsa();
+// Selects the kernels: auto, sse4.1, avx2, avx512bw or avx512vnni. Aborts if the CPU does not
+// support them.
+void setIsa(const std::string& isaName);
+std::string isaName(Isa isa);
+
+// Brand string of the CPU, e.g. "Intel(R) Xeon(R) Platinum 8180 CPU @ 2.50GHz"
+std::string cpuBrand();
+
 void Quantize16(marian::Tensor out,
                 const marian::Tensor in,
                 float /*clipValue*/);
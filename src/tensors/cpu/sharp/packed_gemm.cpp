@@ -6,9 +6,13 @@
 #include <immintrin.h>
 #include <tmmintrin.h>
 #include <xmmintrin.h>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 //#include <chrono>
 
 #ifdef _MSC_VER
@@ -36,6 +40,20 @@ namespace marian {
 namespace cpu {
 namespace variant { // Variants of GEMM implementations
 
+PackFp32Info PackFp32Layout(const int nrow, const int ncol) {
+  PackFp32Info info;
+  info.kernel_ncol_blocks = 2;
+  info.brow = 512;
+  info.bcol = 8 * info.kernel_ncol_blocks;
+  info.last_brow = nrow % info.brow == 0 ? info.brow : nrow % info.brow;
+  info.nbrow = nrow % info.brow == 0 ? nrow / info.brow : (nrow + info.brow) / info.brow;
+  info.nbcol = ncol % info.bcol == 0 ? ncol / info.bcol : (ncol + info.bcol) / info.bcol;
+  const int padding = 1024;  // required by sw pipelined kernels
+  const int specialMem = 256;
+  info.packsize = ((info.nbrow * info.brow) * (info.nbcol * info.bcol)) * sizeof(uint16_t) /* fp16 */ + padding + specialMem;
+  return info;
+}
+
 #if USE_FBGEMM
 // initialize with a dummy
 // When this class is instantiated,
@@ -206,6 +224,205 @@ void GemmPackFp32(marian::Tensor C,
   // return back the original mem
   packedPlaceholder.pmat_ = pmat;
 }
+// Layout of a packed int8 matrix: a header of PACK_INT8_HEADER bytes with the size of the packed
+// matrix, its shape, whether the source was transposed and the blocking it was packed for, then
+// the matrix in FBGEMM's blocked format, and then the quantization scale (float) and the sum of
+// the quantized values (int32) of each column.
+static const uint64_t PACK_INT8_HEADER = 256;
+
+// FBGEMM chooses the block sizes of a packed int8 matrix, and therefore its layout and size, for
+// the instruction set of the CPU that packs it
+enum class PackInt8Blocking : int32_t { avx2 = 2, avx512 = 3 };
+
+static PackInt8Blocking packInt8Blocking() {
+  return fbgemmHasAvx512Support() ? PackInt8Blocking::avx512 : PackInt8Blocking::avx2;
+}
+
+static const char* blockingName(int32_t blocking) {
+  switch((PackInt8Blocking)blocking) {
+    case PackInt8Blocking::avx2: return "AVX2";
+    case PackInt8Blocking::avx512: return "AVX-512";
+    default: return "unknown";
+  }
+}
+
+// Weights are quantized symmetrically to 7 bits, so that the sums of two u8 x s8 products in
+// FBGEMM's AVX2 kernels (VPMADDUBSW) cannot overflow their 16-bit intermediates.
+static const int INT8_WEIGHT_MAX = 63;
+
+static uint64_t packedInt8BufferSize(const int nrow, const int ncol) {
+  return (uint64_t)PackMatrix<PackBMatrix<int8_t>, int8_t>::packedBufferSize(nrow, ncol);
+}
+
+uint64_t PackInt8Size(const int nrow, const int ncol) {
+  return PACK_INT8_HEADER + packedInt8BufferSize(nrow, ncol) + ncol * (sizeof(float) + sizeof(int32_t));
+}
+
+void PackInt8(marian::Tensor out,
+              const marian::Tensor in,
+              const bool transpose,
+              const int nrow,
+              const int ncol) {
+  uint8_t* outmem = out->data<uint8_t>();
+  std::fill(outmem, outmem + PACK_INT8_HEADER, (uint8_t)0);
+  uint64_t packsize = PackInt8Size(nrow, ncol);
+  memcpy(outmem, &packsize, sizeof(packsize));
+  int32_t header[4] = {nrow, ncol, transpose, (int32_t)packInt8Blocking()};
+  memcpy(outmem + sizeof(packsize), header, sizeof(header));
+
+  int8_t* packedmem = (int8_t*)(outmem + PACK_INT8_HEADER);
+  float* scales = (float*)(outmem + PACK_INT8_HEADER + packedInt8BufferSize(nrow, ncol));
+  int32_t* colSums = (int32_t*)(scales + ncol);
+
+  // quantize each column (output channel) with its own scale, keeping the layout of the input
+  const float* inmem = in->data();
+  std::vector<int8_t> quantized((size_t)nrow * ncol);
+  for(int j = 0; j < ncol; j++) {
+    float maxAbs = 0.f;
+    for(int i = 0; i < nrow; i++)
+      maxAbs = std::max(maxAbs, std::abs(!transpose ? inmem[i * ncol + j] : inmem[i + nrow * j]));
+    float scale = maxAbs > 0.f ? maxAbs / INT8_WEIGHT_MAX : 1.f;
+
+    int32_t sum = 0;
+    for(int i = 0; i < nrow; i++) {
+      size_t idx = !transpose ? i * ncol + j : i + nrow * j;
+      int q = (int)std::nearbyint(inmem[idx] / scale);
+      quantized[idx] = (int8_t)std::max(-INT8_WEIGHT_MAX, std::min(INT8_WEIGHT_MAX, q));
+      sum += quantized[idx];
+    }
+    scales[j] = scale;
+    colSums[j] = sum;
+  }
+
+  // pack into the memory of the tensor
+  PackBMatrix<int8_t> packedB(transpose ? matrix_op_t::Transpose : matrix_op_t::NoTranspose,
+                              nrow,
+                              ncol,
+                              quantized.data(),
+                              transpose ? nrow : ncol,
+                              packedmem,
+                              /*groups=*/1);
+}
+
+void CheckPackInt8(const uint8_t* packed) {
+  int32_t header[4];
+  memcpy(header, packed + sizeof(uint64_t), sizeof(header));
+  ABORT_IF(header[3] != (int32_t)packInt8Blocking(),
+           "Int8 matrix was packed for {} and cannot be used on this {} CPU; "
+           "convert the model with marian-conv on a CPU of the same kind",
+           blockingName(header[3]),
+           blockingName((int32_t)packInt8Blocking()));
+}
+
+// FBGEMM packs B when a PackBMatrix is constructed and cannot wrap memory that is already packed.
+// Like packedPlaceholder for fp16, a view is built once per shape and thread (packing zeros into
+// the buffer that FBGEMM allocates for it) and is pointed at the packed memory of a weight before
+// each GEMM. The blocked layout only depends on the shape, so the metadata of the view applies.
+class PackedInt8View : public PackBMatrix<int8_t> {
+private:
+  int8_t* ownBuffer_; // allocated by FBGEMM, freed by ~PackMatrix()
+
+public:
+  PackedInt8View(matrix_op_t trans, int32_t nrow, int32_t ncol, const int8_t* zeros)
+      : PackBMatrix<int8_t>(trans, nrow, ncol, zeros, trans == matrix_op_t::Transpose ? nrow : ncol),
+        ownBuffer_(buf_) {}
+
+  ~PackedInt8View() { buf_ = ownBuffer_; }
+
+  void wrap(int8_t* packedmem) { buf_ = packedmem; }
+};
+
+static PackBMatrix<int8_t>& packedInt8View(int8_t* packedmem, const bool transpose, const int nrow, const int ncol) {
+  static thread_local std::unordered_map<uint64_t, std::unique_ptr<PackedInt8View>> views;
+  uint64_t key = ((uint64_t)nrow << 32) | ((uint64_t)ncol << 1) | (uint64_t)transpose;
+  auto& view = views[key];
+  if(!view) {
+    std::vector<int8_t> zeros((size_t)nrow * ncol, 0);
+    view.reset(new PackedInt8View(transpose ? matrix_op_t::Transpose : matrix_op_t::NoTranspose, nrow, ncol, zeros.data()));
+  }
+  view->wrap(packedmem);
+  return *view;
+}
+
+void GemmPackInt8(marian::Tensor C,
+                  const marian::Tensor A,
+                  const marian::Tensor B,
+                  const marian::Tensor bias,
+                  const size_t m,
+                  const size_t n,
+                  const size_t k,
+                  const int transA) {
+  // retrieve the packed matrix and its quantization parameters
+  uint8_t* bmem = B->data<uint8_t>();
+  int32_t header[4];
+  memcpy(header, bmem + sizeof(uint64_t), sizeof(header));
+  ABORT_IF(header[0] != (int32_t)k || header[1] != (int32_t)n,
+           "Packed int8 matrix has shape {}x{}, expected {}x{}", header[0], header[1], k, n);
+  CheckPackInt8(bmem);
+  bool transB = header[2] != 0;
+  int8_t* packedmem = (int8_t*)(bmem + PACK_INT8_HEADER);
+  const float* bScales = (const float*)(bmem + PACK_INT8_HEADER + packedInt8BufferSize((int)k, (int)n));
+  const int32_t* bColSums = (const int32_t*)(bScales + n);
+
+  // quantize each row of A to uint8 with its own scale and zero point; the range of a row
+  // always includes 0, so that the zero point lies in [0, 255]
+  const float* amem = A->data();
+  std::vector<uint8_t> aQuantized(m * k);
+  std::vector<float> aScales(m);
+  std::vector<int32_t> aZeroPoints(m);
+  for(size_t i = 0; i < m; i++) {
+    auto a = [&](size_t j) { return !transA ? amem[i * k + j] : amem[i + m * j]; };
+    float lo = 0.f, hi = 0.f;
+    for(size_t j = 0; j < k; j++) {
+      lo = std::min(lo, a(j));
+      hi = std::max(hi, a(j));
+    }
+    float scale = hi > lo ? (hi - lo) / 255.f : 1.f;
+    int32_t zeroPoint = (int32_t)std::nearbyint(-lo / scale);
+    for(size_t j = 0; j < k; j++) {
+      int q = (int)std::nearbyint(a(j) / scale) + zeroPoint;
+      aQuantized[i * k + j] = (uint8_t)std::max(0, std::min(255, q));
+    }
+    aScales[i] = scale;
+    aZeroPoints[i] = zeroPoint;
+  }
+
+  // B is already packed, this only wraps the memory
+  auto& packedB = packedInt8View(packedmem, transB, (int)k, (int)n);
+
+  // int32 products of the quantized matrices
+  std::vector<int32_t> Cint(m * n);
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+#ifdef _OPENMP
+    int num_threads = omp_get_num_threads();
+    int tid = omp_get_thread_num();
+#else
+    int num_threads = 1;
+    int tid = 0;
+#endif
+    PackAMatrix<uint8_t> packedA(matrix_op_t::NoTranspose,
+                                 (int32_t)m,
+                                 (int32_t)k,
+                                 aQuantized.data(),
+                                 (int32_t)k,
+                                 /*pmat=*/nullptr,
+                                 /*groups=*/1);
+    DoNothing<int32_t, int32_t> doNothing{};
+    memCopy<> outputProcess(doNothing);
+    fbgemmPacked(packedA, packedB, Cint.data(), Cint.data(), (int32_t)n, outputProcess, tid, num_threads);
+  }
+
+  // dequantize: sum_j (qa_ij - za_i) * sa_i * qb_jl * sb_l = sa_i * sb_l * (sum_j qa_ij * qb_jl - za_i * sum_j qb_jl)
+  float* cmem = C->data();
+  const float* biasmem = bias->data();
+  for(size_t i = 0; i < m; i++)
+    for(size_t l = 0; l < n; l++)
+      cmem[i * n + l] = aScales[i] * bScales[l] * (Cint[i * n + l] - aZeroPoints[i] * bColSums[l]) + biasmem[l];
+}
 #else // USE_FBGEMM
 void PackFp32(marian::Tensor out,
               const marian::Tensor in,
@@ -232,6 +449,29 @@ void GemmPackFp32(marian::Tensor C,
                 // does nothing. supports only FBGEMM based packed gemm at this moment.
                 ABORT("FBGEMM is needed to use packed GEMM.");
 }
+uint64_t PackInt8Size(const int nrow, const int ncol) {
+  ABORT("FBGEMM is needed to use packed GEMM.");
+}
+void PackInt8(marian::Tensor out,
+              const marian::Tensor in,
+              const bool transpose,
+              const int nrow,
+              const int ncol) {
+  ABORT("FBGEMM is needed to use packed GEMM.");
+}
+void CheckPackInt8(const uint8_t* packed) {
+  ABORT("FBGEMM is needed to use packed GEMM.");
+}
+void GemmPackInt8(marian::Tensor C,
+                  const marian::Tensor A,
+                  const marian::Tensor B,
+                  const marian::Tensor bias,
+                  const size_t m,
+                  const size_t n,
+                  const size_t k,
+                  const int transA) {
+  ABORT("FBGEMM is needed to use packed GEMM.");
+}
 #endif // USE_FBGEMM
 
 }  // namespace variant
@@ -6,6 +6,22 @@ namespace marian {
 namespace cpu {
 namespace variant { // Variants of GEMM implementations
 
+// Blocking parameters of a packed fp16 matrix, see PackFp32
+struct PackFp32Info {
+  int kernel_ncol_blocks;
+  int brow;
+  int bcol;
+  int last_brow;
+  int nbrow;
+  int nbcol;
+  uint64_t packsize;
+};
+
+// Blocking parameters and size in bytes of a packed fp16 matrix
+// nrow: the number of rows
+// ncol: the number of columns
+PackFp32Info PackFp32Layout(const int nrow, const int ncol);
+
 // Pack a matrix into cache utilization efficient way (block format)
 // out: output tensor - packed format
 // in: input tensor - normal format
@@ -49,6 +65,49 @@ void GemmPackFp32(marian::Tensor C,
                   const size_t n,
                   const int transA = 0);
 
+// Size in bytes of a packed int8 matrix
+// nrow: the number of rows
+// ncol: the number of columns
+// The packed matrix holds a header (256 bytes), the matrix in FBGEMM's blocked int8 format, and
+// the quantization scale and column sum of each column.
+uint64_t PackInt8Size(const int nrow, const int ncol);
+
+// Quantize a matrix to int8 with one scale per column (output channel) and pack it for FBGEMM
+// out: output tensor - packed format
+// in: input tensor - normal format
+// transpose: the matrix is transposed
+// nrow: the number of rows
+// ncol: the number of columns
+void PackInt8(marian::Tensor out,
+              const marian::Tensor in,
+              const bool transpose,
+              const int nrow,
+              const int ncol);
+
+// Aborts if a matrix packed by PackInt8 was packed for other FBGEMM blocking parameters (AVX2 or
+// AVX-512) than those of this CPU, e.g. by marian-conv on another machine
+// packed: the packed matrix
+void CheckPackInt8(const uint8_t* packed);
+
+// int8 GEMM operation on the packed B matrix. Rows of A are quantized on the fly with one scale
+// and zero point per row.
+// C: output matrix
+// A: A matrix
+// B: B matrix (packed by PackInt8)
+// bias: bias, added to each row of C
+// m: the number of rows in A and C
+// n: the number of columns in B and C
+// k: the number of columns in A and rows in B
+// transA: transpose of A matrix
+void GemmPackInt8(marian::Tensor C,
+                  const marian::Tensor A,
+                  const marian::Tensor B,
+                  const marian::Tensor bias,
+                  const size_t m,
+                  const size_t n,
+                  const size_t k,
+                  const int transA = 0);
+
 }  // namespace variant
 }  // namespace cpu
 }  // namespace marian
@@ -336,6 +336,19 @@ void SSE_MatrixMult16(const __m128i* qA,
   }
 }
 
+// C += bias for each row of C
+void SSE_AddBias(float* C, const float* bias, int num_rows, int width) {
+  int vecWidth = width & ~3;
+  for(int j = 0; j < num_rows; ++j) {
+    float* row = C + (size_t)j * width;
+    int i = 0;
+    for(; i < vecWidth; i += 4)
+      _mm_storeu_ps(row + i, _mm_add_ps(_mm_loadu_ps(row + i), _mm_loadu_ps(bias + i)));
+    for(; i < width; ++i)
+      row[i] += bias[i];
+  }
+}
+
 }  // namespace int16
 }  // namespace cpu
 }  // namespace marian
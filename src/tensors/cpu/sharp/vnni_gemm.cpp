@@ -0,0 +1,139 @@
+#include <immintrin.h>
+#include <stdint.h>
+#include <cassert>
+#include <cstddef>
+
+// AVX-512 VNNI versions of AVX_MatrixMult16() and AVX_MatrixMult8(). The quantization is the same
+// as for AVX-512BW, only the multiply-accumulate differs: vpdpwssd and vpdpbusd multiply, add
+// pairs or quadruples and accumulate into 32 bits in one instruction. This file is compiled with
+// -mavx512vnni only if the compiler supports it, and called after checking the CPU at runtime,
+// see int_gemm.cpp.
+
+#if COMPILE_VNNI
+
+#include "avx512_helpers.h"
+
+namespace marian {
+namespace cpu {
+namespace int16 {
+
+namespace {
+
+// Writes the unquantized sums of Rows rows of A with one row of B, see ScatterPut
+template <int Rows>
+inline void Write(ScatterPut &put, float *C, const __m512i (&sums)[Rows], int num_B_rows) {
+  int r = 0;
+  for(; r + 4 <= Rows; r += 4)
+    put.Write(C + r * num_B_rows, Reduce32(sums[r], sums[r + 1], sums[r + 2], sums[r + 3]));
+  for(; r < Rows; ++r)
+    put.Write(C + r * num_B_rows, Reduce32(sums[r]));
+}
+
+template <int Rows>
+void MatrixMult16Rows(ScatterPut &put,
+                      const __m512i *A_rows,
+                      const __m512i *B,
+                      float *C,
+                      int num_B_rows,
+                      int sse_width) {
+  for(int j = 0; j < num_B_rows; j++) {
+    const __m512i *B_row = B + j * sse_width;
+    __m512i sums[Rows];
+    for(int r = 0; r < Rows; ++r)
+      sums[r] = _mm512_setzero_si512();
+    for(int k = 0; k < sse_width; k++) {
+      __m512i b = *(B_row + k);
+      for(int r = 0; r < Rows; ++r)
+        sums[r] = _mm512_dpwssd_epi32(sums[r], b, *(A_rows + r * sse_width + k));
+    }
+    Write<Rows>(put, C + j, sums, num_B_rows);
+  }
+}
+
+// vpdpbusd multiplies unsigned with signed bytes, so the sign of b is moved to a as in Accum() of
+// avx_gemm.cpp. Unlike there, the sums are accumulated in 32 bits and do not saturate.
+template <int Rows>
+void MatrixMult8Rows(ScatterPut &put,
+                     const __m512i *A_rows,
+                     const __m512i *B,
+                     float *C,
+                     int num_B_rows,
+                     int sse_width) {
+  const __m512i zeros = _mm512_setzero_si512();
+  for(int j = 0; j < num_B_rows; j++) {
+    const __m512i *B_row = B + j * sse_width;
+    __m512i sums[Rows];
+    for(int r = 0; r < Rows; ++r)
+      sums[r] = _mm512_setzero_si512();
+    for(int k = 0; k < sse_width; k++) {
+      __m512i b = *(B_row + k);
+      __m512i b_positive = _mm512_abs_epi8(b);
+      __mmask64 neg_mask = _mm512_test_epi8_mask(b, _mm512_set1_epi8(-128));
+      for(int r = 0; r < Rows; ++r) {
+        __m512i a = _mm512_mask_sub_epi8(*(A_rows + r * sse_width + k), neg_mask, zeros, *(A_rows + r * sse_width + k));
+        sums[r] = _mm512_dpbusd_epi32(sums[r], b_positive, a);
+      }
+    }
+    Write<Rows>(put, C + j, sums, num_B_rows);
+  }
+}
+
+}  // namespace
+
+// Same requirements as AVX_MatrixMult16()
+void VNNI_MatrixMult16(const __m512i *A,
+                       const __m512i *B,
+                       float *C,
+                       float unquant_mult,
+                       int num_A_rows,
+                       int num_B_rows,
+                       int width) {
+  assert(width % 32 == 0);
+  assert(reinterpret_cast<uintptr_t>(A) % 64 == 0);
+  assert(reinterpret_cast<uintptr_t>(B) % 64 == 0);
+  ScatterPut put(unquant_mult, num_B_rows);
+
+  const int sse_width = width / 32;
+  int i = 0;
+  for(; i + 4 <= num_A_rows; i += 4)
+    MatrixMult16Rows<4>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width);
+  switch(num_A_rows - i) {
+    case 3: MatrixMult16Rows<3>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 2: MatrixMult16Rows<2>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 1: MatrixMult16Rows<1>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+  }
+}
+
+// Same requirements as AVX_MatrixMult8(), width must be a multiple of 64
+void VNNI_MatrixMult8(const __m512i *A,
+                      const __m512i *B,
+                      float *C,
+                      float unquant_mult,
+                      int num_A_rows,
+                      int num_B_rows,
+                      int width) {
+  assert(width % 64 == 0);
+  assert(reinterpret_cast<uintptr_t>(A) % 64 == 0);
+  assert(reinterpret_cast<uintptr_t>(B) % 64 == 0);
+  ScatterPut put(unquant_mult, num_B_rows);
+
+  const int sse_width = width / 64;
+  int i = 0;
+  for(; i + 8 <= num_A_rows; i += 8)
+    MatrixMult8Rows<8>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width);
+  switch(num_A_rows - i) {
+    case 7: MatrixMult8Rows<7>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 6: MatrixMult8Rows<6>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 5: MatrixMult8Rows<5>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 4: MatrixMult8Rows<4>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 3: MatrixMult8Rows<3>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 2: MatrixMult8Rows<2>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+    case 1: MatrixMult8Rows<1>(put, A + i * sse_width, B, C + i * num_B_rows, num_B_rows, sse_width); break;
+  }
+}
+
+}  // namespace int16
+}  // namespace cpu
+}  // namespace marian
+
+#endif  // COMPILE_VNNI
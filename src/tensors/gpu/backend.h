@@ -51,6 +51,9 @@ public:
     LOG_ONCE(info, "getGemmType() not supported for GPU");
     return GemmType::Auto;
   }
+  void setGemmIsa(std::string isa) override {
+    LOG_ONCE(info, "setGemmIsa() not supported for GPU_{}", isa);
+  }
 
 private:
   cublasHandle_t cublasHandle_;
@@ -63,13 +63,12 @@ public:
   void clear() { allocator_->clear(); }
 
   size_t capacity(Shape shape, Type type = Type::float32) {
-    return allocator_->capacity(shape.elements(), type);
+    return allocator_->capacity(requiredBytes(shape, type), Type::uint8);
   }
 
   void allocate(Tensor& t, Shape shape, Type type = Type::float32) {
     if(!t || t->shape() != shape) {
-      int size = shape.elements();
-      auto mem = allocator_->alloc(size, type);
+      auto mem = allocator_->alloc(requiredBytes(shape, type));
       t = Tensor(new TensorBase(mem, shape, type, backend_));
     }
   }
@@ -1,6 +1,12 @@
 #include "catch.hpp"
+#include "3rd_party/yaml-cpp/yaml.h"
 #include "graph/expression_graph.h"
 #include "graph/expression_operators.h"
+#include "graph/profiler.h"
+
+#include <cstdio>
+#include <map>
+#include <thread>
 
 using namespace marian;
 
@@ -105,3 +111,288 @@ TEST_CASE("Expression graph can be initialized with constant values (cpu)",
     REQUIRE(values == v);
   }
 }
+
+#ifdef BLAS_FOUND
+TEST_CASE("Recorded steps replay correctly with planned memory (cpu)", "[graph]") {
+  std::vector<float> w1(8 * 16), b1(16), w2(16 * 8);
+  for(size_t i = 0; i < w1.size(); ++i)
+    w1[i] = 0.05f * (float)((i * 7) % 11) - 0.25f;
+  for(size_t i = 0; i < b1.size(); ++i)
+    b1[i] = 0.1f * (float)(i % 5) - 0.2f;
+  for(size_t i = 0; i < w2.size(); ++i)
+    w2[i] = 0.04f * (float)((i * 5) % 13) - 0.24f;
+
+  auto inputs = [](float scale) {
+    std::vector<float> x(4 * 8);
+    for(size_t i = 0; i < x.size(); ++i)
+      x[i] = scale * ((float)((i * 3) % 17) / 8.f - 1.f);
+    return x;
+  };
+
+  // intermediate values of several sizes, including views of them
+  auto build = [&](Ptr<ExpressionGraph> graph, const std::vector<float>& xs) {
+    auto x = graph->constant({4, 8}, inits::from_vector(xs));
+    x->set_name("x");
+    auto W1 = graph->param("W1", {8, 16}, inits::from_vector(w1));
+    auto B1 = graph->param("b1", {1, 16}, inits::from_vector(b1));
+    auto W2 = graph->param("W2", {16, 8}, inits::from_vector(w2));
+    auto h1 = tanh(dot(x, W1));
+    auto h2 = relu(h1 + B1);
+    auto h3 = reshape(h2, {8, 8});
+    auto h4 = sigmoid(h3) * h3;
+    auto h5 = dot(reshape(h4, {4, 16}), W2);
+    return h5 + x * exp(x);
+  };
+
+  auto newGraph = []() {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setInference(true);
+    graph->reserveWorkspaceMB(4);
+    return graph;
+  };
+
+  auto graph = newGraph();
+  graph->startTrace();
+  auto out = build(graph, inputs(1.f));
+  graph->forward();
+  auto trace = graph->stopTrace();
+  auto plan = trace->planMemory(graph->allocator());
+
+  CHECK(plan->numPlanned() > 0);
+  CHECK(plan->arenaBytes() <= plan->plannedBytes());
+
+  SECTION("slots with overlapping lifetimes do not overlap in the arena") {
+    const auto& slots = plan->slots();
+    for(size_t i = 0; i < slots.size(); ++i) {
+      CHECK(slots[i].first <= slots[i].last);
+      CHECK(slots[i].offset + slots[i].bytes <= plan->arenaBytes());
+      for(size_t j = i + 1; j < slots.size(); ++j) {
+        if(slots[i].last < slots[j].first || slots[j].last < slots[i].first)
+          continue;
+        CHECK((slots[i].offset + slots[i].bytes <= slots[j].offset
+               || slots[j].offset + slots[j].bytes <= slots[i].offset));
+      }
+    }
+  }
+
+  SECTION("replays match unplanned runs") {
+    for(float scale : {0.5f, -2.f, 1.5f}) {
+      trace->setInput("x", inputs(scale));
+      graph->replay(trace);
+      std::vector<float> replayed;
+      out->val()->get(replayed);
+
+      auto unplanned = newGraph();
+      auto expected = build(unplanned, inputs(scale));
+      unplanned->forward();
+      std::vector<float> values;
+      expected->val()->get(values);
+
+      REQUIRE(replayed.size() == values.size());
+      for(size_t i = 0; i < values.size(); ++i)
+        CHECK(replayed[i] == Approx(values[i]).epsilon(1e-5).margin(1e-6));
+    }
+  }
+}
+#endif
+
+TEST_CASE("Intermediate values are freed after their last use during inference (cpu)", "[graph]") {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  const int rows = 64, cols = 256, depth = 20;
+  const size_t bytes = graph->allocator()->capacity(rows * cols, Type::float32);
+
+  // a chain of intermediates, each of which is only read by the next one
+  auto x = graph->constant({rows, cols}, inits::from_value(1.f));
+  auto y = x;
+  for(int i = 0; i < depth; ++i)
+    y = y + x;
+
+  graph->allocator()->resetPeakBytes();
+  graph->forward();
+
+  // x, the last intermediate and the one that is computed from it, not all of them
+  CHECK(graph->allocator()->peakBytes() <= 3 * bytes);
+  CHECK(graph->allocator()->allocatedBytes() == 2 * bytes);
+
+  std::vector<float> values;
+  y->val()->get(values);
+  CHECK(values.front() == depth + 1);
+  CHECK(values.back() == depth + 1);
+}
+
+TEST_CASE("Allocator views follow reallocations and are not freed (cpu)", "[graph]") {
+  auto allocator = New<Allocator>(DeviceId{0, DeviceType::cpu}, 1024, 1024);
+
+  auto piece = allocator->alloc(512);
+  auto view = allocator->view(piece, 256, 256);
+  CHECK(view->data() == piece->data() + 256);
+  for(size_t i = 0; i < view->size(); ++i)
+    view->data()[i] = (uint8_t)i;
+
+  // more than is left, so the allocator grows and moves its memory
+  auto other = allocator->alloc(4096);
+  REQUIRE(allocator->size() > 1024);
+  CHECK(view->data() == piece->data() + 256);
+  for(size_t i = 0; i < view->size(); ++i)
+    CHECK(view->data()[i] == (uint8_t)i);
+
+  CHECK_FALSE(allocator->free(view));
+  CHECK(allocator->owns(piece));
+  CHECK(view->data() == piece->data() + 256);
+
+  CHECK(allocator->free(piece));
+  CHECK(allocator->free(other));
+}
+
+TEST_CASE("Node memory is pooled per graph (cpu)", "[graph]") {
+  auto newGraph = [](bool shorttermMemoization) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setInference(true);
+    graph->setShorttermMemoization(shorttermMemoization);
+    graph->reserveWorkspaceMB(4);
+    return graph;
+  };
+
+  // a step builds some nodes twice, which short-term memoization would merge
+  auto step = [&](Ptr<ExpressionGraph> graph, int t) {
+    std::vector<float> xs(2 * 6);
+    for(size_t i = 0; i < xs.size(); ++i)
+      xs[i] = 0.25f * (float)(((i + t) * 5) % 7) - 0.75f;
+    auto x = graph->constant({2, 6}, inits::from_vector(xs));
+    auto h = x;
+    for(int i = 0; i <= t % 3; ++i)
+      h = tanh(h) + sigmoid(h) * h;
+    return h * (1.f + (float)t) + tanh(x);
+  };
+
+  auto run = [](Ptr<ExpressionGraph> graph, Expr out) {
+    graph->forward();
+    std::vector<float> values;
+    out->val()->get(values);
+    return values;
+  };
+
+  SECTION("results do not depend on short-term memoization") {
+    auto memoizing = newGraph(true);
+    auto plain = newGraph(false);
+    for(int t = 0; t < 6; ++t) {
+      auto expected = run(memoizing, step(memoizing, t));
+      auto values = run(plain, step(plain, t));
+      REQUIRE(values.size() == expected.size());
+      for(size_t i = 0; i < values.size(); ++i)
+        CHECK(values[i] == Approx(expected[i]));
+      memoizing->clear();
+      plain->clear();
+    }
+  }
+
+  SECTION("identical nodes are only merged with short-term memoization") {
+    auto memoizing = newGraph(true);
+    auto x = memoizing->constant({2, 6}, inits::ones);
+    CHECK(tanh(x) == tanh(x));
+
+    auto plain = newGraph(false);
+    auto y = plain->constant({2, 6}, inits::ones);
+    CHECK(tanh(y) != tanh(y));
+    CHECK(plain->param("W", {6, 6}, inits::zeros) == plain->param("W", {6, 6}, inits::zeros));
+  }
+
+  SECTION("nodes and their pool outlive the graph") {
+    auto graph = newGraph(false);
+    Expr kept;
+    for(int t = 0; t < 4; ++t) {
+      kept = step(graph, t);
+      run(graph, kept);
+      graph->clear();
+    }
+    Weak<NodePool> pool = graph->nodePool();
+    graph = nullptr;
+
+    CHECK_FALSE(pool.expired());
+    CHECK(kept->shape() == Shape({2, 6}));
+    CHECK(kept->graph() == nullptr);
+    kept = nullptr;
+    CHECK(pool.expired());
+  }
+
+  SECTION("nodes can be destroyed on another thread") {
+    auto graph = newGraph(false);
+    auto reference = newGraph(false);
+    for(int t = 0; t < 6; ++t) {
+      std::vector<Expr> nodes;
+      for(int i = 0; i < 200; ++i)
+        nodes.push_back(tanh(graph->constant({2, 6}, inits::ones)));
+      graph->clear();
+
+      std::thread destroy([&nodes]() { nodes.clear(); });
+      auto values = run(graph, step(graph, t));
+      destroy.join();
+
+      auto expected = run(reference, step(reference, t));
+      REQUIRE(values.size() == expected.size());
+      for(size_t i = 0; i < values.size(); ++i)
+        CHECK(values[i] == Approx(expected[i]));
+      graph->clear();
+      reference->clear();
+    }
+  }
+}
+
+#ifdef BLAS_FOUND
+TEST_CASE("Profiled graphs write a valid Chrome trace (cpu)", "[graph]") {
+  const std::string tracePath = "graph_tests.trace.json";
+  auto options = New<Options>();
+  options->set("profile", tracePath);
+  options->set("profile-events", (size_t)1000);
+  auto profiler = New<GraphProfiler>();
+  profiler->start(options);
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+  graph->setProfiler(profiler);
+
+  // a node name that has to be escaped in JSON
+  const std::string name = "a \"quoted\" name\\with\tcontrol\x01 characters";
+  auto x = graph->constant({4, 8}, inits::from_value(1.f));
+  auto y = exp(x);
+  y->set_name(name);
+  auto z = sum(y * x, -1);
+  graph->forward();
+  profiler->finish();
+
+  // JSON is valid YAML, so the YAML parser reads the trace and restores escaped strings
+  auto trace = YAML::LoadFile(tracePath);
+  REQUIRE(trace.IsSequence());
+  std::map<std::string, size_t> forwardNodes, calls;
+  bool foundName = false;
+  for(const auto& event : trace) {
+    if(event["ph"].as<std::string>() != "X")
+      continue;
+    auto category = event["cat"].as<std::string>();
+    if(category == "forward") {
+      forwardNodes[event["name"].as<std::string>()]++;
+      CHECK(event["dur"].as<double>() >= 0);
+      if(event["args"]["node"].as<std::string>() == name) {
+        foundName = true;
+        CHECK(event["name"].as<std::string>() == "exp");
+        CHECK(event["args"]["shape"].as<std::string>() == "4x8");
+      }
+    } else if(category == "graph") {
+      calls[event["name"].as<std::string>()]++;
+    }
+  }
+  CHECK(foundName);
+  CHECK(forwardNodes["const"] == 1);
+  CHECK(forwardNodes["exp"] == 1);
+  CHECK(forwardNodes.size() == 4); // and the product and the sum
+  CHECK(calls["forward"] == 1);
+
+  std::remove(tracePath.c_str());
+}
+#endif
@@ -0,0 +1,124 @@
+#include "catch.hpp"
+#include "tensors/backend.h"
+#include "tensors/cpu/sharp/int_gemm.h"
+#include "tensors/tensor_allocator.h"
+
+#include <cmath>
+#include <random>
+
+using namespace marian;
+using namespace marian::cpu::int16;
+
+#ifdef BLAS_FOUND
+TEST_CASE("int16/int8 matrix products agree for all instruction sets (cpu)", "[int_gemm]") {
+  auto backend = BackendByDeviceId({0, DeviceType::cpu}, 1234);
+  auto allocator = New<TensorAllocator>(backend);
+  allocator->reserveExact(4 * 1024 * 1024);
+
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  auto randomTensor = [&](Shape shape, std::vector<float>& values) {
+    values.resize(shape.elements());
+    for(auto& value : values)
+      value = dist(gen);
+    Tensor tensor;
+    allocator->allocate(tensor, shape);
+    tensor->set(values);
+    return tensor;
+  };
+
+  // Computes A * B^T with the kernels of the selected instruction set and compares the result
+  // with the product of the quantized values computed in double precision, and loosely with the
+  // product of the floats.
+  auto compare = [&](int rowsA, int rowsB, int width, bool int8) {
+    std::vector<float> vA, vB;
+    auto A = randomTensor({rowsA, width}, vA);
+    auto B = randomTensor({rowsB, width}, vB);
+
+    // The 8-bit kernels accumulate in saturating 16-bit integers, which this clip value avoids
+    const float clipValue = int8 ? 8.f : 1.f;
+    float quantMult = int8 ? 127.f / clipValue : (float)std::pow(2.0, BITS);
+    Tensor qA, qB, C;
+    allocator->allocate(qA, A->shape(), int8 ? Type::int8 : Type::int16);
+    allocator->allocate(qB, B->shape(), int8 ? Type::int8 : Type::int16);
+    allocator->allocate(C, {rowsA, rowsB});
+    if(int8) {
+      Quantize8(qA, A, clipValue);
+      Quantize8(qB, B, clipValue);
+      ProdInt8(C, qA, qB, 1.f, clipValue);
+    } else {
+      Quantize16(qA, A, clipValue);
+      Quantize16(qB, B, clipValue);
+      ProdInt16(C, qA, qB, 1.f);
+    }
+
+    std::vector<float> values;
+    C->get(values);
+    for(int i = 0; i < rowsA; ++i) {
+      for(int j = 0; j < rowsB; ++j) {
+        double quantized = 0, exact = 0;
+        for(int k = 0; k < width; ++k) {
+          float a = vA[i * width + k], b = vB[j * width + k];
+          quantized += std::nearbyint(a * quantMult) * std::nearbyint(b * quantMult);
+          exact += (double)a * b;
+        }
+        quantized /= (double)quantMult * quantMult;
+        CHECK(values[i * rowsB + j] == Approx(quantized).epsilon(1e-5).margin(1e-5));
+        CHECK(values[i * rowsB + j] == Approx(exact).margin(int8 ? 0.5 : 0.01));
+      }
+    }
+
+    allocator->free(qA);
+    allocator->free(qB);
+    allocator->free(C);
+    allocator->free(A);
+    allocator->free(B);
+  };
+
+  auto checkAddBias = [&](int rows, int width) {
+    std::vector<float> vC, vBias;
+    auto C = randomTensor({rows, width}, vC);
+    auto bias = randomTensor({1, width}, vBias);
+    AddBias(C, bias);
+    std::vector<float> values;
+    C->get(values);
+    for(int i = 0; i < rows; ++i)
+      for(int j = 0; j < width; ++j)
+        CHECK(values[i * width + j] == vC[i * width + j] + vBias[j]);
+    allocator->free(C);
+    allocator->free(bias);
+  };
+
+  std::vector<std::pair<Isa, std::string>> isas = {
+    {Isa::SSE41, "sse4.1"}, {Isa::AVX2, "avx2"}, {Isa::AVX512BW, "avx512bw"}, {Isa::AVX512VNNI, "avx512vnni"}
+  };
+  for(const auto& isa : isas) {
+    if(isa.first > detectIsa())
+      break;
+    setIsa(isa.second);
+    REQUIRE(getIsa() == isa.first);
+
+    SECTION("int16 kernels, " + isa.second) {
+      compare(5, 7, 64, /*int8=*/false);  // all instruction sets
+      compare(4, 9, 48, /*int8=*/false);  // AVX2 instead of AVX-512
+      compare(3, 6, 40, /*int8=*/false);  // SSE4.1 instead of AVX2 and AVX-512
+      compare(8, 8, 8, /*int8=*/false);
+    }
+
+    if(isa.first >= Isa::AVX2) {
+      SECTION("int8 kernels, " + isa.second) {
+        compare(5, 7, 128, /*int8=*/true); // all instruction sets
+        compare(6, 3, 96, /*int8=*/true);  // AVX2 instead of AVX-512
+        compare(1, 9, 32, /*int8=*/true);
+      }
+    }
+
+    SECTION("bias, " + isa.second) {
+      checkAddBias(3, 64);
+      checkAddBias(5, 37);
+      checkAddBias(2, 3);
+    }
+  }
+  setIsa("auto");
+}
+#endif
@@ -2,6 +2,7 @@
 #include "graph/expression_graph.h"
 #include "graph/expression_operators.h"
 #include <cmath>
+#include <functional>
 
 using namespace marian;
 
@@ -764,3 +765,219 @@ TEST_CASE("Expression graph supports basic math operations (cpu)", "[operator]")
   tests(DeviceType::cpu);
 }
 #endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Fused elementwise operations match separate ones (cpu)", "[operator]") {
+  auto data = [](size_t size, int seed) {
+    std::vector<float> values(size);
+    for(size_t i = 0; i < size; ++i)
+      values[i] = (float)(((int)i * 37 + seed * 11) % 41) / 20.f - 1.f;
+    return values;
+  };
+
+  auto newGraph = [](bool fuse) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setInference(true);
+    graph->setElementwiseFusion(fuse);
+    graph->reserveWorkspaceMB(16);
+    return graph;
+  };
+
+  // Builds the same graph with and without fusion and compares all returned expressions. The
+  // builder gets a function that creates an input of a given shape.
+  typedef std::function<std::vector<Expr>(std::function<Expr(Shape)>)> Builder;
+  auto compare = [&](Builder build) {
+    std::vector<std::vector<float>> results[2];
+    for(bool fuse : {false, true}) {
+      auto graph = newGraph(fuse);
+      int seed = 0;
+      auto input = [&](Shape shape) {
+        ++seed;
+        return graph->constant(shape, inits::from_vector(data(shape.elements(), seed)));
+      };
+      auto outputs = build(input);
+      graph->forward();
+      for(auto& out : outputs) {
+        results[fuse].emplace_back();
+        out->val()->get(results[fuse].back());
+      }
+    }
+    REQUIRE(results[1].size() == results[0].size());
+    for(size_t k = 0; k < results[0].size(); ++k) {
+      REQUIRE(results[1][k].size() == results[0][k].size());
+      for(size_t i = 0; i < results[0][k].size(); ++i)
+        CHECK(results[1][k][i] == Approx(results[0][k][i]).epsilon(1e-5).margin(1e-6));
+    }
+  };
+
+  SECTION("flat chain over several tiles") {
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto x = input({5, 300});
+      auto y = input({5, 300});
+      auto h = tanh(x) * y + sigmoid(y);
+      return {relu(h - 0.5f * x) + exp(-square(h))};
+    });
+  }
+
+  SECTION("row-broadcast inputs") {
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto x = input({4, 3, 40});
+      auto bias = input({1, 40});
+      auto scale = input({4, 1, 40});
+      return {tanh((x + bias) * scale) - bias};
+    });
+  }
+
+  SECTION("column-broadcast inputs") {
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto x = input({6, 40});
+      auto mask = input({6, 1});
+      auto bias = input({1, 40});
+      return {sigmoid(x * mask + bias) * mask};
+    });
+  }
+
+  SECTION("dot head") {
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto a = input({6, 20});
+      auto b = input({20, 40});
+      auto bias = input({1, 40});
+      auto residual = input({6, 40});
+      return {relu(dot(a, b) + bias) + residual};
+    });
+  }
+
+  SECTION("affine head with bias") {
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto a = input({2, 5, 20});
+      auto b = input({20, 48});
+      auto bias = input({1, 48});
+      auto residual = input({2, 5, 48});
+      return {tanh(affine(a, b, bias)) * 0.5f + residual};
+    });
+  }
+
+  SECTION("nodes referenced from outside are not merged") {
+    // h is held by the returned list during the forward step, so it must keep its value
+    compare([](std::function<Expr(Shape)> input) -> std::vector<Expr> {
+      auto x = input({6, 40});
+      auto y = input({6, 40});
+      auto h = tanh(x + y);
+      return {sigmoid(h * y) - h, h};
+    });
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Affine products with prepared weights match affine() (cpu)", "[operator]") {
+  auto data = [](size_t size, int seed) {
+    std::vector<float> values(size);
+    for(size_t i = 0; i < size; ++i)
+      values[i] = (float)(((int)i * 37 + seed * 11) % 41) / 20.f - 1.f;
+    return values;
+  };
+
+  std::vector<std::string> gemmTypes = {"intrinint16"};
+#if USE_FBGEMM
+  gemmTypes.push_back("fp16packed");
+  gemmTypes.push_back("int8packed");
+#endif
+
+  const int rows = 8, dimModel = 64, dimOutput = 16;
+  for(const auto& gemmType : gemmTypes) {
+    for(bool transB : {false, true}) {
+      auto graph = New<ExpressionGraph>();
+      graph->setDevice({0, DeviceType::cpu});
+      graph->setInference(true);
+      graph->getBackend()->setOptimized(true);
+      graph->getBackend()->setGemmType(gemmType);
+      graph->reserveWorkspaceMB(16);
+
+      auto a = graph->constant({rows, dimModel}, inits::from_vector(data(rows * dimModel, 1)));
+      auto b = graph->constant(transB ? Shape({dimOutput, dimModel}) : Shape({dimModel, dimOutput}),
+                               inits::from_vector(data(dimModel * dimOutput, 2)));
+      auto bias = graph->constant({1, dimOutput}, inits::from_vector(data(dimOutput, 3)));
+
+      auto prepared = prepareAffineWeights(b, transB);
+      if(!prepared) { // the packed types need AVX2
+        CHECK(gemmType != "intrinint16");
+        continue;
+      }
+      auto expected = affine(a, b, bias, false, transB);
+      auto result = affinePrepared(a, prepared, b->shape(), bias, false, transB);
+      graph->forward();
+
+      std::vector<float> expectedValues, values;
+      expected->val()->get(expectedValues);
+      result->val()->get(values);
+      INFO(gemmType << (transB ? ", transB" : ""));
+      CHECK(result->shape() == Shape({rows, dimOutput}));
+      REQUIRE(values.size() == expectedValues.size());
+      for(size_t i = 0; i < values.size(); ++i)
+        CHECK(values[i] == Approx(expectedValues[i]).margin(1e-4));
+    }
+  }
+}
+#endif
+
+#if defined(BLAS_FOUND) && USE_FBGEMM
+TEST_CASE("Int8 packed affine products are close to fp32 ones (cpu)", "[operator]") {
+  auto data = [](size_t size, int seed) {
+    std::vector<float> values(size);
+    for(size_t i = 0; i < size; ++i)
+      values[i] = (float)(((int)i * 37 + seed * 11) % 41) / 20.f - 1.f;
+    return values;
+  };
+
+  // odd sizes, so that the blocks of the packed matrix are padded
+  const int rows = 5, dimModel = 72, dimOutput = 40;
+  auto aValues = data(rows * dimModel, 1);
+  auto bValues = data(dimModel * dimOutput, 2);
+  auto biasValues = data(dimOutput, 3);
+
+  for(bool transB : {false, true}) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setInference(true);
+    graph->getBackend()->setOptimized(true);
+    graph->getBackend()->setGemmType("int8packed");
+    graph->reserveWorkspaceMB(16);
+
+    // b in the layout given by transB, holding the same matrix [dimModel, dimOutput]
+    std::vector<float> bLayout(bValues);
+    if(transB)
+      for(int j = 0; j < dimModel; ++j)
+        for(int l = 0; l < dimOutput; ++l)
+          bLayout[l * dimModel + j] = bValues[j * dimOutput + l];
+
+    auto a = graph->constant({rows, dimModel}, inits::from_vector(aValues));
+    auto b = graph->constant(transB ? Shape({dimOutput, dimModel}) : Shape({dimModel, dimOutput}),
+                             inits::from_vector(bLayout));
+    auto bias = graph->constant({1, dimOutput}, inits::from_vector(biasValues));
+    // run twice, so that the second product reuses the packed weights
+    auto first = affine(a, b, bias, false, transB);
+    auto second = affine(a * 0.5f, b, bias, false, transB);
+    graph->forward();
+
+    std::vector<float> firstValues, secondValues;
+    first->val()->get(firstValues);
+    second->val()->get(secondValues);
+    REQUIRE(firstValues.size() == rows * dimOutput);
+    REQUIRE(secondValues.size() == rows * dimOutput);
+
+    INFO((transB ? "transB" : "no transB"));
+    for(int i = 0; i < rows; ++i) {
+      for(int l = 0; l < dimOutput; ++l) {
+        float expected = 0.f;
+        for(int j = 0; j < dimModel; ++j)
+          expected += aValues[i * dimModel + j] * bValues[j * dimOutput + l];
+        // weights have 7 bits and inputs 8 bits, so allow for a few quantization steps per sum
+        CHECK(firstValues[i * dimOutput + l] == Approx(expected + biasValues[l]).margin(0.15));
+        CHECK(secondValues[i * dimOutput + l] == Approx(0.5f * expected + biasValues[l]).margin(0.15));
+      }
+    }
+  }
+}
+#endif
@@ -0,0 +1,693 @@
+#include "catch.hpp"
+#include "common/config_parser.h"
+#include "models/encoder_decoder.h"
+#include "models/model_factory.h"
+#include "translator/beam_search.h"
+#include "translator/nth_element.h"
+#include "translator/translator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <set>
+#include <sstream>
+
+using namespace marian;
+
+#ifdef BLAS_FOUND
+namespace {
+
+class TableScorerState : public ScorerState {
+  Logits logProbs_;
+public:
+  TableScorerState(Logits logProbs) : logProbs_(logProbs) {}
+  virtual Logits getLogProbs() const override { return logProbs_; }
+  virtual Ptr<ScorerState> merge(Ptr<ScorerState>) const override { return New<TableScorerState>(Logits()); }
+};
+
+// Scorer whose log probs only depend on the previous word: they are row w of a table
+// [dimVocab, dimVocab] for previous word w. The start hypotheses read the row of </s>, or with
+// startFromSource that of the first source word.
+class TableScorer : public Scorer {
+  std::vector<float> table_;
+  int dimVocab_;
+  bool startFromSource_;
+  std::vector<IndexType> startWords_; // [batchIdx] previous words of the start hypotheses
+
+public:
+  TableScorer(const std::string& name, float weight, const std::vector<float>& table, int dimVocab, bool startFromSource = false)
+      : Scorer(name, weight), table_(table), dimVocab_(dimVocab), startFromSource_(startFromSource) {}
+
+  virtual void clear(Ptr<ExpressionGraph> graph) override { graph->clear(); }
+
+  // the log probs do not depend on the position
+  virtual bool statesAreMergeable() override { return true; }
+
+  virtual Ptr<ScorerState> startState(Ptr<ExpressionGraph>, Ptr<data::CorpusBatch> batch) override {
+    startWords_.assign(batch->size(), Word::DEFAULT_EOS_ID.toWordIndex());
+    if(startFromSource_)
+      for(size_t i = 0; i < batch->size(); ++i)
+        startWords_[i] = batch->front()->data()[i].toWordIndex(); // time-major
+    return New<TableScorerState>(Logits());
+  }
+
+  virtual Ptr<ScorerState> step(Ptr<ExpressionGraph> graph,
+                                Ptr<ScorerState>,
+                                const std::vector<IndexType>&,
+                                const std::vector<IndexType>&,
+                                const Words& words,
+                                int dimBatch,
+                                int beamSize) override {
+    auto table = graph->param(getName() + "_table", {dimVocab_, dimVocab_}, inits::from_vector(table_));
+    // like the decoders, the first step has no previous words and one hypothesis per sentence
+    if(words.empty())
+      beamSize = 1;
+    auto prevWords = words.empty() ? startWords_ : toWordIndexVector(words);
+    auto logProbs = reshape(rows(table, prevWords), {beamSize, 1, dimBatch, dimVocab_});
+    return New<TableScorerState>(Logits(logProbs));
+  }
+};
+
+// text vocabulary of </s>, <unk> and the words w2, w3, ...
+Ptr<Vocab> createVocab(const std::string& path, size_t size) {
+  std::ofstream out(path);
+  out << DEFAULT_EOS_STR << "\n" << DEFAULT_UNK_STR << "\n";
+  for(size_t i = 2; i < size; ++i)
+    out << "w" << i << "\n";
+  out.close();
+
+  auto vocab = New<Vocab>(New<Options>(), 0);
+  vocab->load(path);
+  return vocab;
+}
+
+// sub-batch of the given sentences of word indices, padded to at least the given width
+Ptr<data::SubBatch> createSubBatch(const std::vector<std::vector<WordIndex>>& sentences, Ptr<Vocab> vocab, size_t width = 0) {
+  for(const auto& sentence : sentences)
+    width = std::max(width, sentence.size());
+
+  auto subBatch = New<data::SubBatch>(sentences.size(), width, vocab);
+  for(size_t i = 0; i < sentences.size(); ++i) {
+    for(size_t j = 0; j < sentences[i].size(); ++j) {
+      subBatch->data()[j * sentences.size() + i] = Word::fromWordIndex(sentences[i][j]);
+      subBatch->mask()[j * sentences.size() + i] = 1.f;
+    }
+  }
+  return subBatch;
+}
+
+// source batch of the given sentences of word indices, or a source and target batch
+Ptr<data::CorpusBatch> createBatch(const std::vector<std::vector<WordIndex>>& sentences,
+                                   Ptr<Vocab> vocab,
+                                   size_t width = 0,
+                                   const std::vector<std::vector<WordIndex>>& targets = {}) {
+  std::vector<Ptr<data::SubBatch>> subBatches = {createSubBatch(sentences, vocab, width)};
+  if(!targets.empty())
+    subBatches.push_back(createSubBatch(targets, vocab));
+  auto batch = New<data::CorpusBatch>(subBatches);
+  std::vector<size_t> sentenceIds(sentences.size());
+  std::iota(sentenceIds.begin(), sentenceIds.end(), 0);
+  batch->setSentenceIds(sentenceIds);
+  return batch;
+}
+
+// options of a tiny transformer, whose parameters are initialized randomly when first used
+Ptr<Options> transformerOptions(const std::string& vocabPath, int dimVocab) {
+  std::vector<std::string> args = {"marian", "--type", "transformer", "--dim-emb", "16",
+                                   "--transformer-heads", "2", "--transformer-dim-ffn", "32",
+                                   "--enc-depth", "1", "--dec-depth", "2",
+                                   "--vocabs", vocabPath, vocabPath,
+                                   "--dim-vocabs", std::to_string(dimVocab), std::to_string(dimVocab)};
+  std::vector<char*> argv;
+  for(auto& arg : args)
+    argv.push_back(&arg[0]);
+  auto config = ConfigParser((int)argv.size(), argv.data(), cli::mode::translation).getConfig();
+
+  auto options = New<Options>();
+  options->merge(config);
+  options->set("inference", true);
+  return options;
+}
+
+Ptr<Options> searchOptions(size_t beamSize, float maxLengthFactor) {
+  auto options = New<Options>();
+  options->set("beam-size", beamSize);
+  options->set("normalize", 0.f);
+  options->set("word-penalty", 0.f);
+  options->set("max-length-factor", maxLengthFactor);
+  options->set("n-best", false);
+  return options;
+}
+
+}  // namespace
+#endif
+
+TEST_CASE("Beam thresholds prune the N-best of a step", "[search]") {
+  HypothesisArena arena;
+  auto start = arena.newHypothesis();
+
+  // two batch entries with the path scores of the N-best of a step, best first
+  std::vector<std::vector<float>> scores = {{-1.f, -1.5f, -2.5f, -6.f}, {-0.5f, -0.5f, -9.f}};
+  Beams beams;
+  for(auto& beamScores : scores) {
+    Beam beam;
+    for(size_t i = 0; i < beamScores.size(); ++i)
+      beam.push_back(arena.newHypothesis(start, Word::fromWordIndex(i + 3), 0, beamScores[i]));
+    beams.push_back(beam);
+  }
+
+  SECTION("Thresholds of 0 leave the beams unchanged") {
+    auto pruned = BeamSearch::pruneBeams(beams, 0.f, 0.f);
+    CHECK(pruned == beams);
+  }
+
+  SECTION("Absolute threshold") {
+    auto pruned = BeamSearch::pruneBeams(beams, 2.f, 0.f);
+    REQUIRE(pruned.size() == 2);
+    CHECK(pruned[0] == Beam(beams[0].begin(), beams[0].begin() + 3));
+    CHECK(pruned[1] == Beam(beams[1].begin(), beams[1].begin() + 2));
+  }
+
+  SECTION("Relative threshold") {
+    auto pruned = BeamSearch::pruneBeams(beams, 0.f, 0.5f); // -log(0.5) ~ 0.69
+    REQUIRE(pruned.size() == 2);
+    CHECK(pruned[0] == Beam(beams[0].begin(), beams[0].begin() + 2));
+    CHECK(pruned[1] == Beam(beams[1].begin(), beams[1].begin() + 2));
+  }
+
+  SECTION("The stricter threshold wins and the best entry always survives") {
+    auto pruned = BeamSearch::pruneBeams(beams, 0.1f, 0.5f);
+    REQUIRE(pruned.size() == 2);
+    CHECK(pruned[0] == Beam(1, beams[0][0]));
+    CHECK(pruned[1] == Beam(beams[1].begin(), beams[1].begin() + 2));
+  }
+}
+
+TEST_CASE("Histories trace back hypotheses from the arena", "[search]") {
+  auto arena = New<HypothesisArena>();
+  auto eos = Word::DEFAULT_EOS_ID;
+  auto word = [](size_t i) { return Word::fromWordIndex(i + 10); };
+
+  // grid of one batch entry: start -> a, b; a -> c, b -> </s>; c -> </s>, c -> d
+  auto start = arena->newHypothesis();
+  auto a = arena->newHypothesis(start, word(0), 0, -1.f);
+  auto b = arena->newHypothesis(start, word(1), 0, -2.f);
+  auto c = arena->newHypothesis(a, word(2), 0, -1.5f);
+  auto bEos = arena->newHypothesis(b, eos, 1, -2.5f);
+  auto cEos = arena->newHypothesis(c, eos, 0, -2.f);
+  auto d = arena->newHypothesis(c, word(3), 0, -4.f);
+  CHECK(arena->size() == 7);
+
+  History history(/*lineNo=*/0, arena, /*alpha=*/1.f);
+  history.add(Beam(2, start), eos);
+  history.add({a, b}, eos);
+  history.add({c, bEos}, eos);
+  history.add({cEos, d}, eos, /*last=*/true);
+  CHECK(history.size() == 4);
+
+  CHECK(start->getPrevHyp() == nullptr);
+  CHECK(c->getPrevHyp() == a);
+  CHECK(bEos->getPrevStateIndex() == 1);
+  CHECK(d->tracebackWords() == Words({word(0), word(2), word(3)}));
+
+  // path scores normalized by length: cEos -2/3, d -4/3, bEos -2.5/2
+  auto nbest = history.nBest(5);
+  REQUIRE(nbest.size() == 3);
+  CHECK(std::get<1>(nbest[0]) == cEos);
+  CHECK(std::get<0>(nbest[0]) == Words({word(0), word(2), eos}));
+  CHECK(std::get<2>(nbest[0]) == Approx(-2.f / 3));
+  CHECK(std::get<1>(nbest[1]) == bEos);
+  CHECK(std::get<0>(nbest[1]) == Words({word(1), eos}));
+  CHECK(std::get<2>(nbest[1]) == Approx(-1.25f));
+  CHECK(std::get<1>(nbest[2]) == d);
+  CHECK(std::get<2>(nbest[2]) == Approx(-4.f / 3));
+
+  CHECK(history.nBest(1).size() == 1);
+  CHECK(std::get<1>(history.top()) == cEos);
+  CHECK(history.bestNormalizedScore() == Approx(-2.f / 3));
+}
+
+TEST_CASE("Alignments are reconstructed from the attention of the decoding steps", "[search]") {
+  HypothesisArena arena;
+
+  // two sentences of 3 and 2 source words, mask [srcPos, batchIdx]
+  const size_t batchSize = 2, batchWidth = 3;
+  arena.setSourceMask({1, 1,
+                       1, 1,
+                       1, 0}, batchSize);
+
+  // attention [beamHypIdx, srcPos, batchIdx, 1] of a step; the value encodes the coordinates
+  auto attention = [](size_t step, size_t beamSize, size_t dimBatch) {
+    std::vector<float> values;
+    for(size_t beamHypIdx = 0; beamHypIdx < beamSize; ++beamHypIdx)
+      for(size_t srcPos = 0; srcPos < batchWidth; ++srcPos)
+        for(size_t batchIdx = 0; batchIdx < dimBatch; ++batchIdx)
+          values.push_back(1000.f * step + 100.f * beamHypIdx + 10.f * srcPos + batchIdx);
+    return values;
+  };
+
+  // step 0 decodes both sentences with a beam of 2, step 1 only the second one
+  auto step0 = arena.addAlignmentStep(attention(0, 2, 2), 2);
+  auto step1 = arena.addAlignmentStep(attention(1, 2, 1), 1);
+
+  auto start = arena.newHypothesis();
+  CHECK(start->getAlignment().empty());
+
+  auto first = arena.newHypothesis(start, Word::fromWordIndex(5), 0, -1.f);
+  first->setAlignment(step0, /*beamHypIdx=*/1, /*batchIdx=*/0, /*origBatchIdx=*/0);
+  CHECK(first->getAlignment() == std::vector<float>({100.f, 110.f, 120.f}));
+
+  auto second = arena.newHypothesis(start, Word::fromWordIndex(6), 0, -1.f);
+  second->setAlignment(step0, /*beamHypIdx=*/1, /*batchIdx=*/1, /*origBatchIdx=*/1);
+  auto next = arena.newHypothesis(second, Word::fromWordIndex(7), 1, -2.f);
+  next->setAlignment(step1, /*beamHypIdx=*/0, /*batchIdx=*/0, /*origBatchIdx=*/1);
+  auto last = arena.newHypothesis(next, Word::DEFAULT_EOS_ID, 0, -3.f);
+  last->shareAlignment(*next);
+
+  auto matrix = last->tracebackAlignment(); // [t][s]
+  REQUIRE(matrix.size() == 3);
+  CHECK(matrix[0] == std::vector<float>({101.f, 111.f}));
+  CHECK(matrix[1] == std::vector<float>({1000.f, 1010.f}));
+  CHECK(matrix[2] == matrix[1]);
+}
+
+#ifdef BLAS_FOUND
+TEST_CASE("N-best selection matches std::partial_sort (cpu)", "[search]") {
+  Config::seed = 1234;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+
+  // Compares the N best scores of each batch entry and their keys (batchIdx * inputN * dimVocab
+  // + index in the entry) with those of a sort in which the lower key wins a tie.
+  auto compare = [&](const std::vector<float>& scores, int dimBatch, int inputN, int dimVocab, size_t N, bool isFirst) {
+    graph->clear();
+    auto input = graph->constant({dimBatch, 1, inputN, dimVocab}, inits::from_vector(scores));
+    graph->forward();
+
+    std::vector<float> outScores;
+    std::vector<unsigned> outKeys;
+    auto getNBestList = createGetNBestListFn(N, dimBatch, graph->getDeviceId());
+    getNBestList(input->val(), N, outScores, outKeys, isFirst);
+    REQUIRE(outScores.size() == N * dimBatch);
+    REQUIRE(outKeys.size() == N * dimBatch);
+
+    unsigned batchStride = inputN * dimVocab;
+    for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
+      std::vector<unsigned> keys(batchStride);
+      std::iota(keys.begin(), keys.end(), batchIdx * batchStride);
+      std::partial_sort(keys.begin(), keys.begin() + N, keys.end(), [&](unsigned a, unsigned b) {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+      });
+      for(size_t i = 0; i < N; ++i) {
+        CHECK(outKeys[batchIdx * N + i] == keys[i]);
+        CHECK(outScores[batchIdx * N + i] == scores[keys[i]]);
+      }
+    }
+  };
+
+  // scores from a few distinct values, so that there are many ties
+  auto randomScores = [](size_t size) {
+    std::vector<float> scores(size);
+    for(auto& score : scores)
+      score = -(float)(rand() % 7);
+    return scores;
+  };
+
+  SECTION("first step with ties") {
+    compare(randomScores(3 * 100), /*dimBatch=*/3, /*inputN=*/1, /*dimVocab=*/100, /*N=*/5, /*isFirst=*/true);
+  }
+
+  SECTION("later step with ties") {
+    compare(randomScores(4 * 4 * 37), /*dimBatch=*/4, /*inputN=*/4, /*dimVocab=*/37, /*N=*/4, /*isFirst=*/false);
+  }
+
+  SECTION("distinct scores") {
+    std::vector<float> scores(2 * 3 * 50);
+    std::iota(scores.begin(), scores.end(), -300.f);
+    std::random_shuffle(scores.begin(), scores.end());
+    compare(scores, /*dimBatch=*/2, /*inputN=*/3, /*dimVocab=*/50, /*N=*/3, /*isFirst=*/false);
+  }
+
+  SECTION("N larger than the rows of the beam entries") {
+    compare(randomScores(2 * 6 * 4), /*dimBatch=*/2, /*inputN=*/6, /*dimVocab=*/4, /*N=*/6, /*isFirst=*/false);
+    compare(randomScores(8), /*dimBatch=*/1, /*inputN=*/1, /*dimVocab=*/8, /*N=*/8, /*isFirst=*/true);
+  }
+
+  SECTION("-inf and lowest() entries") {
+    auto scores = randomScores(3 * 2 * 40);
+    for(size_t i = 0; i < scores.size(); ++i) {
+      if(i % 3 == 0)
+        scores[i] = -std::numeric_limits<float>::infinity();
+      else if(i % 5 == 0)
+        scores[i] = std::numeric_limits<float>::lowest();
+    }
+    // one batch entry with nothing but -inf and lowest()
+    for(size_t i = 0; i < 2 * 40; ++i)
+      scores[i] = i % 2 ? std::numeric_limits<float>::lowest() : -std::numeric_limits<float>::infinity();
+    compare(scores, /*dimBatch=*/3, /*inputN=*/2, /*dimVocab=*/40, /*N=*/2, /*isFirst=*/false);
+    compare(scores, /*dimBatch=*/6, /*inputN=*/1, /*dimVocab=*/40, /*N=*/5, /*isFirst=*/true);
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Beams pruned by the thresholds get their full width back at the next step (cpu)", "[search]") {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+
+  const int dimVocab = 6;
+  auto trgVocab = createVocab("search_tests.vocab", dimVocab);
+  auto batch = createBatch({{2, 0}}, trgVocab); // w2 </s>
+
+  // After the start, w2 is far better than anything else, and the thresholds leave only w2 in
+  // the beam. After w2, w3, w4 and w5 are equally likely and all survive the thresholds.
+  std::vector<float> table(dimVocab * dimVocab, -30.f);
+  table[0 * dimVocab + 0] = -40.f; // </s> right after the start would narrow the beam
+  table[0 * dimVocab + 2] = -0.01f;
+  for(int w = 3; w < dimVocab; ++w)
+    table[2 * dimVocab + w] = -1.1f;
+  std::vector<Ptr<Scorer>> scorers = {New<TableScorer>("table", 1.f, table, dimVocab)};
+
+  // two steps: sentence length 2 times 1
+  auto search = [&](float absoluteThreshold) {
+    auto options = searchOptions(/*beamSize=*/3, /*maxLengthFactor=*/1.f);
+    options->set("beam-threshold-absolute", absoluteThreshold);
+    auto histories = BeamSearch(options, scorers, trgVocab).search(graph, batch);
+    REQUIRE(histories.size() == 1);
+    return histories[0]->nBest(3);
+  };
+
+  auto unpruned = search(0.f);
+  auto pruned = search(5.f);
+
+  // all hypotheses of the last step end the search, so the N-best lists hold the last beams
+  REQUIRE(pruned.size() == 3);
+  REQUIRE(unpruned.size() == 3);
+  for(size_t i = 0; i < 3; ++i) {
+    CHECK(std::get<0>(pruned[i]).front() == Word::fromWordIndex(2));
+    CHECK(std::get<0>(pruned[i]) == std::get<0>(unpruned[i]));
+    CHECK(std::get<2>(pruned[i]) == Approx(-1.11f));
+  }
+
+  std::remove("search_tests.vocab");
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Parallel ensemble members give the same translations as sequential ones (cpu)", "[search]") {
+  const int dimVocab = 9;
+  auto trgVocab = createVocab("search_tests.vocab", dimVocab);
+  auto batch = createBatch({{2, 5, 7, 0}, {3, 0}, {8, 4, 6, 2, 0}}, trgVocab);
+
+  // log probs of the members; </s> is likely enough that hypotheses end at different steps
+  auto table = [&](int seed) {
+    std::vector<float> values(dimVocab * dimVocab);
+    for(int prev = 0; prev < dimVocab; ++prev)
+      for(int word = 0; word < dimVocab; ++word)
+        values[prev * dimVocab + word] = -0.37f * (float)((prev * 7 + word * 3 + seed) % 11) - 0.1f;
+    return values;
+  };
+
+  auto options = searchOptions(/*beamSize=*/3, /*maxLengthFactor=*/2.f);
+  options->set("n-best", true);
+  options->set("clip-gemm", 0.f);
+  options->set("optimize", false);
+  options->set("gemm-type", std::string("auto"));
+  options->set("gemm-isa", std::string("auto"));
+  options->set("workspace", (size_t)16);
+
+  auto translate = [&](bool parallel) {
+    options->set("parallel-ensemble", parallel);
+    std::vector<Ptr<Scorer>> scorers = {New<TableScorer>("first", 0.7f, table(1), dimVocab),
+                                        New<TableScorer>("second", 0.3f, table(4), dimVocab)};
+    auto graph = createTranslationGraph(options, {0, DeviceType::cpu});
+    initScorers(options, scorers, graph);
+    CHECK((scorers[1]->getGraph() != nullptr) == parallel);
+
+    return BeamSearch(options, scorers, trgVocab).search(graph, batch);
+  };
+
+  // the histories own the hypotheses of their N-best lists
+  auto sequentialHistories = translate(false);
+  auto parallelHistories = translate(true);
+
+  REQUIRE(sequentialHistories.size() == batch->size());
+  REQUIRE(parallelHistories.size() == sequentialHistories.size());
+  for(size_t i = 0; i < sequentialHistories.size(); ++i) {
+    auto sequential = sequentialHistories[i]->nBest(3);
+    auto parallel = parallelHistories[i]->nBest(3);
+    REQUIRE(parallel.size() == sequential.size());
+    CHECK(sequential.size() == 3);
+    for(size_t k = 0; k < sequential.size(); ++k) {
+      CHECK(std::get<0>(parallel[k]) == std::get<0>(sequential[k]));
+      CHECK(std::get<2>(parallel[k]) == Approx(std::get<2>(sequential[k])));
+      auto parallelBreakdown = std::get<1>(parallel[k])->getScoreBreakdown();
+      auto sequentialBreakdown = std::get<1>(sequential[k])->getScoreBreakdown();
+      REQUIRE(parallelBreakdown.size() == 2);
+      REQUIRE(sequentialBreakdown.size() == 2);
+      for(size_t j = 0; j < 2; ++j)
+        CHECK(parallelBreakdown[j] == Approx(sequentialBreakdown[j]));
+    }
+  }
+
+  std::remove("search_tests.vocab");
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Greedy search gives the same translations as beam search with a beam of 1 (cpu)", "[search]") {
+  const int dimVocab = 9;
+  auto trgVocab = createVocab("search_tests.vocab", dimVocab);
+  // sentences of different lengths and an empty line, so that entries are dropped at different steps
+  auto batch = createBatch({{2, 5, 7, 0}, {3, 0}, {0}, {8, 4, 6, 2, 0}}, trgVocab);
+
+  auto table = [&](int seed) {
+    std::vector<float> values(dimVocab * dimVocab);
+    for(int prev = 0; prev < dimVocab; ++prev)
+      for(int word = 0; word < dimVocab; ++word)
+        values[prev * dimVocab + word] = -0.37f * (float)((prev * 5 + word * 3 + seed) % 11) - 0.1f;
+    return values;
+  };
+
+  auto options = searchOptions(/*beamSize=*/1, /*maxLengthFactor=*/2.f);
+  options->set("normalize", 0.6f);
+  options->set("n-best", true);
+  options->set("right-left", false);
+  REQUIRE(GreedySearch::supports(options, trgVocab));
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+  std::vector<Ptr<Scorer>> scorers = {New<TableScorer>("first", 0.7f, table(1), dimVocab),
+                                      New<TableScorer>("second", 0.3f, table(4), dimVocab)};
+
+  // the histories own the hypotheses of their N-best lists
+  auto beamHistories = BeamSearch(options, scorers, trgVocab).search(graph, batch);
+  auto greedyHistories = GreedySearch(options, scorers, trgVocab).search(graph, batch);
+
+  OutputPrinter printer(options, trgVocab);
+  REQUIRE(beamHistories.size() == batch->size());
+  REQUIRE(greedyHistories.size() == beamHistories.size());
+  for(size_t i = 0; i < beamHistories.size(); ++i) {
+    CHECK(greedyHistories[i]->getLineNum() == beamHistories[i]->getLineNum());
+
+    auto beam = beamHistories[i]->nBest(1);
+    auto greedy = greedyHistories[i]->nBest(1);
+    REQUIRE(beam.size() == 1);
+    REQUIRE(greedy.size() == 1);
+    CHECK(std::get<0>(greedy[0]) == std::get<0>(beam[0]));
+    CHECK(std::get<2>(greedy[0]) == Approx(std::get<2>(beam[0])));
+    CHECK(std::get<1>(greedy[0])->getPathScore() == Approx(std::get<1>(beam[0])->getPathScore()));
+    auto greedyBreakdown = std::get<1>(greedy[0])->getScoreBreakdown();
+    auto beamBreakdown = std::get<1>(beam[0])->getScoreBreakdown();
+    if(std::get<0>(beam[0]) != Words({Word::DEFAULT_EOS_ID})) { // empty lines have no breakdown
+      REQUIRE(greedyBreakdown.size() == 2);
+      REQUIRE(beamBreakdown.size() == 2);
+      for(size_t j = 0; j < 2; ++j)
+        CHECK(greedyBreakdown[j] == Approx(beamBreakdown[j]));
+    }
+
+    // the printed translations and N-best lines agree up to the digits of the scores
+    std::stringstream beamBest1, beamBestN, greedyBest1, greedyBestN;
+    printer.print(beamHistories[i], beamBest1, beamBestN);
+    printer.print(greedyHistories[i], greedyBest1, greedyBestN);
+    CHECK(greedyBest1.str() == beamBest1.str());
+    auto text = [](const std::string& line) { return line.substr(0, line.rfind(" |||", line.rfind(" |||") - 1)); };
+    CHECK(text(greedyBestN.str()) == text(beamBestN.str()));
+  }
+
+  std::remove("search_tests.vocab");
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Transformer decoding with the key/value cache gives the logits of the whole target (cpu)", "[search]") {
+  Config::seed = 1234;
+  const int dimVocab = 10;
+  auto vocab = createVocab("search_tests.vocab", dimVocab);
+  auto options = transformerOptions("search_tests.vocab", dimVocab);
+  auto model = std::dynamic_pointer_cast<EncoderDecoder>(models::createModelFromOptions(options, models::usage::raw));
+  REQUIRE(model);
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  std::vector<std::vector<WordIndex>> targets = {{4, 7, 2, 9, 0}, {3, 5, 0}};
+  auto batch = createBatch({{2, 5, 7, 0}, {8, 4, 0}}, vocab, /*width=*/0, targets);
+  const int dimBatch = (int)targets.size();
+  const int dimTime = (int)targets[0].size();
+
+  // without the cache: all target positions at once, as in training and scoring
+  auto full = model->stepAll(graph, batch, /*clearGraph=*/true)->getLogProbs().getLogits();
+  graph->forward();
+  REQUIRE(full->shape() == Shape({1, dimTime, dimBatch, dimVocab}));
+  std::vector<float> fullValues;
+  full->val()->get(fullValues);
+
+  // with the cache: one position per step, fed with the previous target words
+  model->clear(graph);
+  auto state = model->startState(graph, batch);
+  for(int t = 0; t < dimTime; ++t) {
+    Words words;
+    if(t > 0)
+      for(const auto& target : targets)
+        words.push_back(Word::fromWordIndex(t - 1 < (int)target.size() ? target[t - 1] : 0));
+    state = model->step(graph, state, /*hypIndices=*/{}, /*batchIndices=*/{}, words, dimBatch, /*beamSize=*/1);
+    auto logits = state->getLogProbs().getLogits();
+    if(t == 0)
+      graph->forward();
+    else
+      graph->forwardNext();
+    REQUIRE(logits->shape() == Shape({1, 1, dimBatch, dimVocab}));
+    std::vector<float> stepValues;
+    logits->val()->get(stepValues);
+
+    // padded target positions are masked in the whole target only
+    for(int b = 0; b < dimBatch; ++b)
+      if(t < (int)targets[b].size())
+        for(int v = 0; v < dimVocab; ++v)
+          CHECK(stepValues[b * dimVocab + v] == Approx(fullValues[(t * dimBatch + b) * dimVocab + v]).epsilon(1e-4));
+  }
+
+  std::remove("search_tests.vocab");
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Dropping finished sentences from the batch keeps the translations (cpu)", "[search]") {
+  Config::seed = 1234;
+  const int dimVocab = 10;
+  auto trgVocab = createVocab("search_tests.vocab", dimVocab);
+  auto options = transformerOptions("search_tests.vocab", dimVocab);
+  options->set("beam-size", (size_t)2);
+  options->set("max-length-factor", 3.f);
+
+  // The translations count up from the first source word to w9, followed by </s>, so that the
+  // sentences end at different steps. The transformer changes the scores of the translations.
+  std::vector<float> table(dimVocab * dimVocab, -10.f);
+  for(int prev = 2; prev < dimVocab; ++prev)
+    table[prev * dimVocab + (prev + 1 < dimVocab ? prev + 1 : 0)] = -0.1f;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+  std::vector<Ptr<Scorer>> scorers = {
+      New<ScorerWrapper>(models::createModelFromOptions(options, models::usage::translation), "transformer", 1.f, ""),
+      New<TableScorer>("table", 1.f, table, dimVocab, /*startFromSource=*/true)};
+
+  // sentences of different lengths and an empty line; alone, each is padded to the width of
+  // the batch so that the maximum length of the translations stays the same
+  std::vector<std::vector<WordIndex>> sentences = {{2, 5, 7, 0}, {3, 0}, {0}, {8, 4, 6, 2, 0}, {9, 4, 0}};
+  const size_t width = 5;
+  auto histories = BeamSearch(options, scorers, trgVocab).search(graph, createBatch(sentences, trgVocab));
+  REQUIRE(histories.size() == sentences.size());
+
+  std::set<size_t> lengths;
+  for(size_t i = 0; i < sentences.size(); ++i) {
+    auto alone = BeamSearch(options, scorers, trgVocab).search(graph, createBatch({sentences[i]}, trgVocab, width));
+    REQUIRE(alone.size() == 1);
+    lengths.insert(histories[i]->size());
+
+    auto best = histories[i]->top();
+    auto bestAlone = alone[0]->top();
+    CHECK(std::get<0>(best) == std::get<0>(bestAlone));
+    CHECK(std::get<2>(best) == Approx(std::get<2>(bestAlone)).epsilon(1e-4));
+  }
+  // the batch only shrinks if the sentences end at different steps
+  CHECK(lengths.size() > 2);
+
+  std::remove("search_tests.vocab");
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Sentences that join a running transformer search keep their translations (cpu)", "[search]") {
+  Config::seed = 1234;
+  const int dimVocab = 10;
+  auto trgVocab = createVocab("search_tests.vocab", dimVocab);
+  auto options = transformerOptions("search_tests.vocab", dimVocab);
+  options->set("beam-size", (size_t)2);
+  options->set("max-length-factor", 3.f);
+  options->set("continuous-batching", (size_t)3);
+
+  // The translations count up from the first source word to w9, followed by </s>, so that the
+  // sentences end at different steps. The transformer changes the scores of the translations.
+  std::vector<float> table(dimVocab * dimVocab, -10.f);
+  for(int prev = 2; prev < dimVocab; ++prev)
+    table[prev * dimVocab + (prev + 1 < dimVocab ? prev + 1 : 0)] = -0.1f;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+  std::vector<Ptr<Scorer>> scorers = {
+      New<ScorerWrapper>(models::createModelFromOptions(options, models::usage::translation), "transformer", 1.f, ""),
+      New<TableScorer>("table", 1.f, table, dimVocab, /*startFromSource=*/true)};
+  REQUIRE(BeamSearch(options, scorers, trgVocab).supportsContinuousBatching());
+
+  // batches of two sentences, of which only three are decoded together, so that new sentences
+  // join whenever one finishes; all are padded to the same width for the same maximum length
+  std::vector<std::vector<std::vector<WordIndex>>> inputs = {{{2, 5, 7, 0}, {3, 0}},
+                                                             {{8, 4, 6, 2, 0}, {9, 4, 0}},
+                                                             {{5, 0}, {7, 3, 3, 0}}};
+  const size_t width = 5;
+  std::vector<Ptr<data::CorpusBatch>> batches;
+  for(size_t b = 0; b < inputs.size(); ++b) {
+    batches.push_back(createBatch(inputs[b], trgVocab, width));
+    batches.back()->setSentenceIds({2 * b, 2 * b + 1});
+  }
+
+  size_t nextBatch = 0;
+  auto feed = [&]() -> Ptr<data::CorpusBatch> { return nextBatch < batches.size() ? batches[nextBatch++] : nullptr; };
+  std::map<size_t, Ptr<History>> histories;
+  BeamSearch(options, scorers, trgVocab).searchContinuous(graph, feed, [&](Ptr<History> history) {
+    histories[history->getLineNum()] = history;
+  });
+  REQUIRE(histories.size() == 6);
+
+  std::set<size_t> lengths;
+  for(size_t b = 0; b < inputs.size(); ++b) {
+    for(size_t i = 0; i < inputs[b].size(); ++i) {
+      auto alone = BeamSearch(options, scorers, trgVocab).search(graph, createBatch({inputs[b][i]}, trgVocab, width));
+      REQUIRE(alone.size() == 1);
+      auto history = histories[2 * b + i];
+      lengths.insert(history->size());
+
+      auto best = history->top();
+      auto bestAlone = alone[0]->top();
+      CHECK(std::get<0>(best) == std::get<0>(bestAlone));
+      CHECK(std::get<2>(best) == Approx(std::get<2>(bestAlone)).epsilon(1e-4));
+    }
+  }
+  // new sentences only join a running search if the sentences end at different steps
+  CHECK(lengths.size() > 2);
+
+  std::remove("search_tests.vocab");
+}
+#endif
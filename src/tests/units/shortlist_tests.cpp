@@ -0,0 +1,258 @@
+#include "catch.hpp"
+#include "data/corpus_base.h"
+#include "data/shortlist.h"
+#include "layers/generic.h"
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <unordered_set>
+
+using namespace marian;
+
+namespace {
+
+// text vocabulary of </s>, <unk> and the given number of words prefix0, prefix1, ...
+Ptr<Vocab> createVocab(const std::string& path, const std::string& prefix, size_t size, size_t batchIndex) {
+  std::ofstream out(path);
+  out << DEFAULT_EOS_STR << "\n" << DEFAULT_UNK_STR << "\n";
+  for(size_t i = 2; i < size; ++i)
+    out << prefix << i << "\n";
+  out.close();
+
+  auto vocab = New<Vocab>(New<Options>(), batchIndex);
+  vocab->load(path);
+  return vocab;
+}
+
+// source batch of the given sentences of word indices
+Ptr<data::CorpusBatch> createBatch(const std::vector<std::vector<WordIndex>>& sentences, Ptr<Vocab> vocab) {
+  size_t width = 0;
+  for(const auto& sentence : sentences)
+    width = std::max(width, sentence.size());
+
+  auto subBatch = New<data::SubBatch>(sentences.size(), width, vocab);
+  for(size_t i = 0; i < sentences.size(); ++i) {
+    for(size_t j = 0; j < sentences[i].size(); ++j) {
+      subBatch->data()[j * sentences.size() + i] = Word::fromWordIndex(sentences[i][j]);
+      subBatch->mask()[j * sentences.size() + i] = 1.f;
+    }
+  }
+  return New<data::CorpusBatch>(std::vector<Ptr<data::SubBatch>>({subBatch}));
+}
+
+}  // namespace
+
+TEST_CASE("Binary shortlists give the same short lists as text lexicons", "[data]") {
+  const std::string lexPath = "shortlist_tests.lex";
+  const std::string binPath = "shortlist_tests.bin";
+  auto srcVocab = createVocab("shortlist_tests.src", "s", 20, 0);
+  auto trgVocab = createVocab("shortlist_tests.trg", "t", 30, 1);
+
+  // target word, source word, probability
+  std::ofstream lex(lexPath);
+  lex << "t5 s2 0.5\n"  "t6 s2 0.3\n"  "t7 s2 0.2\n"
+         "t9 s3 0.9\n"  "t8 s3 0.1\n"
+         "t29 s10 0.6\n" "t3 s10 0.4\n"
+         "NULL s11 0.7\n" "t12 s11 0.01\n";
+  lex.close();
+
+  auto textOptions = New<Options>();
+  textOptions->set("shortlist", std::vector<std::string>({lexPath, "3", "2", "0.05"}));
+  data::LexicalShortlistGenerator text(textOptions, srcVocab, trgVocab);
+  text.save(binPath);
+
+  auto binaryOptions = New<Options>();
+  binaryOptions->set("shortlist", std::vector<std::string>({binPath}));
+  data::LexicalShortlistGenerator binary(binaryOptions, srcVocab, trgVocab);
+
+  std::vector<std::vector<std::vector<WordIndex>>> batches = {
+    {{2, 3, 0}},
+    {{10, 11, 0}, {2, 0}},
+    {{4, 19, 0}, {3, 10, 2, 0}, {0}},
+  };
+  for(const auto& sentences : batches) {
+    auto batch = createBatch(sentences, srcVocab);
+    CHECK(binary.generate(batch)->indices() == text.generate(batch)->indices());
+  }
+  // first 3 words, the 2 best for s2 and s10 above the threshold
+  CHECK(text.generate(createBatch({{2, 10, 11}}, srcVocab))->indices() == std::vector<WordIndex>({0, 1, 2, 3, 5, 6, 29}));
+
+  std::remove(lexPath.c_str());
+  std::remove(binPath.c_str());
+  std::remove("shortlist_tests.src");
+  std::remove("shortlist_tests.trg");
+}
+
+TEST_CASE("Short lists match those of a hash set over the lexicon", "[data]") {
+  const std::string lexPath = "shortlist_tests.lex";
+  const size_t firstNum = 4, bestNum = 3;
+  auto srcVocab = createVocab("shortlist_tests.src", "s", 40, 0);
+  auto trgVocab = createVocab("shortlist_tests.trg", "t", 30, 1);
+
+  // random lexicon for the source words below 12 with distinct probabilities; words from 12 on
+  // are beyond the short lists of the generator
+  std::mt19937 gen(1234);
+  std::vector<std::vector<std::pair<float, WordIndex>>> lexicon(12);
+  std::ofstream lex(lexPath);
+  for(WordIndex src = 2; src < lexicon.size(); ++src) {
+    std::vector<WordIndex> trgWords(28);
+    std::iota(trgWords.begin(), trgWords.end(), 2);
+    std::shuffle(trgWords.begin(), trgWords.end(), gen);
+    trgWords.resize(gen() % 6);
+    for(size_t k = 0; k < trgWords.size(); ++k) {
+      float prob = 0.5f / (k + 1) + 0.001f * src;
+      lexicon[src].emplace_back(prob, trgWords[k]);
+      lex << "t" << trgWords[k] << " s" << src << " " << prob << "\n";
+    }
+    std::sort(lexicon[src].begin(), lexicon[src].end(), std::greater<std::pair<float, WordIndex>>());
+  }
+  lex.close();
+
+  // as generated before short lists were bitsets; source words are only added if they are in
+  // the target vocabulary
+  auto expected = [&](const std::vector<WordIndex>& srcWords, bool shared) {
+    std::unordered_set<WordIndex> indexSet;
+    for(WordIndex i = 0; i < firstNum; ++i)
+      indexSet.insert(i);
+    for(auto i : srcWords) {
+      if(shared && i < trgVocab->size())
+        indexSet.insert(i);
+      if(i < lexicon.size())
+        for(size_t k = 0; k < bestNum && k < lexicon[i].size(); ++k)
+          indexSet.insert(lexicon[i][k].second);
+    }
+    std::vector<WordIndex> indices(indexSet.begin(), indexSet.end());
+    std::sort(indices.begin(), indices.end());
+    return indices;
+  };
+
+  // more distinct sets of source words than the generator caches, each of them twice
+  std::vector<std::vector<std::vector<WordIndex>>> batches;
+  for(size_t i = 0; i < 600; ++i) {
+    std::vector<std::vector<WordIndex>> sentences(1 + gen() % 3);
+    for(auto& sentence : sentences) {
+      sentence.resize(1 + gen() % 6);
+      for(auto& word : sentence)
+        word = 2 + gen() % 38;
+      sentence.push_back(0);
+    }
+    batches.push_back(sentences);
+    if(i % 2 == 0)
+      batches.push_back(sentences);
+  }
+
+  for(bool shared : {false, true}) {
+    auto options = New<Options>();
+    options->set("shortlist", std::vector<std::string>({lexPath, std::to_string(firstNum), std::to_string(bestNum)}));
+
+    SECTION(shared ? "one short list per batch, shared vocabularies" : "one short list per batch") {
+      data::LexicalShortlistGenerator generator(options, srcVocab, trgVocab, 0, 1, shared);
+      for(const auto& sentences : batches) {
+        std::vector<WordIndex> srcWords;
+        for(const auto& sentence : sentences)
+          srcWords.insert(srcWords.end(), sentence.begin(), sentence.end());
+        auto shortlist = generator.generate(createBatch(sentences, srcVocab));
+        CHECK(!shortlist->isPerSentence());
+        CHECK(shortlist->indices() == expected(srcWords, shared));
+      }
+
+      // the same words in another order and with padding give the cached short list
+      auto shortlist = generator.generate(createBatch({{3, 7, 2, 0}}, srcVocab));
+      CHECK(generator.generate(createBatch({{2, 3, 0}, {7, 3, 0}}, srcVocab)) == shortlist);
+    }
+
+    SECTION(shared ? "one short list per sentence, shared vocabularies" : "one short list per sentence") {
+      options->set("shortlist-per-sentence", true);
+      data::LexicalShortlistGenerator generator(options, srcVocab, trgVocab, 0, 1, shared);
+      for(const auto& sentences : batches) {
+        auto shortlist = generator.generate(createBatch(sentences, srcVocab));
+        REQUIRE(shortlist->isPerSentence());
+        REQUIRE(shortlist->dimBatch() == sentences.size());
+        for(size_t i = 0; i < sentences.size(); ++i) {
+          auto indices = expected(sentences[i], shared);
+          CHECK(shortlist->lengths()[i] == indices.size());
+          // padded with the last word of the list
+          indices.resize(shortlist->size(), indices.back());
+          auto begin = shortlist->indices().begin() + i * shortlist->size();
+          CHECK(std::vector<WordIndex>(begin, begin + shortlist->size()) == indices);
+        }
+      }
+    }
+  }
+
+  std::remove(lexPath.c_str());
+  std::remove("shortlist_tests.src");
+  std::remove("shortlist_tests.trg");
+}
+
+#ifdef BLAS_FOUND
+TEST_CASE("Output layers with per-sentence short lists give the logits of the full vocabulary (cpu)", "[layer]") {
+  Config::seed = 1234;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+
+  const int dimVocab = 12, dimModel = 4, dimBatch = 2, beamSize = 3;
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  auto randomValues = [&](size_t size) {
+    std::vector<float> values(size);
+    for(auto& value : values)
+      value = dist(gen);
+    return values;
+  };
+
+  // parameters of the output layer, shared by all instances with this prefix
+  graph->param("out_Wt", {dimVocab, dimModel}, inits::from_vector(randomValues(dimVocab * dimModel)));
+  graph->param("out_b", {1, dimVocab}, inits::from_vector(randomValues(dimVocab)));
+  auto options = New<Options>();
+  options->set("prefix", "out");
+  options->set("dim", dimVocab);
+
+  auto input = graph->constant({beamSize, 1, dimBatch, dimModel}, inits::from_vector(randomValues(beamSize * dimBatch * dimModel)));
+  auto full = New<mlp::Output>(graph, options)->applyAsLogits(input).getLogits(); // [beamSize, 1, dimBatch, dimVocab]
+
+  std::vector<std::vector<WordIndex>> indicesPerSentence = {{0, 1, 3, 7, 11}, {0, 2, 5}};
+  auto shortlist = New<data::Shortlist>(indicesPerSentence);
+  auto output = New<mlp::Output>(graph, options);
+  output->setShortlist(shortlist);
+  auto logits = output->applyAsLogits(input).getLogits(); // [beamSize, 1, dimBatch, dimShortlist]
+  graph->forward();
+
+  // compares the logits of each batch entry with the full ones at the words of its short list,
+  // and checks that the padding gets lowest()
+  auto compare = [&](Expr logits, const std::vector<IndexType>& batchIndices) {
+    int dimShortlist = (int)shortlist->size();
+    REQUIRE(logits->shape() == Shape({beamSize, 1, (int)batchIndices.size(), dimShortlist}));
+    std::vector<float> fullValues, values;
+    full->val()->get(fullValues);
+    logits->val()->get(values);
+    for(int beamHypIdx = 0; beamHypIdx < beamSize; ++beamHypIdx) {
+      for(size_t batchIdx = 0; batchIdx < batchIndices.size(); ++batchIdx) {
+        const auto& indices = indicesPerSentence[batchIndices[batchIdx]];
+        for(int k = 0; k < dimShortlist; ++k) {
+          float value = values[(beamHypIdx * batchIndices.size() + batchIdx) * dimShortlist + k];
+          if(k < (int)indices.size())
+            CHECK(value == Approx(fullValues[(beamHypIdx * dimBatch + batchIndices[batchIdx]) * dimVocab + indices[k]]));
+          else
+            CHECK(value == std::numeric_limits<float>::lowest());
+        }
+      }
+    }
+  };
+
+  compare(logits, {0, 1});
+
+  // finished sentences are dropped: the short list shrinks with the batch
+  shortlist = shortlist->select({1});
+  output->setShortlist(shortlist);
+  auto selectedInput = index_select(input, -2, std::vector<IndexType>({1}));
+  auto selectedLogits = output->applyAsLogits(selectedInput).getLogits();
+  graph->forward();
+  compare(selectedLogits, {1});
+}
+#endif
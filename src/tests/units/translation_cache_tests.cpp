@@ -0,0 +1,174 @@
+#include "catch.hpp"
+#include "translator/translation_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+using namespace marian;
+
+namespace {
+
+// distinct keys of the same length that all fall into the same shard
+std::vector<std::string> keysOfOneShard(size_t num) {
+  std::vector<std::string> keys;
+  for(size_t i = 1000; keys.size() < num; ++i) {
+    auto key = "key" + std::to_string(i);
+    if(TranslationCache::shardIndex(key) == 0)
+      keys.push_back(key);
+  }
+  return keys;
+}
+
+}  // namespace
+
+TEST_CASE("Source sentences are normalized for the translation cache", "[cache]") {
+  CHECK(TranslationCache::normalize("a b c") == "a b c");
+  CHECK(TranslationCache::normalize("  a \t b\n\nc  \r\n") == "a b c");
+  CHECK(TranslationCache::normalize("   ") == "");
+  CHECK(TranslationCache::normalize("") == "");
+  CHECK(TranslationCache::normalize("ä b") == "ä b"); // only ASCII whitespace
+}
+
+TEST_CASE("Translation cache evicts the least recently used entries of a shard", "[cache]") {
+  auto keys = keysOfOneShard(5);
+  const std::string translation = "translation";
+  size_t entryBytes = TranslationCache::entryBytes(keys[0], translation);
+
+  // room for three entries per shard
+  TranslationCache cache(New<Options>(), TranslationCache::NUM_SHARDS * 3 * entryBytes);
+  std::string found;
+
+  for(size_t i = 0; i < 3; ++i)
+    cache.insert(keys[i], translation);
+  CHECK(cache.size() == 3);
+
+  // keys[0] is used again, so keys[1] is the least recently used one
+  CHECK(cache.lookup(keys[0], found));
+  CHECK(found == translation);
+  cache.insert(keys[3], translation);
+  CHECK(cache.size() == 3);
+  CHECK(!cache.lookup(keys[1], found));
+
+  // inserting an existing key replaces its translation and makes it the most recently used one
+  cache.insert(keys[2], "other");
+  cache.insert(keys[4], translation);
+  CHECK(cache.size() == 3);
+  CHECK(!cache.lookup(keys[0], found));
+  CHECK(cache.lookup(keys[2], found));
+  CHECK(found == "other");
+  CHECK(cache.lookup(keys[3], found));
+  CHECK(cache.lookup(keys[4], found));
+
+  // entries that do not fit into a shard are not cached
+  cache.insert(keys[1], std::string(3 * entryBytes, 'x'));
+  CHECK(!cache.lookup(keys[1], found));
+  CHECK(cache.size() == 3);
+
+  // other shards are not affected
+  TranslationCache small(New<Options>(), TranslationCache::NUM_SHARDS * entryBytes);
+  for(size_t i = 0; i < 100; ++i)
+    small.insert("key" + std::to_string(i), translation);
+  CHECK(small.size() <= TranslationCache::NUM_SHARDS);
+  CHECK(small.size() > 1);
+}
+
+TEST_CASE("Translation caches are saved and loaded for the same options", "[cache]") {
+  const std::string cachePath = "translation_cache_tests.cache";
+  const std::string modelPath = "translation_cache_tests.npz";
+  std::ofstream(modelPath) << "model";
+
+  auto createOptions = [&](size_t beamSize) {
+    auto options = New<Options>();
+    options->set("models", std::vector<std::string>({modelPath}));
+    options->set("beam-size", beamSize);
+    return options;
+  };
+
+  {
+    TranslationCache cache(createOptions(4), 1 << 20);
+    for(size_t i = 0; i < 100; ++i)
+      cache.insert("key" + std::to_string(i), "translation" + std::to_string(i));
+    cache.save(cachePath);
+  }
+
+  SECTION("matching fingerprint") {
+    TranslationCache cache(createOptions(4), 1 << 20);
+    cache.load(cachePath);
+    CHECK(cache.size() == 100);
+    std::string found;
+    for(size_t i = 0; i < 100; ++i) {
+      CHECK(cache.lookup("key" + std::to_string(i), found));
+      CHECK(found == "translation" + std::to_string(i));
+    }
+  }
+
+  SECTION("loading into a smaller cache keeps the most recently used entries") {
+    auto keys = keysOfOneShard(3);
+    size_t entryBytes = TranslationCache::entryBytes(keys[0], "translation");
+    {
+      TranslationCache cache(createOptions(4), 1 << 20);
+      for(const auto& key : keys)
+        cache.insert(key, "translation");
+      cache.save(cachePath);
+    }
+    TranslationCache cache(createOptions(4), TranslationCache::NUM_SHARDS * 2 * entryBytes);
+    cache.load(cachePath);
+    std::string found;
+    CHECK(!cache.lookup(keys[0], found));
+    CHECK(cache.lookup(keys[1], found));
+    CHECK(cache.lookup(keys[2], found));
+  }
+
+  SECTION("truncated file") {
+    std::string bytes;
+    {
+      std::ifstream in(cachePath, std::ios::binary);
+      bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(cachePath, std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() / 2);
+    TranslationCache cache(createOptions(4), 1 << 20);
+    cache.load(cachePath);
+    CHECK(cache.size() == 0);
+  }
+
+  SECTION("damaged string length") {
+    {
+      // magic, fingerprint length, fingerprint, number of entries, length of the first key
+      std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+      uint64_t fingerprintSize;
+      file.seekg(sizeof(uint64_t));
+      file.read((char*)&fingerprintSize, sizeof(fingerprintSize));
+      uint64_t damagedSize = std::numeric_limits<uint64_t>::max() / 2;
+      file.seekp(3 * sizeof(uint64_t) + fingerprintSize);
+      file.write((const char*)&damagedSize, sizeof(damagedSize));
+    }
+    TranslationCache cache(createOptions(4), 1 << 20);
+    cache.load(cachePath);
+    CHECK(cache.size() == 0);
+  }
+
+  SECTION("failing to save only logs a warning") {
+    TranslationCache cache(createOptions(4), 1 << 20);
+    cache.insert("key", "translation");
+    cache.save("translation_cache_tests.missing/cache.bin"); // the directory does not exist
+    CHECK(!std::ifstream("translation_cache_tests.missing/cache.bin"));
+  }
+
+  SECTION("different options") {
+    TranslationCache cache(createOptions(5), 1 << 20);
+    cache.load(cachePath);
+    CHECK(cache.size() == 0);
+  }
+
+  SECTION("changed model file") {
+    std::ofstream(modelPath, std::ios::app) << " retrained";
+    TranslationCache cache(createOptions(4), 1 << 20);
+    cache.load(cachePath);
+    CHECK(cache.size() == 0);
+  }
+
+  std::remove(cachePath.c_str());
+  std::remove(modelPath.c_str());
+}
@@ -1,7 +1,15 @@
 #pragma once
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
 
 #include "marian.h"
+#include "translator/greedy_search.h"
 #include "translator/history.h"
 #include "translator/scorers.h"
 #include "data/factored_vocab.h"
@@ -20,6 +28,24 @@ private:
 
   static constexpr auto INVALID_PATH_SCORE = -9999; // (@TODO: change to -9999.0 once C++ allows that)
 
+  // Logs the memory of a recorded decoding step (see MemoryPlan) whenever it exceeds the largest
+  // one logged so far for the same beam and batch size. The peak also depends on the source length.
+  static void reportStepMemory(size_t beamSize, int dimBatch, Ptr<MemoryPlan> plan) {
+    static std::mutex mutex;
+    static std::map<std::pair<size_t, int>, size_t> largestPeaks;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& largestPeak = largestPeaks[{beamSize, dimBatch}];
+    if(plan->peakBytes() <= largestPeak)
+      return;
+    largestPeak = plan->peakBytes();
+    const float MB = 1024.f * 1024.f;
+    LOG(info,
+        "[memory] Decoding step with beam size {} and batch size {}: peak {:.2f} MB, {} intermediate values "
+        "packed from {:.2f} MB into {:.2f} MB, {:.2f} MB kept for inputs and outputs",
+        beamSize, dimBatch, plan->peakBytes() / MB, plan->numPlanned(),
+        plan->plannedBytes() / MB, plan->arenaBytes() / MB, plan->keptBytes() / MB);
+  }
+
 public:
   BeamSearch(Ptr<Options> options,
              const std::vector<Ptr<Scorer>>& scorers,
@@ -31,22 +57,53 @@ public:
                       : 3),
         trgVocab_(trgVocab) {}
 
+  // --parallel-ensemble: ensemble members that run on their own graphs, see Scorer::setGraph()
+  bool hasParallelScorers() const {
+    return std::any_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> scorer) { return scorer->getGraph() != nullptr; });
+  }
+
   // combine new expandedPathScores and previous beams into new set of beams
   Beams toHyps(const std::vector<unsigned int>& nBestKeys, // [dimBatch, beamSize] flattened -> ((batchIdx, beamHypIdx) flattened, word idx) flattened
                const std::vector<float>& nBestPathScores,  // [dimBatch, beamSize] flattened
                const size_t nBestBeamSize, // for interpretation of nBestKeys
                const size_t vocabSize,     // ditto.
                const Beams& beams,
+               const std::vector<size_t>& beamWidths,     // [dimBatch] number of hyps each new beam may hold, see search()
                const std::vector<Ptr<ScorerState /*const*/>>& states,
-               Ptr<data::CorpusBatch /*const*/> batch, // for alignments only
+               const std::vector<IndexType>& batchIdxMap, // [dimBatch] maps active batch entries to their index in batch; for alignments only
                Ptr<FactoredVocab/*const*/> factoredVocab, size_t factorGroup) const {
-    std::vector<float> align;
-    if(options_->hasAndNotEmpty("alignment") && factorGroup == 0)
-      align = scorers_[0]->getAlignment(); // [beam depth * max src length * batch size] -> P(s|t); use alignments from the first scorer, even if ensemble
+    // The attention of this step is kept in the arena once, hypotheses only refer to it
+    bool align = options_->hasAndNotEmpty("alignment") && factorGroup == 0;
+    std::vector<float> attention;
+    if(align)
+      attention = scorers_[0]->getAlignment(); // [beam depth * max src length * batch size] -> P(s|t); use alignments from the first scorer, even if ensemble
+    size_t alignStep = 0;
+    HypothesisArena* alignArena = nullptr;
 
     const auto dimBatch = beams.size();
     Beams newBeams(dimBatch);   // return value of this function goes here
 
+    // Set score breakdown for n-best lists: the logits of each scorer for the words of all keys,
+    // [scorer][index in nBestKeys], are gathered at once rather than read one by one below
+    std::vector<std::vector<float>> nBestLogits(states.size());
+    if(options_->get<bool>("n-best")) {
+      for(size_t j = 0; j < states.size(); ++j) {
+        auto lvalShape = states[j]->getLogProbs().getFactoredLogitsTensor(factorGroup)->shape(); // [localBeamSize or 1, 1, dimBatch, dimFactorVocab]
+        ABORT_IF(lvalShape[-2] != (int)dimBatch || lvalShape[-1] != (int)vocabSize
+                 || (lvalShape[-4] != (int)nBestBeamSize && lvalShape[-4] != 1),
+                 "Unexpected shape of logits?? {} != {}", lvalShape, Shape({(int)nBestBeamSize, 1, (int)dimBatch, (int)vocabSize}));
+        std::vector<IndexType> flattenedLogitIndices;
+        flattenedLogitIndices.reserve(nBestKeys.size());
+        for(auto key : nBestKeys) {
+          const auto wordIdx    = key % vocabSize;
+          const auto beamHypIdx = lvalShape[-4] == 1 ? 0 : (key / vocabSize) % nBestBeamSize; // logits without beam apply to all hyps
+          const auto batchIdx   = (key / vocabSize) / nBestBeamSize;
+          flattenedLogitIndices.push_back((IndexType)((beamHypIdx * dimBatch + batchIdx) * vocabSize + wordIdx)); // (beam idx, batch idx, word idx); note: beam and batch are transposed, compared to 'key'
+        }
+        nBestLogits[j] = states[j]->getLogProbs().getFactoredLogitsValues(factorGroup, flattenedLogitIndices);
+      }
+    }
+
     for(size_t i = 0; i < nBestKeys.size(); ++i) { // [dimBatch, beamSize] flattened
       // Keys encode batchIdx, beamHypIdx, and word index in the entire beam.
       // They can be between 0 and (vocabSize * nBestBeamSize * batchSize)-1.
@@ -62,7 +119,7 @@ public:
       const auto& beam = beams[batchIdx];
       auto& newBeam = newBeams[batchIdx];
 
-      if (newBeam.size() >= beam.size()) // getNBestList() generates N for all batch entries incl. those that already have a narrower beam
+      if (newBeam.size() >= beamWidths[batchIdx]) // getNBestList() generates N for all batch entries incl. those that already have a narrower beam
         continue;
       if (pathScore <= INVALID_PATH_SCORE) // (dummy slot or word that cannot be expanded by current factor)
         continue;
@@ -96,11 +153,11 @@ public:
         }
       }
       else if (shortlist)
-        word = Word::fromWordIndex(shortlist->reverseMap(wordIdx));
+        word = Word::fromWordIndex(shortlist->reverseMap((int)batchIdx, wordIdx));
       else
         word = Word::fromWordIndex(wordIdx);
 
-      auto hyp = New<Hypothesis>(prevHyp, word, prevBeamHypIdx, pathScore);
+      auto hyp = prevHyp->getArena()->newHypothesis(prevHyp, word, prevBeamHypIdx, pathScore);
 
       // Set score breakdown for n-best lists
       if(options_->get<bool>("n-best")) {
@@ -108,23 +165,21 @@ public:
         ABORT_IF(factoredVocab && factorGroup > 0 && !factoredVocab->canExpandFactoredWord(word, factorGroup),
                  "A word without this factor snuck through to here??");
         breakDown.resize(states.size(), 0); // at start, this is empty, so this will set the initial score to 0
-        for(size_t j = 0; j < states.size(); ++j) {
-          auto lval = states[j]->getLogProbs().getFactoredLogitsTensor(factorGroup); // [localBeamSize, 1, dimBatch, dimFactorVocab]
-          size_t flattenedLogitIndex = (beamHypIdx * dimBatch + batchIdx) * vocabSize + wordIdx;  // (beam idx, batch idx, word idx); note: beam and batch are transposed, compared to 'key'
-          // @TODO: use a function on shape() to index, or new method val->at({i1, i2, i3, i4}) with broadcasting
-          ABORT_IF(lval->shape() != Shape({(int)nBestBeamSize, 1, (int)dimBatch, (int)vocabSize}) &&
-                   (beamHypIdx == 0 && lval->shape() != Shape({1, 1, (int)dimBatch, (int)vocabSize})),
-                   "Unexpected shape of logits?? {} != {}", lval->shape(), Shape({(int)nBestBeamSize, 1, (int)dimBatch, (int)vocabSize}));
-          breakDown[j] += lval->get(flattenedLogitIndex);
-        }
+        for(size_t j = 0; j < states.size(); ++j)
+          breakDown[j] += nBestLogits[j][i];
         hyp->setScoreBreakdown(breakDown);
       }
 
       // Set alignments
-      if(!align.empty())
-        hyp->setAlignment(getAlignmentsForHypothesis(align, batch, (int)beamHypIdx, (int)batchIdx));
+      if(align) {
+        if(!alignArena) { // all hypotheses of a search share an arena
+          alignArena = hyp->getArena();
+          alignStep = alignArena->addAlignmentStep(std::move(attention), dimBatch);
+        }
+        hyp->setAlignment(alignStep, beamHypIdx, batchIdx, batchIdxMap[batchIdx]);
+      }
       else // not first factor: just copy
-        hyp->setAlignment(beam[beamHypIdx]->getAlignment());
+        hyp->shareAlignment(*beam[beamHypIdx]);
 
       newBeam.push_back(hyp);
     }
@@ -143,56 +198,20 @@ public:
           //LOG(info, "Forwarded {}", factoredVocab->word2string(word));
           newBeam.push_back(beamHyp);
         }
-        if (newBeam.size() > beam.size()) {
+        const auto beamWidth = beamWidths[batchIdx];
+        if (newBeam.size() > beamWidth) {
           //LOG(info, "Size {}, sorting...", newBeam.size());
-          std::nth_element(newBeam.begin(), newBeam.begin() + beam.size(), newBeam.end(), [](Ptr<Hypothesis> a, Ptr<Hypothesis> b) {
+          std::nth_element(newBeam.begin(), newBeam.begin() + beamWidth, newBeam.end(), [](const Hypothesis* a, const Hypothesis* b) {
             return a->getPathScore() > b->getPathScore(); // (sort highest score first)
           });
           //LOG(info, "Size {}, sorted...", newBeam.size());
-          newBeam.resize(beam.size());
+          newBeam.resize(beamWidth);
         }
       }
     }
     return newBeams;
   }
 
-  std::vector<float> getAlignmentsForHypothesis( // -> P(s|t) for current t and given beam and batch dim
-      const std::vector<float> alignAll, // [beam depth, max src length, batch size, 1], flattened
-      Ptr<data::CorpusBatch> batch,
-      int beamHypIdx,
-      int batchIdx) const {
-    // Let's B be the beam size, N be the number of batched sentences,
-    // and L the number of words in the longest sentence in the batch.
-    // The alignment vector:
-    //
-    // if(first)
-    //   * has length of N x L if it's the first beam
-    //   * stores elements in the following order:
-    //     beam1 = [word1-batch1, word1-batch2, ..., word2-batch1, ...]
-    // else
-    //   * has length of N x L x B
-    //   * stores elements in the following order:
-    //     beams = [beam1, beam2, ..., beam_n]
-    //
-    // The mask vector is always of length N x L and has 1/0s stored like
-    // in a single beam, i.e.:
-    //   * [word1-batch1, word1-batch2, ..., word2-batch1, ...]
-    //
-    size_t batchSize  = batch->size();               // number of sentences in batch
-    size_t batchWidth = batch->width();              // max src length
-    size_t batchWidthXSize = batchWidth * batchSize; // total number of words in the batch incl. padding = product of last 3 tensor dimensions
-
-    // loop over words of batch entry 'batchIdx' and beam entry 'beamHypIdx'
-    std::vector<float> align;
-    for(size_t srcPos = 0; srcPos < batchWidth; ++srcPos) { // loop over source positions
-      size_t a = ((batchWidthXSize * beamHypIdx) + batchIdx) + (batchSize * srcPos); // = flatten [beam index, s, batch index, 0]
-      size_t m = a % batchWidthXSize; // == batchIdx + (batchSize * srcPos) = flatten [0, s, batch index, 0]
-      if(batch->front()->mask()[m] != 0)
-        align.emplace_back(alignAll[a]);
-    }
-    return align;
-  }
-
   // remove all beam entries that have reached EOS
   Beams purgeBeams(const Beams& beams) {
     const auto trgEosId = trgVocab_->getEosId();
@@ -209,9 +228,116 @@ public:
     return newBeams;
   }
 
+  // Create a History and a beam with the sentence-start hypothesis for each entry of 'batch'.
+  // Entries that consist only of source <EOS>, i.e. empty lines, are finished right away and get
+  // an empty beam.
+  Beams startBeams(Ptr<data::CorpusBatch> batch, Ptr<HypothesisArena> arena, Histories& histories) const {
+    const auto trgEosId = trgVocab_->getEosId();
+    const auto srcEosId = batch->front()->vocab()->getEosId();
+
+    // create one beam per batch entry with sentence-start hypothesis
+    Beams beams(batch->size(), Beam(beamSize_, arena->newHypothesis())); // array [dimBatch] of array [localBeamSize] of Hypothesis
+    if(options_->hasAndNotEmpty("alignment"))
+      arena->setSourceMask(batch->front()->mask(), batch->size());
+    for(size_t batchIdx = 0; batchIdx < batch->size(); ++batchIdx) {
+      auto history = New<History>(batch->getSentenceIds()[batchIdx], arena,
+                                  options_->get<float>("normalize"),
+                                  options_->get<float>("word-penalty"));
+      histories.push_back(history);
+
+      auto& beam = beams[batchIdx];
+      history->add(beam, trgEosId); // add beams with start-hypotheses to traceback grid
+
+      // Handle batch entries that consist only of source <EOS> i.e. these are empty lines
+      if(batch->front()->data()[batchIdx] == srcEosId) {
+        // create a target <EOS> hypothesis that extends the start-hypothesis
+        auto eosHyp = arena->newHypothesis(/*prevHyp=*/    beam[0],
+                                           /*currWord=*/   trgEosId,
+                                           /*prevHypIdx=*/ 0,
+                                           /*pathScore=*/  0.f);
+        auto eosBeam = Beam(beamSize_, eosHyp); // create a dummy beam filled with <EOS>-hyps
+        history->add(eosBeam, trgEosId);        // push dummy <EOS>-beam to traceback grid
+        beam.clear(); // zero out current beam, so it does not get used for further symbols as empty beams get omitted/dummy-filled everywhere
+      }
+    }
+    return beams;
+  }
+
+  // Whether new sentences can join a running search (searchContinuous()). Their first step is
+  // computed separately and its states are merged into those of the running search, which
+  // requires that the states of sentences at different positions can be merged, see
+  // Scorer::statesAreMergeable().
+  bool supportsContinuousBatching() const {
+    auto factoredVocab = trgVocab_->tryAs<FactoredVocab>();
+    return (!factoredVocab || factoredVocab->getNumGroups() == 1)
+           && !options_->hasAndNotEmpty("alignment") && !options_->hasAndNotEmpty("shortlist")
+           && !hasParallelScorers()
+           && std::all_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> scorer) { return scorer->statesAreMergeable(); });
+  }
+
+  typedef std::function<Ptr<data::CorpusBatch>()> BatchFeed;   // next batch to translate; nullptr at the end of the input
+  typedef std::function<void(Ptr<History>)> FinishedCallback; // receives the history of each finished sentence
+
+  // Continuous batching: translate all batches from 'feed'. Whenever sentences finish, new batches
+  // are admitted into the running search as long as no more than --continuous-batching sentences
+  // are decoded together. Histories are passed to onFinished as soon as their sentence is done.
+  void searchContinuous(Ptr<ExpressionGraph> graph, const BatchFeed& feed, const FinishedCallback& onFinished) {
+    ABORT_IF(!supportsContinuousBatching(), "Continuous batching is not supported for this model and these options");
+    // search() returns without admitting anything if the first batch consists of empty lines only
+    while(auto batch = feed())
+      for(auto history : search(graph, batch, feed, onFinished))
+        if(history)
+          onFinished(history);
+  }
+
+  // Remove beam entries whose path score is too far below that of the best entry in their beam:
+  // more than --beam-threshold-absolute, or a probability below --beam-threshold-relative times
+  // that of the best entry. The best entry always survives.
+  Beams pruneBeams(const Beams& beams) const {
+    return pruneBeams(beams,
+                      options_->get<float>("beam-threshold-absolute", 0.f),
+                      options_->get<float>("beam-threshold-relative", 0.f));
+  }
+
+  // as above; thresholds of 0 disable the respective pruning
+  static Beams pruneBeams(const Beams& beams, float absoluteThreshold, float relativeThreshold) {
+    float maxDistance = std::numeric_limits<float>::infinity();
+    if(absoluteThreshold > 0)
+      maxDistance = absoluteThreshold;
+    if(relativeThreshold > 0)
+      maxDistance = std::min(maxDistance, -std::log(relativeThreshold));
+    if(maxDistance == std::numeric_limits<float>::infinity())
+      return beams;
+
+    Beams newBeams;
+    for(const auto& beam : beams) {
+      float bestPathScore = std::numeric_limits<float>::lowest();
+      for(auto hyp : beam)
+        bestPathScore = std::max(bestPathScore, hyp->getPathScore());
+      Beam newBeam;
+      for(auto hyp : beam)
+        if(hyp->getPathScore() >= bestPathScore - maxDistance)
+          newBeam.push_back(hyp);
+      newBeams.push_back(newBeam);
+    }
+    return newBeams;
+  }
+
   //**********************************************************************
   // main decoding function
   Histories search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+    if(beamSize_ == 1 && GreedySearch::supports(options_, trgVocab_) && !hasParallelScorers()) // no need for beams
+      return GreedySearch(options_, scorers_, trgVocab_).search(graph, batch);
+    return search(graph, batch, /*feed=*/nullptr, /*onFinished=*/nullptr);
+  }
+
+  // If 'feed' is given, new batches from it join the search whenever sentences finish, see
+  // searchContinuous(). Finished histories are then passed to onFinished and set to nullptr in
+  // the return value.
+  Histories search(Ptr<ExpressionGraph> graph,
+                   Ptr<data::CorpusBatch> batch,
+                   const BatchFeed& feed,
+                   const FinishedCallback& onFinished) {
     auto factoredVocab = trgVocab_->tryAs<FactoredVocab>();
 #if 0   // use '1' here to disable factored decoding, e.g. for comparisons
     factoredVocab.reset();
@@ -219,51 +345,43 @@ public:
     size_t numFactorGroups = factoredVocab ? factoredVocab->getNumGroups() : 1;
     if (numFactorGroups == 1) // if no factors then we didn't need this object in the first place
       factoredVocab.reset();
+    ABORT_IF(factoredVocab && hasParallelScorers(), "--parallel-ensemble is not supported for factored vocabularies");
 
-    const int dimBatch = (int)batch->size();
+    const int origDimBatch = (int)batch->size();
+    int dimBatch = origDimBatch; // number of batch entries that are still being decoded
     const auto trgEosId = trgVocab_->getEosId();
     const auto trgUnkId = trgVocab_->getUnkId();
 
-    auto getNBestList = createGetNBestListFn(beamSize_, dimBatch, graph->getDeviceId());
+    // maximum number of sentences decoded together
+    size_t maxDimBatch = feed ? std::max(options_->get<size_t>("continuous-batching"), (size_t)origDimBatch) : origDimBatch;
+    auto getNBestList = createGetNBestListFn(beamSize_, maxDimBatch, graph->getDeviceId());
 
     for(auto scorer : scorers_) {
-      scorer->clear(graph);
+      scorer->clear(scorer->getGraph() ? scorer->getGraph() : graph);
     }
 
-    Histories histories(dimBatch);
-    for(int i = 0; i < dimBatch; ++i) {
-      size_t sentId = batch->getSentenceIds()[i];
-      histories[i] = New<History>(sentId,
-                                  options_->get<float>("normalize"),
-                                  options_->get<float>("word-penalty"));
-    }
+    // all hypotheses of this batch; released when the last of its histories is gone
+    auto arena = New<HypothesisArena>();
+
+    Histories histories; // [index of sentence in the order of admission]
+    auto beams = startBeams(batch, arena, histories); // array [dimBatch] of array [localBeamSize] of Hypothesis
+    std::vector<float> maxLengths(origDimBatch, options_->get<float>("max-length-factor") * batch->front()->batchWidth());
 
     // start states
     std::vector<Ptr<ScorerState>> states;
     for(auto scorer : scorers_) {
-      states.push_back(scorer->startState(graph, batch));
+      states.push_back(scorer->startState(scorer->getGraph() ? scorer->getGraph() : graph, batch));
     }
 
-    // create one beam per batch entry with sentence-start hypothesis
-    Beams beams(dimBatch, Beam(beamSize_, New<Hypothesis>())); // array [dimBatch] of array [localBeamSize] of Hypothesis
-
-    const auto srcEosId = batch->front()->vocab()->getEosId();
-    for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
-      auto& beam = beams[batchIdx];
-      histories[batchIdx]->add(beam, trgEosId); // add beams with start-hypotheses to traceback grid
-
-      // Handle batch entries that consist only of source <EOS> i.e. these are empty lines
-      if(batch->front()->data()[batchIdx] == srcEosId) {
-        // create a target <EOS> hypothesis that extends the start-hypothesis
-        auto eosHyp = New<Hypothesis>(/*prevHyp=*/    beam[0], 
-                                      /*currWord=*/   trgEosId, 
-                                      /*prevHypIdx=*/ 0, 
-                                      /*pathScore=*/  0.f);
-        auto eosBeam = Beam(beamSize_, eosHyp);      // create a dummy beam filled with <EOS>-hyps
-        histories[batchIdx]->add(eosBeam, trgEosId); // push dummy <EOS>-beam to traceback grid
-        beam.clear(); // zero out current beam, so it does not get used for further symbols as empty beams get omitted/dummy-filled everywhere
-      }
-    }
+    // Batch entries whose beams are empty are dropped from the search space and the scorer
+    // states. The following keep track of which entries are left.
+    std::vector<IndexType> batchIdxMap(dimBatch); // [dimBatch] index in histories of each active batch entry; also in batch unless continuous
+    std::iota(batchIdxMap.begin(), batchIdxMap.end(), 0);
+    std::vector<size_t> beamWidths(dimBatch);     // [dimBatch] N-best size of each active batch entry, see addToHistories
+    for(int i = 0; i < dimBatch; ++i)
+      beamWidths[i] = beams[i].size();
+    std::vector<IndexType> batchIndices;          // [dimBatch] index in the scorer states of each active batch entry; empty if nothing was dropped
+    int prevDimBatch = dimBatch;                  // number of batch entries in the scorer states
 
     // determine index of UNK in the log prob vectors if we want to suppress it in the decoding process
     int unkColId = -1;
@@ -274,6 +392,119 @@ public:
             unkColId = shortlist->tryForwardMap(unkColId); // use shifted postion of unk in case of using a shortlist, shortlist may have removed unk which results in -1
     }
 
+    // With --replay-steps, the graph of a decoding step is recorded once and replayed for the following
+    // steps as long as beam and batch size do not change. Only the named constants for hypothesis
+    // indices, words and path scores are overwritten, and the new decoder states are copied back
+    // into the tensors that the recorded step reads its previous states from.
+    bool replaySteps = options_->get<bool>("replay-steps", false)
+                       && !factoredVocab && !options_->hasAndNotEmpty("alignment") && !hasParallelScorers()
+                       && std::all_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> scorer) { return scorer->stepsAreReplayable(); });
+    Ptr<GraphTrace> trace;                        // recorded step, valid for traceBeamSize and traceDimBatch
+    size_t traceBeamSize = 0;
+    int traceDimBatch = 0;
+    std::vector<std::pair<Expr, Expr>> traceStates; // (state read by the recorded step, state written by it)
+    Expr tracePathScores;                         // expandedPathScores of the recorded step
+
+    // With --beam-early-stop, a batch entry is finished as soon as none of its active hyps can
+    // beat its best sentence hypothesis anymore. The bound assumes that path scores never increase,
+    // which does not hold for sampling or negative scorer weights. N-best lists would change.
+    bool earlyStop = options_->get<bool>("beam-early-stop", false)
+                     && !options_->get<bool>("n-best") && !options_->get<bool>("output-sampling", false)
+                     && std::all_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> scorer) { return scorer->getWeight() >= 0; });
+
+    // Prune the beams of active batch entries, add them to the traceback grids of their histories,
+    // and return them without the hyps that end in EOS; the position of a hyp in the beam may change.
+    // Entries that reach the maximum length or stop early are finished and get an empty beam.
+    // 'widths' receives the number of hyps each beam would have kept without threshold pruning,
+    // so that pruning at one step does not reduce the N-best size of all following steps.
+    auto addToHistories = [&](const Beams& newBeams, const std::vector<IndexType>& histIdxMap, std::vector<size_t>& widths) -> Beams {
+      auto beams = pruneBeams(newBeams);
+      auto purgedBeams = purgeBeams(beams);
+      widths.resize(beams.size());
+      for(size_t i = 0; i < beams.size(); ++i)
+        widths[i] = std::count_if(newBeams[i].begin(), newBeams[i].end(), [&](const Hypothesis* hyp) { return hyp->getWord() != trgEosId; });
+      for(size_t i = 0; i < beams.size(); ++i) {
+        // if this batch entry has surviving hyps then add them to the traceback grid
+        if(!beams[i].empty()) {
+          auto histIdx = histIdxMap[i];
+          auto& history = histories[histIdx];
+          bool maxLengthReached = history->size() >= maxLengths[histIdx];
+          history->add(beams[i], trgEosId, purgedBeams[i].empty() || maxLengthReached);
+          if(maxLengthReached)
+            purgedBeams[i].clear();
+          else if(earlyStop && !purgedBeams[i].empty()) {
+            float bestPathScore = std::numeric_limits<float>::lowest();
+            for(auto hyp : purgedBeams[i])
+              bestPathScore = std::max(bestPathScore, hyp->getPathScore());
+            auto maxLength = (size_t)std::ceil(maxLengths[histIdx]);
+            if(history->bestNormalizedScore() > history->normalizedScoreBound(bestPathScore, maxLength))
+              purgedBeams[i].clear();
+          }
+        }
+        if(purgedBeams[i].empty())
+          widths[i] = 0;
+      }
+      return purgedBeams;
+    };
+
+    // Continuous batching: compute the first step for the sentences of newBatch separately and
+    // append them to the search space and the scorer states. Returns the number of admitted
+    // sentences that are not finished yet.
+    const size_t maxActive = feed ? options_->get<size_t>("continuous-batching") : 0;
+    Ptr<data::CorpusBatch> pending; // next batch from feed that waits for admission
+    auto admit = [&](Ptr<data::CorpusBatch> newBatch) -> size_t {
+      const int newDimBatch = (int)newBatch->size();
+      if(newDimBatch > (int)maxDimBatch) {
+        maxDimBatch = newDimBatch;
+        getNBestList = createGetNBestListFn(beamSize_, maxDimBatch, graph->getDeviceId());
+      }
+
+      std::vector<IndexType> newHistIdxMap(newDimBatch); // index in histories of each new batch entry
+      std::iota(newHistIdxMap.begin(), newHistIdxMap.end(), (IndexType)histories.size());
+      std::vector<IndexType> newBatchIdxMap(newDimBatch);
+      std::iota(newBatchIdxMap.begin(), newBatchIdxMap.end(), 0);
+
+      // each batch gets its own arena, so that its hypotheses are released with its histories
+      auto newBeams = startBeams(newBatch, New<HypothesisArena>(), histories);
+      maxLengths.resize(histories.size(), options_->get<float>("max-length-factor") * newBatch->front()->batchWidth());
+
+      std::vector<Ptr<ScorerState>> newStates;
+      auto expandedPathScores = graph->constant({1, 1, 1, 1}, inits::from_value(0));
+      for(size_t i = 0; i < scorers_.size(); ++i) {
+        auto startState = scorers_[i]->startState(graph, newBatch);
+        newStates.push_back(scorers_[i]->step(graph, startState, {}, {}, {}, newDimBatch, 1));
+        expandedPathScores = expandedPathScores + scorers_[i]->getWeight() * newStates[i]->getLogProbs().getLogits();
+      }
+      expandedPathScores = swapAxes(expandedPathScores, 0, 2); // -> [newDimBatch, 1, 1, dimVocab]
+      graph->forwardNext();
+
+      if(unkColId != -1)
+        suppressWord(expandedPathScores, unkColId);
+
+      std::vector<unsigned int> nBestKeys;
+      std::vector<float> nBestPathScores;
+      getNBestList(expandedPathScores->val(), beamSize_, nBestPathScores, nBestKeys, /*first=*/true);
+      std::vector<size_t> newBeamWidths(newDimBatch);
+      for(int i = 0; i < newDimBatch; ++i)
+        newBeamWidths[i] = newBeams[i].size();
+      newBeams = toHyps(nBestKeys, nBestPathScores,
+                        /*nBestBeamSize=*/1, /*vocabSize=*/expandedPathScores->shape()[-1],
+                        newBeams, newBeamWidths, newStates, newBatchIdxMap,
+                        /*factoredVocab=*/nullptr, /*factorGroup=*/0);
+      newBeams = addToHistories(newBeams, newHistIdxMap, newBeamWidths);
+
+      for(size_t i = 0; i < scorers_.size(); ++i)
+        states[i] = states[i]->merge(newStates[i]);
+      beams.insert(beams.end(), newBeams.begin(), newBeams.end());
+      beamWidths.insert(beamWidths.end(), newBeamWidths.begin(), newBeamWidths.end());
+      batchIdxMap.insert(batchIdxMap.end(), newHistIdxMap.begin(), newHistIdxMap.end());
+      dimBatch     += newDimBatch;
+      prevDimBatch += newDimBatch;
+      trace = nullptr;
+
+      return std::count_if(newBeams.begin(), newBeams.end(), [](const Beam& beam) { return !beam.empty(); });
+    };
+
     // the decoding process updates the following state information in each output time step:
     //  - beams: array [dimBatch] of array [localBeamSize] of Hypothesis
     //     - current output time step's set of active hypotheses, aka active search space
@@ -286,15 +517,16 @@ public:
 
     // main loop over output time steps
     for (size_t t = 0; ; t++) {
-      ABORT_IF(dimBatch != beams.size(), "Lost a batch entry??");
+      ABORT_IF(dimBatch != beams.size() || dimBatch != batchIdxMap.size() || dimBatch != beamWidths.size(), "Lost a batch entry??");
 
       // determine beam size for next output time step, as max over still-active sentences
       // E.g. if all batch entries are down from beam 5 to no more than 4 surviving hyps, then
       // switch to beam of 4 for all. If all are done, then beam ends up being 0, and we are done.
+      // Hyps removed by the beam thresholds do not count here; their places are padded.
       size_t localBeamSize = 0; // @TODO: is there some std::algorithm for this?
-      for(auto& beam : beams)
-        if(beam.size() > localBeamSize)
-          localBeamSize = beam.size();
+      for(auto width : beamWidths)
+        if(width > localBeamSize)
+          localBeamSize = width;
 
       // done if all batch entries have reached EOS on all beam entries
       if (localBeamSize == 0)
@@ -308,13 +540,17 @@ public:
         // Also create mapping of hyp indices, for reordering the decoder-state tensors.
         std::vector<IndexType> hypIndices; // [localBeamsize, 1, dimBatch, 1] (flattened) tensor index ((beamHypIdx, batchIdx), flattened) of prev hyp that a hyp originated from
         std::vector<Word> prevWords;       // [localBeamsize, 1, dimBatch, 1] (flattened) word that a hyp ended in, for advancing the decoder-model's history
+        std::vector<float> prevScores;     // [localBeamSize, 1, dimBatch, 1] (flattened) path score that a hyp ended in
         Expr prevPathScores;               // [localBeamSize, 1, dimBatch, 1], path score that a hyp ended in (last axis will broadcast into vocab size when adding expandedPathScores)
         bool anyCanExpand = false; // stays false if all hyps are invalid factor expansions
         if(t == 0 && factorGroup == 0) { // no scores yet
           prevPathScores = graph->constant({1, 1, 1, 1}, inits::from_value(0));
           anyCanExpand = true;
         } else {
-          std::vector<float> prevScores;
+          // Scorer states still have the layout of the previous step at the first factor. If batch entries
+          // were dropped since, hypIndices have to point to their positions in that layout.
+          bool remapBatch = factorGroup == 0 && !batchIndices.empty();
+          int stateDimBatch = factorGroup == 0 ? prevDimBatch : dimBatch;
           for(size_t beamHypIdx = 0; beamHypIdx < localBeamSize; ++beamHypIdx) {
             for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) { // loop over batch entries (active sentences)
               auto& beam = beams[batchIdx];
@@ -324,7 +560,8 @@ public:
                 auto canExpand = (!factoredVocab || factoredVocab->canExpandFactoredWord(hyp->getWord(), factorGroup));
                 //LOG(info, "[{}, {}] Can expand {} with {} -> {}", batchIdx, beamHypIdx, (*batch->back()->vocab())[hyp->getWord()], factorGroup, canExpand);
                 anyCanExpand |= canExpand;
-                hypIndices.push_back((IndexType)(hyp->getPrevStateIndex() * dimBatch + batchIdx)); // (beamHypIdx, batchIdx), flattened, for index_select() operation
+                auto stateBatchIdx = remapBatch ? batchIndices[batchIdx] : (IndexType)batchIdx;
+                hypIndices.push_back((IndexType)(hyp->getPrevStateIndex() * stateDimBatch + stateBatchIdx)); // (beamHypIdx, batchIdx), flattened, for index_select() operation
                 prevWords .push_back(word);
                 prevScores.push_back(canExpand ? hyp->getPathScore() : INVALID_PATH_SCORE);
               } else {  // pad to localBeamSize (dummy hypothesis)
@@ -334,66 +571,164 @@ public:
               }
             }
           }
-          prevPathScores = graph->constant({(int)localBeamSize, 1, dimBatch, 1}, inits::from_vector(prevScores));
         }
         if (!anyCanExpand) // all words cannot expand this factor: skip
           continue;
 
-        //**********************************************************************
-        // compute expanded path scores with word prediction probs from all scorers
-        auto expandedPathScores = prevPathScores; // will become [localBeamSize, 1, dimBatch, dimVocab]
-        Expr logProbs;
-        for(size_t i = 0; i < scorers_.size(); ++i) {
-          if (factorGroup == 0) {
-            // compute output probabilities for current output time step
-            //  - uses hypIndices[index in beam, 1, batch index, 1] to reorder scorer state to reflect the top-N in beams[][]
-            //  - adds prevWords [index in beam, 1, batch index, 1] to the scorer's target history
-            //  - performs one step of the scorer
-            //  - returns new NN state for use in next output time step
-            //  - returns vector of prediction probabilities over output vocab via newState
-            // update state in-place for next output time step
-            //if (t > 0) for (size_t kk = 0; kk < prevWords.size(); kk++)
-            //  LOG(info, "prevWords[{},{}]={} -> {}", t/numFactorGroups, factorGroup,
-            //      factoredVocab ? factoredVocab->word2string(prevWords[kk]) : (*batch->back()->vocab())[prevWords[kk]],
-            //      prevScores[kk]);
-            states[i] = scorers_[i]->step(graph, states[i], hypIndices, prevWords, dimBatch, (int)localBeamSize);
-            if (numFactorGroups == 1) // @TODO: this branch can go away
-              logProbs = states[i]->getLogProbs().getLogits(); // [localBeamSize, 1, dimBatch, dimVocab]
-            else
-            {
-              auto shortlist = scorers_[i]->getShortlist();
-              logProbs = states[i]->getLogProbs().getFactoredLogits(factorGroup, shortlist); // [localBeamSize, 1, dimBatch, dimVocab]
+        // a recorded step can only be replayed with the shapes it was recorded with
+        bool replay = trace && localBeamSize == traceBeamSize && dimBatch == traceDimBatch && batchIndices.empty();
+        if(trace && !replay) // beam and batch only shrink, so the recorded step is no longer needed
+          trace = nullptr;
+        bool record = replaySteps && !trace && t > 0 && batchIndices.empty();
+
+        Expr expandedPathScores; // will become [localBeamSize, 1, dimBatch, dimVocab]
+        if(replay) {
+          trace->setInput("step:hypIndices", hypIndices);
+          trace->setInput("step:words", toWordIndexVector(prevWords));
+          trace->setInput("step:pathScores", prevScores);
+          graph->replay(trace);
+          expandedPathScores = tracePathScores;
+        } else {
+          if(!(t == 0 && factorGroup == 0)) {
+            prevPathScores = graph->constant({(int)localBeamSize, 1, dimBatch, 1}, inits::from_vector(prevScores));
+            prevPathScores->set_name("step:pathScores");
+          }
+
+          if(record)
+            graph->startTrace();
+
+          //**********************************************************************
+          // compute expanded path scores with word prediction probs from all scorers
+          expandedPathScores = prevPathScores;
+          std::vector<Ptr<ScorerState>> prevStates = states;
+          Expr logProbs;
+          auto memberSteps = New<std::vector<std::future<void>>>(); // steps of ensemble members on their own graphs
+          auto memberLogProbs = New<std::vector<Expr>>(scorers_.size());
+          for(size_t i = 0; i < scorers_.size(); ++i) {
+            if (auto memberGraph = scorers_[i]->getGraph()) { // --parallel-ensemble, no factors
+              memberSteps->push_back(scorers_[i]->getThread()->enqueue([&, i, memberGraph]() {
+                states[i] = scorers_[i]->step(memberGraph, states[i], hypIndices, batchIndices, prevWords, dimBatch, (int)localBeamSize);
+                (*memberLogProbs)[i] = states[i]->getLogProbs().getLogits(); // [localBeamSize, 1, dimBatch, dimVocab]
+                if(t == 0)
+                  memberGraph->forward();
+                else
+                  memberGraph->forwardNext();
+              }));
+              continue;
+            }
+            if (factorGroup == 0) {
+              // compute output probabilities for current output time step
+              //  - uses hypIndices[index in beam, 1, batch index, 1] to reorder scorer state to reflect the top-N in beams[][]
+              //  - adds prevWords [index in beam, 1, batch index, 1] to the scorer's target history
+              //  - performs one step of the scorer
+              //  - returns new NN state for use in next output time step
+              //  - returns vector of prediction probabilities over output vocab via newState
+              // update state in-place for next output time step
+              //if (t > 0) for (size_t kk = 0; kk < prevWords.size(); kk++)
+              //  LOG(info, "prevWords[{},{}]={} -> {}", t/numFactorGroups, factorGroup,
+              //      factoredVocab ? factoredVocab->word2string(prevWords[kk]) : (*batch->back()->vocab())[prevWords[kk]],
+              //      prevScores[kk]);
+              states[i] = scorers_[i]->step(graph, states[i], hypIndices, batchIndices, prevWords, dimBatch, (int)localBeamSize);
+              if (numFactorGroups == 1) // @TODO: this branch can go away
+                logProbs = states[i]->getLogProbs().getLogits(); // [localBeamSize, 1, dimBatch, dimVocab]
+              else
+              {
+                auto shortlist = scorers_[i]->getShortlist();
+                logProbs = states[i]->getLogProbs().getFactoredLogits(factorGroup, shortlist); // [localBeamSize, 1, dimBatch, dimVocab]
+              }
+              //logProbs->debug("logProbs");
+            }
+            else {
+              // add secondary factors
+              // For those, we don't update the decoder-model state in any way.
+              // Instead, we just keep expanding with the factors.
+              // We will have temporary Word entries in hyps with some factors set to FACTOR_NOT_SPECIFIED.
+              // For some lemmas, a factor is not applicable. For those, the factor score is the same (zero)
+              // for all factor values. This would thus unnecessarily pollute the beam with identical copies,
+              // and push out other hypotheses. Hence, we exclude those here by setting the path score to
+              // INVALID_PATH_SCORE. Instead, toHyps() explicitly propagates those hyps by simply copying the
+              // previous hypothesis.
+              logProbs = states[i]->getLogProbs().getFactoredLogits(factorGroup, /*shortlist=*/ nullptr, hypIndices, localBeamSize); // [localBeamSize, 1, dimBatch, dimVocab]
             }
-            //logProbs->debug("logProbs");
+            // expand all hypotheses, [localBeamSize, 1, dimBatch, 1] -> [localBeamSize, 1, dimBatch, dimVocab]
+            expandedPathScores = expandedPathScores + scorers_[i]->getWeight() * logProbs;
           }
-          else {
-            // add secondary factors
-            // For those, we don't update the decoder-model state in any way.
-            // Instead, we just keep expanding with the factors.
-            // We will have temporary Word entries in hyps with some factors set to FACTOR_NOT_SPECIFIED.
-            // For some lemmas, a factor is not applicable. For those, the factor score is the same (zero)
-            // for all factor values. This would thus unnecessarily pollute the beam with identical copies,
-            // and push out other hypotheses. Hence, we exclude those here by setting the path score to
-            // INVALID_PATH_SCORE. Instead, toHyps() explicitly propagates those hyps by simply copying the
-            // previous hypothesis.
-            logProbs = states[i]->getLogProbs().getFactoredLogits(factorGroup, /*shortlist=*/ nullptr, hypIndices, localBeamSize); // [localBeamSize, 1, dimBatch, dimVocab]
+
+          // Weighted sum of the log probs of the ensemble members, in one pass. This constant is
+          // only initialized during the forward step below after the nodes of the first scorer
+          // have been computed, so that the members run concurrently with those.
+          if(!memberSteps->empty()) {
+            auto memberScores = graph->constant(logProbs->shape(), [=](Tensor out) {
+              for(auto& memberStep : *memberSteps)
+                memberStep.get();
+              std::vector<const float*> members;
+              std::vector<float> weights;
+              for(size_t i = 0; i < scorers_.size(); ++i) {
+                if(auto memberLogProb = (*memberLogProbs)[i]) {
+                  ABORT_IF(memberLogProb->shape() != out->shape(), "Ensemble members have different output shapes");
+                  members.push_back(memberLogProb->val()->data());
+                  weights.push_back(scorers_[i]->getWeight());
+                }
+              }
+              float* sum = out->data();
+              for(size_t k = 0; k < out->size(); ++k) {
+                float score = 0.f;
+                for(size_t j = 0; j < members.size(); ++j)
+                  score += weights[j] * members[j][k];
+                sum[k] = score;
+              }
+            });
+            expandedPathScores = expandedPathScores + memberScores;
           }
-          // expand all hypotheses, [localBeamSize, 1, dimBatch, 1] -> [localBeamSize, 1, dimBatch, dimVocab]
-          expandedPathScores = expandedPathScores + scorers_[i]->getWeight() * logProbs;
-        }
 
-        // make beams continuous
-        expandedPathScores = swapAxes(expandedPathScores, 0, 2); // -> [dimBatch, 1, localBeamSize, dimVocab]
+          // make beams continuous
+          expandedPathScores = swapAxes(expandedPathScores, 0, 2); // -> [dimBatch, 1, localBeamSize, dimVocab]
+
+          // perform NN computation
+          if(t == 0 && factorGroup == 0)
+            graph->forward();
+          else
+            graph->forwardNext();
+
+          if(record) {
+            trace = graph->stopTrace();
+            traceBeamSize = localBeamSize;
+            traceDimBatch = dimBatch;
+            tracePathScores = expandedPathScores;
+            traceStates.clear();
+            for(size_t i = 0; i < scorers_.size() && trace; ++i) {
+              auto prevExprs = prevStates[i]->getStateExprs();
+              auto nextExprs = states[i]->getStateExprs();
+              if(prevExprs.empty() || prevExprs.size() != nextExprs.size())
+                trace = nullptr;
+              for(size_t j = 0; j < prevExprs.size() && trace; ++j) {
+                // prev states must have the shape of the next ones and may not be shared (e.g. start states)
+                bool shared = std::any_of(traceStates.begin(), traceStates.end(),
+                                          [&](const std::pair<Expr, Expr>& s) { return s.first == prevExprs[j]; });
+                if(shared || prevExprs[j]->shape() != nextExprs[j]->shape())
+                  trace = nullptr;
+                else
+                  traceStates.push_back({prevExprs[j], nextExprs[j]});
+              }
+            }
+            if(trace)
+              reportStepMemory(localBeamSize, dimBatch, trace->planMemory(graph->allocator()));
+          }
+        } // END IF replay
 
-        // perform NN computation
-        if(t == 0 && factorGroup == 0)
-          graph->forward();
-        else
-          graph->forwardNext();
+        // feed the new states back to where the recorded step reads them from
+        if(trace)
+          for(auto& s : traceStates)
+            s.first->val()->copyFrom(s.second->val());
 
         //**********************************************************************
         // suppress specific symbols if not at right positions
 
+        if(factorGroup == 0) { // scorer states now have the layout of the active batch entries
+          batchIndices.clear();
+          prevDimBatch = dimBatch;
+        }
+
         if(unkColId != -1 && factorGroup == 0)
           suppressWord(expandedPathScores, unkColId);
         for(auto state : states)
@@ -417,30 +752,53 @@ public:
                       /*nBestBeamSize*/expandedPathScores->shape()[-2], // used for interpretation of keys
                       /*vocabSize=*/expandedPathScores->shape()[-1],    // used for interpretation of keys
                       beams,
+                      beamWidths, // N-best size of each batch entry, which threshold pruning does not reduce
                       states,    // used for keeping track of per-ensemble-member path score
-                      batch,     // only used for propagating alignment info
+                      batchIdxMap, // only used for propagating alignment info
                       factoredVocab, factorGroup);
       } // END FOR factorGroup = 0 .. numFactorGroups-1
 
-      // remove all hyps that end in EOS
-      // The position of a hyp in the beam may change.
-      const auto purgedNewBeams = purgeBeams(beams);
-
       // add updated search space (beams) to our return value
-      bool maxLengthReached = false;
-      for(int i = 0; i < dimBatch; ++i) {
-        // if this batch entry has surviving hyps then add them to the traceback grid
-        if(!beams[i].empty()) {
-          if (histories[i]->size() >= options_->get<float>("max-length-factor") * batch->front()->batchWidth())
-            maxLengthReached = true;
-          histories[i]->add(beams[i], trgEosId, purgedNewBeams[i].empty() || maxLengthReached);
+      // this is the search space for the next output time step
+      beams = addToHistories(beams, batchIdxMap, beamWidths);
+
+      // Continuous batching: fill up the batch with new sentences as long as there is room
+      bool admitted = false;
+      if(feed) {
+        size_t numActive = std::count_if(beams.begin(), beams.end(), [](const Beam& beam) { return !beam.empty(); });
+        if(!pending)
+          pending = feed();
+        while(pending && (numActive == 0 || numActive + pending->size() <= maxActive)) {
+          numActive += admit(pending);
+          admitted = true;
+          pending = feed();
         }
       }
-      if (maxLengthReached) // early exit if max length limit was reached
-        break;
 
-      // this is the search space for the next output time step
-      beams = purgedNewBeams;
+      // Drop batch entries that are done, so that they no longer run through the decoder.
+      // Their states are removed by the scorers at the next step via batchIndices. After
+      // admission, this also keeps the merged states out of a recorded step.
+      if(admitted || std::any_of(beams.begin(), beams.end(), [](const Beam& beam) { return beam.empty(); })) {
+        Beams activeBeams;
+        std::vector<IndexType> activeBatchIdxMap;
+        std::vector<size_t> activeBeamWidths;
+        for(int i = 0; i < dimBatch; ++i) {
+          if(!beams[i].empty()) {
+            batchIndices.push_back((IndexType)i);
+            activeBeams.push_back(beams[i]);
+            activeBatchIdxMap.push_back(batchIdxMap[i]);
+            activeBeamWidths.push_back(beamWidths[i]);
+          }
+          else if(onFinished) { // continuous batching: pass on finished sentences right away
+            onFinished(histories[batchIdxMap[i]]);
+            histories[batchIdxMap[i]] = nullptr;
+          }
+        }
+        beams       = activeBeams;
+        batchIdxMap = activeBatchIdxMap;
+        beamWidths  = activeBeamWidths;
+        dimBatch    = (int)beams.size();
+      }
     } // end of main loop over output time steps
 
     return histories; // [dimBatch][t][N best hyps]
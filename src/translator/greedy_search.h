@@ -0,0 +1,173 @@
+#pragma once
+#include <numeric>
+
+#include "marian.h"
+#include "translator/history.h"
+#include "translator/scorers.h"
+#include "data/factored_vocab.h"
+
+#include "translator/helpers.h"
+#include "translator/nth_element.h"
+
+namespace marian {
+
+// Beam search with beam size 1 without the beam machinery: the best word of each batch entry is
+// taken directly from the (summed) logits, decoder states are only reordered when finished batch
+// entries are dropped, and output words are collected in a buffer per sentence. Hypotheses and
+// histories are only created at the end, for the output.
+class GreedySearch {
+private:
+  Ptr<Options> options_;
+  std::vector<Ptr<Scorer>> scorers_;
+  Ptr<Vocab> trgVocab_;
+
+  // output of one batch entry
+  struct Sentence {
+    Words words;
+    std::vector<float> pathScores;     // [t] path score after each word
+    std::vector<float> scoreBreakdown; // [num scorers] summed logits of each scorer; with --n-best only
+  };
+
+public:
+  GreedySearch(Ptr<Options> options,
+               const std::vector<Ptr<Scorer>>& scorers,
+               Ptr<Vocab> trgVocab)
+      : options_(options), scorers_(scorers), trgVocab_(trgVocab) {}
+
+  // factored vocabularies and alignments need the full beam search
+  static bool supports(Ptr<Options> options, Ptr<Vocab> trgVocab) {
+    auto factoredVocab = trgVocab->tryAs<FactoredVocab>();
+    return (!factoredVocab || factoredVocab->getNumGroups() == 1)
+           && !options->hasAndNotEmpty("alignment");
+  }
+
+  Histories search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+    const int origDimBatch = (int)batch->size();
+    const auto trgEosId = trgVocab_->getEosId();
+    const auto trgUnkId = trgVocab_->getUnkId();
+    const auto srcEosId = batch->front()->vocab()->getEosId();
+    const float maxLength = options_->get<float>("max-length-factor") * batch->front()->batchWidth();
+    const bool nBest = options_->get<bool>("n-best");
+
+    auto getBest = createGetNBestListFn(/*beamSize=*/1, origDimBatch, graph->getDeviceId());
+
+    for(auto scorer : scorers_) {
+      scorer->clear(graph);
+    }
+
+    // start states
+    std::vector<Ptr<ScorerState>> states;
+    for(auto scorer : scorers_) {
+      states.push_back(scorer->startState(graph, batch));
+    }
+
+    // determine index of UNK in the logits if we want to suppress it, see BeamSearch::search()
+    int unkColId = -1;
+    if(trgUnkId != Word::NONE && !options_->get<bool>("allow-unk", false)) {
+      unkColId = trgUnkId.toWordIndex();
+      if(auto shortlist = scorers_[0]->getShortlist())
+        unkColId = shortlist->tryForwardMap(unkColId);
+    }
+
+    std::vector<Sentence> sentences(origDimBatch);
+    std::vector<IndexType> batchIdxMap(origDimBatch); // [dimBatch] index in batch of each batch entry that is still being decoded
+    std::iota(batchIdxMap.begin(), batchIdxMap.end(), 0);
+    std::vector<IndexType> batchIndices;              // [dimBatch] index in the scorer states of each of them; empty if nothing was dropped
+    Words prevWords;                                  // [dimBatch] last word of each of them
+
+    for(size_t t = 0; !batchIdxMap.empty(); t++) {
+      const int dimBatch = (int)batchIdxMap.size();
+
+      // With beam size 1, the hypothesis index of a batch entry is its index in the scorer states,
+      // so states only need to be reordered if batch entries were dropped.
+      Expr logits; // [1, 1, dimBatch, dimVocab]
+      for(size_t i = 0; i < scorers_.size(); ++i) {
+        states[i] = scorers_[i]->step(graph, states[i], /*hypIndices=*/batchIndices, batchIndices, prevWords, dimBatch, /*beamSize=*/1);
+        auto scorerLogits = states[i]->getLogProbs().getLogits();
+        if(scorers_[i]->getWeight() != 1.f)
+          scorerLogits = scorers_[i]->getWeight() * scorerLogits;
+        logits = logits ? logits + scorerLogits : scorerLogits;
+      }
+      const int dimVocab = logits->shape()[-1];
+      logits = reshape(logits, {dimBatch, 1, 1, dimVocab}); // one row per batch entry, as getBest() expects
+
+      if(t == 0)
+        graph->forward();
+      else
+        graph->forwardNext();
+
+      if(unkColId != -1)
+        suppressWord(logits, unkColId);
+
+      std::vector<unsigned int> bestKeys; // [dimBatch] (batchIdx, word idx) flattened
+      std::vector<float> bestScores;      // [dimBatch]
+      getBest(logits->val(), /*N=*/1, bestScores, bestKeys, /*isFirst=*/true);
+      auto shortlist = scorers_[0]->getShortlist(); // per-sentence shortlists follow the dropped batch entries
+
+      // with --n-best, the logits of each scorer for the best words, [scorer][batchIdx], gathered at once
+      std::vector<std::vector<float>> bestLogits(states.size());
+      if(nBest) {
+        std::vector<IndexType> flattenedLogitIndices(bestKeys.begin(), bestKeys.end()); // [1, 1, dimBatch, dimVocab] flattened, as the keys
+        for(size_t j = 0; j < states.size(); ++j)
+          bestLogits[j] = states[j]->getLogProbs().getFactoredLogitsValues(0, flattenedLogitIndices);
+      }
+
+      std::vector<IndexType> activeBatchIdxMap;
+      batchIndices.clear();
+      prevWords.clear();
+      for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
+        auto& sentence = sentences[batchIdxMap[batchIdx]];
+        if(t == 0 && batch->front()->data()[batchIdxMap[batchIdx]] == srcEosId) {
+          // empty line: translate to a single target <EOS>
+          sentence.words.push_back(trgEosId);
+          sentence.pathScores.push_back(0.f);
+          continue;
+        }
+
+        auto wordIdx = (WordIndex)(bestKeys[batchIdx] % dimVocab);
+        auto word = Word::fromWordIndex(shortlist ? shortlist->reverseMap(batchIdx, wordIdx) : wordIdx);
+        float prevPathScore = sentence.pathScores.empty() ? 0.f : sentence.pathScores.back();
+        sentence.words.push_back(word);
+        sentence.pathScores.push_back(prevPathScore + bestScores[batchIdx]);
+
+        if(nBest) {
+          sentence.scoreBreakdown.resize(states.size(), 0.f);
+          for(size_t j = 0; j < states.size(); ++j)
+            sentence.scoreBreakdown[j] += bestLogits[j][batchIdx];
+        }
+
+        // same limit as in BeamSearch::search(), where the history also holds the start hypothesis
+        if(word != trgEosId && sentence.words.size() < maxLength) {
+          activeBatchIdxMap.push_back(batchIdxMap[batchIdx]);
+          batchIndices.push_back((IndexType)batchIdx);
+          prevWords.push_back(word);
+        }
+      }
+      if(batchIndices.size() == (size_t)dimBatch) // nothing was dropped
+        batchIndices.clear();
+      batchIdxMap = activeBatchIdxMap;
+    }
+
+    // create the histories for the output
+    auto arena = New<HypothesisArena>();
+    Histories histories;
+    for(int batchIdx = 0; batchIdx < origDimBatch; ++batchIdx) {
+      const auto& sentence = sentences[batchIdx];
+      auto history = New<History>(batch->getSentenceIds()[batchIdx], arena,
+                                  options_->get<float>("normalize"),
+                                  options_->get<float>("word-penalty"));
+      auto hyp = arena->newHypothesis();
+      history->add(Beam(1, hyp), trgEosId);
+      for(size_t t = 0; t < sentence.words.size(); ++t) {
+        hyp = arena->newHypothesis(hyp, sentence.words[t], /*prevBeamHypIdx=*/0, sentence.pathScores[t]);
+        bool last = t + 1 == sentence.words.size();
+        if(last && nBest)
+          hyp->setScoreBreakdown(sentence.scoreBreakdown);
+        history->add(Beam(1, hyp), trgEosId, last);
+      }
+      histories.push_back(history);
+    }
+    return histories;
+  }
+};
+}  // namespace marian
@@ -3,6 +3,8 @@
 #include "data/types.h"
 #include "hypothesis.h"
 
+#include <algorithm>
+#include <limits>
 #include <queue>
 
 namespace marian {
@@ -19,10 +21,10 @@ private:
     float normalizedPathScore; // length-normalized sentence score
   };
 
-  float lengthPenalty(size_t length) { return std::pow((float)length, alpha_); }
-  float wordPenalty(size_t length) { return wp_ * (float)length; }
+  float lengthPenalty(size_t length) const { return std::pow((float)length, alpha_); }
+  float wordPenalty(size_t length) const { return wp_ * (float)length; }
 public:
-  History(size_t lineNo, float alpha = 1.f, float wp_ = 0.f);
+  History(size_t lineNo, Ptr<HypothesisArena> arena, float alpha = 1.f, float wp_ = 0.f);
 
   void add(const Beam& beam, Word trgEosId, bool last = false) {
     if(beam.back()->getPrevHyp() != nullptr) {
@@ -40,6 +42,23 @@ public:
 
   size_t size() const { return history_.size(); } // number of time steps
 
+  // normalized score of the best sentence hypothesis so far; lowest() if there is none
+  float bestNormalizedScore() const {
+    return topHyps_.empty() ? std::numeric_limits<float>::lowest() : topHyps_.top().normalizedPathScore;
+  }
+
+  // Upper bound of the normalized score of any sentence hypothesis that continues a hypothesis with
+  // the given path score and ends at a length in [size(), maxLength], provided that path scores
+  // never increase, i.e. all word scores are log probabilities.
+  float normalizedScoreBound(float pathScore, size_t maxLength) const {
+    size_t minLength = history_.size();
+    maxLength = std::max(maxLength, minLength);
+    float maxNumerator = pathScore - wordPenalty(wp_ < 0 ? maxLength : minLength);
+    float minDenominator = std::min(lengthPenalty(minLength), lengthPenalty(maxLength));
+    float maxDenominator = std::max(lengthPenalty(minLength), lengthPenalty(maxLength));
+    return maxNumerator / (maxNumerator >= 0 ? minDenominator : maxDenominator);
+  }
+
   NBestList nBest(size_t n) const {
     NBestList nbest;
     for (auto topHypsCopy = topHyps_; nbest.size() < n && !topHypsCopy.empty(); topHypsCopy.pop()) {
@@ -47,7 +66,7 @@ public:
 
       const size_t start = bestHypCoord.i; // last time step of this hypothesis
       const size_t j     = bestHypCoord.j; // which beam entry
-      Ptr<Hypothesis> bestHyp = history_[start][j];
+      const Hypothesis* bestHyp = history_[start][j];
       // float c = bestHypCoord.normalizedPathScore;
       // std::cerr << "h: " << start << " " << j << " " << c << std::endl;
 
@@ -65,6 +84,7 @@ public:
   size_t getLineNum() const { return lineNo_; }
 
 private:
+  Ptr<HypothesisArena> arena_; // owns the hypotheses in history_, shared by all entries of a batch
   std::vector<Beam> history_; // [time step][index into beam] search grid
   std::priority_queue<SentenceHypothesisCoord> topHyps_; // all sentence hypotheses (those that reached eos), sorted by score
   size_t lineNo_;
@@ -6,22 +6,32 @@
 
 namespace marian {
 
+class HypothesisArena;
+
 // one single (partial or full) hypothesis in beam search
 // key elements:
 //  - the word that this hyp ends with
 //  - the aggregate score up to and including the word
 //  - back pointer to previous hypothesis for traceback
+// Hypotheses are created by and live in a HypothesisArena. Back pointers are indices into the
+// arena, and score breakdowns are stored in a flat array of the arena. Alignments are kept as the
+// attention of whole decoding steps in the arena, and hypotheses only refer to their part of it.
 class Hypothesis {
 public:
-  Hypothesis() : prevHyp_(nullptr), prevBeamHypIdx_(0), word_(Word::ZERO), pathScore_(0.0) {}
+  typedef uint32_t Index; // position of a hypothesis in its arena
+  static const Index NONE = (Index)-1;
 
-  Hypothesis(const Ptr<Hypothesis> prevHyp,
+  Hypothesis(HypothesisArena* arena,
+             Index index,
+             Index prevIndex,
              Word word,
              size_t prevBeamHypIdx, // beam-hyp index that this hypothesis originated from
              float pathScore)
-      : prevHyp_(prevHyp), prevBeamHypIdx_(prevBeamHypIdx), word_(word), pathScore_(pathScore) {}
+      : arena_(arena), index_(index), prevIndex_(prevIndex), prevBeamHypIdx_(prevBeamHypIdx), word_(word), pathScore_(pathScore) {}
+
+  inline Hypothesis* getPrevHyp() const; // nullptr for the start hypothesis
 
-  const Ptr<Hypothesis> getPrevHyp() const { return prevHyp_; }
+  HypothesisArena* getArena() const { return arena_; }
 
   Word getWord() const { return word_; }
 
@@ -29,17 +39,27 @@ public:
 
   float getPathScore() const { return pathScore_; }
 
-  const std::vector<float>& getScoreBreakdown() { return scoreBreakdown_; }
-  void setScoreBreakdown(const std::vector<float>& scoreBreaddown) { scoreBreakdown_ = scoreBreaddown; }
+  inline std::vector<float> getScoreBreakdown() const;
+  inline void setScoreBreakdown(const std::vector<float>& scoreBreakdown);
 
-  const std::vector<float>& getAlignment() { return alignment_; }
-  void setAlignment(const std::vector<float>& align) { alignment_ = align; };
+  // P(s|t) over the source positions of the sentence, materialized from the attention in the arena
+  inline std::vector<float> getAlignment() const;
+  // refer to the attention of the given decoding step (see HypothesisArena::addAlignmentStep())
+  // for the given beam and batch entry; origBatchIdx is the entry's index in the batch
+  void setAlignment(size_t step, size_t beamHypIdx, size_t batchIdx, size_t origBatchIdx) {
+    alignment_.step = (Index)step;
+    alignment_.beamHypIdx = (Index)beamHypIdx;
+    alignment_.batchIdx = (Index)batchIdx;
+    alignment_.origBatchIdx = (Index)origBatchIdx;
+  }
+  // use the same alignment as the given hypothesis without copying it
+  void shareAlignment(const Hypothesis& hyp) { alignment_ = hyp.alignment_; }
 
   // helpers to trace back paths referenced from this hypothesis
-  Words tracebackWords()
+  Words tracebackWords() const
   {
       Words targetWords;
-      for (auto hyp = this; hyp->getPrevHyp(); hyp = hyp->getPrevHyp().get()) {
+      for (auto hyp = this; hyp->getPrevHyp(); hyp = hyp->getPrevHyp()) {
         targetWords.push_back(hyp->getWord());
         // std::cerr << hyp->getWord() << " " << hyp << std::endl;
       }
@@ -49,10 +69,10 @@ public:
 
   // get soft alignments [t][s] -> P(s|t) for each target word starting from the hyp one
   typedef data::SoftAlignment SoftAlignment;
-  SoftAlignment tracebackAlignment()
+  SoftAlignment tracebackAlignment() const
   {
       SoftAlignment align;
-      for (auto hyp = this; hyp->getPrevHyp(); hyp = hyp->getPrevHyp().get()) {
+      for (auto hyp = this; hyp->getPrevHyp(); hyp = hyp->getPrevHyp()) {
           align.push_back(hyp->getAlignment());
       }
       std::reverse(align.begin(), align.end());
@@ -60,17 +80,133 @@ public:
   }
 
 private:
-  const Ptr<Hypothesis> prevHyp_;
+  // range in one of the flat arrays of the arena
+  struct Range {
+    size_t offset{0};
+    size_t size{0};
+  };
+
+  // coordinates in the attention of a decoding step in the arena
+  struct AlignmentRef {
+    Index step{NONE};
+    Index beamHypIdx{0};
+    Index batchIdx{0};     // index among the batch entries that were still being decoded in that step
+    Index origBatchIdx{0}; // index of the same entry in the batch
+  };
+
+  HypothesisArena* const arena_;
+  const Index index_;
+  const Index prevIndex_;
   const size_t prevBeamHypIdx_;
   const Word word_;
   const float pathScore_;
 
-  std::vector<float> scoreBreakdown_; // [num scorers]
-  std::vector<float> alignment_;
+  Range scoreBreakdown_; // [num scorers]
+  AlignmentRef alignment_;
+
+  friend class HypothesisArena;
 };
 
-typedef std::vector<Ptr<Hypothesis>> Beam;                // Beam = vector [beamSize] of hypotheses
-typedef std::vector<Beam> Beams;                          // Beams = vector [batchDim] of vector [beamSize] of hypotheses
-typedef std::tuple<Words, Ptr<Hypothesis>, float> Result; // (word ids for hyp, hyp, normalized sentence score for hyp)
-typedef std::vector<Result> NBestList;                    // sorted vector of (word ids, hyp, sent score) tuples
+// Owns all hypotheses created for one batch in BeamSearch::search() and releases them at once.
+// Hypotheses are stored in chunks that are never reallocated, so pointers to them stay valid as
+// long as the arena exists.
+class HypothesisArena {
+private:
+  static const size_t CHUNK_SIZE = 4096; // hypotheses per chunk
+
+  std::vector<std::vector<Hypothesis>> chunks_;
+  size_t size_{0};
+  std::vector<float> scoreBreakdowns_;
+
+  // attention of each decoding step with alignments, and the source mask of the batch
+  struct AlignmentStep {
+    std::vector<float> attention; // [beam depth, max src length, active batch size, 1], flattened
+    size_t dimBatch;              // active batch size of the step
+  };
+  std::vector<AlignmentStep> alignmentSteps_;
+  std::vector<float> srcMask_; // [max src length, batch size], flattened
+  size_t srcBatchSize_{0};
+
+  friend class Hypothesis;
+
+  Hypothesis* emplace(Hypothesis::Index prevIndex, Word word, size_t prevBeamHypIdx, float pathScore) {
+    if(size_ % CHUNK_SIZE == 0) {
+      chunks_.emplace_back();
+      chunks_.back().reserve(CHUNK_SIZE);
+    }
+    chunks_.back().emplace_back(this, (Hypothesis::Index)size_++, prevIndex, word, prevBeamHypIdx, pathScore);
+    return &chunks_.back().back();
+  }
+
+  Hypothesis* at(Hypothesis::Index index) { return &chunks_[index / CHUNK_SIZE][index % CHUNK_SIZE]; }
+
+public:
+  // start hypothesis, i.e. the root of all search paths
+  Hypothesis* newHypothesis() {
+    return emplace(Hypothesis::NONE, Word::ZERO, 0, 0.f);
+  }
+
+  Hypothesis* newHypothesis(const Hypothesis* prevHyp,
+                            Word word,
+                            size_t prevBeamHypIdx, // beam-hyp index that this hypothesis originated from
+                            float pathScore) {
+    ABORT_IF(prevHyp->arena_ != this, "Hypothesis does not belong to this arena");
+    return emplace(prevHyp->index_, word, prevBeamHypIdx, pathScore);
+  }
+
+  size_t size() const { return size_; }
+
+  // source mask of the batch, for alignments
+  void setSourceMask(const std::vector<float>& srcMask, size_t batchSize) {
+    srcMask_ = srcMask;
+    srcBatchSize_ = batchSize;
+  }
+
+  // Keeps the attention of a decoding step with the given active batch size; returns the step
+  // index for Hypothesis::setAlignment()
+  size_t addAlignmentStep(std::vector<float>&& attention, size_t dimBatch) {
+    alignmentSteps_.push_back({std::move(attention), dimBatch});
+    return alignmentSteps_.size() - 1;
+  }
+};
+
+inline Hypothesis* Hypothesis::getPrevHyp() const {
+  return prevIndex_ == NONE ? nullptr : arena_->at(prevIndex_);
+}
+
+inline std::vector<float> Hypothesis::getScoreBreakdown() const {
+  auto begin = arena_->scoreBreakdowns_.begin() + scoreBreakdown_.offset;
+  return std::vector<float>(begin, begin + scoreBreakdown_.size);
+}
+
+inline void Hypothesis::setScoreBreakdown(const std::vector<float>& scoreBreakdown) {
+  scoreBreakdown_.offset = arena_->scoreBreakdowns_.size();
+  scoreBreakdown_.size = scoreBreakdown.size();
+  arena_->scoreBreakdowns_.insert(arena_->scoreBreakdowns_.end(), scoreBreakdown.begin(), scoreBreakdown.end());
+}
+
+inline std::vector<float> Hypothesis::getAlignment() const {
+  std::vector<float> align;
+  if(alignment_.step == NONE)
+    return align;
+
+  // The attention of a step is [B, L, N, 1] for B beam entries, L the number of words in the
+  // longest sentence, and N the number of sentences that were still being decoded. The mask
+  // is [L, batch size] and has 1/0s for the words of all sentences.
+  const auto& step = arena_->alignmentSteps_[alignment_.step];
+  size_t batchSize  = arena_->srcBatchSize_;
+  size_t batchWidth = arena_->srcMask_.size() / batchSize;
+  for(size_t srcPos = 0; srcPos < batchWidth; ++srcPos) { // loop over source positions
+    size_t a = (batchWidth * step.dimBatch * alignment_.beamHypIdx) + alignment_.batchIdx + (step.dimBatch * srcPos); // = flatten [beam index, s, batch index, 0]
+    size_t m = alignment_.origBatchIdx + (batchSize * srcPos); // = flatten [s, orig batch index]
+    if(arena_->srcMask_[m] != 0)
+      align.emplace_back(step.attention[a]);
+  }
+  return align;
+}
+
+typedef std::vector<Hypothesis*> Beam;                          // Beam = vector [beamSize] of hypotheses
+typedef std::vector<Beam> Beams;                                // Beams = vector [batchDim] of vector [beamSize] of hypotheses
+typedef std::tuple<Words, const Hypothesis*, float> Result;     // (word ids for hyp, hyp, normalized sentence score for hyp)
+typedef std::vector<Result> NBestList;                          // sorted vector of (word ids, hyp, sent score) tuples
 }  // namespace marian
@@ -7,7 +7,6 @@
 #include <algorithm>
 #include <iterator>
 #include <limits>
-#include <numeric>
 
 namespace marian {
 
@@ -16,36 +15,60 @@ class NthElementCPU {
   std::vector<float> h_res;
   //size_t lastN_;
 
+  // Scores are scanned in blocks of this size. A block is skipped as a whole if its maximum
+  // does not beat the N-th best score found so far, which is true for most blocks.
+  static const int BLOCK_SIZE = 16;
+
 public:
   NthElementCPU() {}
   NthElementCPU(const NthElementCPU& copy) = delete;
 
 private:
+  // insert score at its position in the descending list of best scores [resIdx, resIdx + N)
+  // dropping the last one; requires score > res[N - 1]
+  static inline void insert(float score, int idx, float* res, int* resIdx, int N) {
+    int pos = N - 1;
+    for(; pos > 0 && score > res[pos - 1]; --pos) {
+      res[pos]    = res[pos - 1];
+      resIdx[pos] = resIdx[pos - 1];
+    }
+    res[pos]    = score;
+    resIdx[pos] = idx;
+  }
+
+  // select the N best of the given scores in one pass, sorted in descending order
+  static void selectNBest(const float* scores, int numScores, int N, int firstIdx, float* res, int* resIdx) {
+    // start with the first N scores
+    for(int i = 0; i < N; ++i)
+      insert(scores[i], firstIdx + i, res, resIdx, i + 1);
+
+    int i = N;
+    for(; i + BLOCK_SIZE <= numScores; i += BLOCK_SIZE) {
+      const float* block = scores + i;
+      float blockMax = block[0];
+      #pragma omp simd reduction(max : blockMax)
+      for(int j = 1; j < BLOCK_SIZE; ++j)
+        blockMax = std::max(blockMax, block[j]);
+
+      if(blockMax <= res[N - 1])
+        continue;
+
+      for(int j = 0; j < BLOCK_SIZE; ++j)
+        if(block[j] > res[N - 1])
+          insert(block[j], firstIdx + i + j, res, resIdx, N);
+    }
+    for(; i < numScores; ++i)
+      if(scores[i] > res[N - 1])
+        insert(scores[i], firstIdx + i, res, resIdx, N);
+  }
+
   // for each batch, select the max N elements, where N is the beam size for this batch.
-  void selectNBest(const float* scores,
-                   const std::vector<int>& batchFirstElementIdxs,
-                   const std::vector<int>& cumulativeBeamSizes) {
-    int numProbs = batchFirstElementIdxs.back();
-    std::vector<int> idxs(numProbs);
-    std::iota(idxs.begin(), idxs.end(), 0);
-
-    size_t numBatches = batchFirstElementIdxs.size() - 1;
-    for(size_t batchIdx = 0; batchIdx < numBatches; ++batchIdx) {
-      int pos = cumulativeBeamSizes[batchIdx];
-      int beamSize = cumulativeBeamSizes[batchIdx + 1] - pos;
-
-      std::vector<int>::iterator begin = idxs.begin() + batchFirstElementIdxs[batchIdx];
-      std::vector<int>::iterator middle = begin + beamSize;
-      std::vector<int>::iterator end = idxs.begin() + batchFirstElementIdxs[batchIdx + 1];
-      std::partial_sort(
-          begin, middle, end, [&](int a, int b) { return scores[a] > scores[b]; });
-
-      while(begin != middle) {
-        int idx = *begin++;
-        h_res_idx[pos] = idx;
-        h_res[pos] = scores[idx];
-        ++pos;
-      }
+  void selectNBest(const float* scores, int dimBatch, int batchStride, int N) {
+    #pragma omp parallel for
+    for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
+      int firstIdx = batchIdx * batchStride;
+      selectNBest(scores + firstIdx, batchStride, N, firstIdx,
+                  h_res.data() + batchIdx * N, h_res_idx.data() + batchIdx * N);
     }
   }
 
@@ -59,23 +82,14 @@ public:
     const auto inputN    = scores->shape()[-2];
     const auto dimBatch  = scores->shape()[-4];
     ABORT_IF(inputN != (isFirst ? 1 : N), "Input tensor has wrong beam dim??"); // @TODO: Remove isFirst argument altogether
-
-    std::vector<int> cumulativeBeamSizes(dimBatch + 1, 0);
-    std::vector<int> batchFirstElementIdxs(dimBatch + 1, 0);
-
-    for(int batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
-      cumulativeBeamSizes[batchIdx + 1] = (batchIdx + 1) * (int)N;
-      batchFirstElementIdxs[batchIdx + 1] += (batchIdx + 1) * inputN * vocabSize;
-      ABORT_IF(cumulativeBeamSizes[batchIdx + 1] != cumulativeBeamSizes[batchIdx] + (int)N, "cumulativeBeamSizes wrong??");
-      ABORT_IF((isFirst ? batchIdx + 1 : cumulativeBeamSizes[batchIdx + 1]) != (batchIdx + 1) * inputN, "inputN wrong??");
-    }
-    ABORT_IF(cumulativeBeamSizes.back() != dimBatch * N, "cumulativeBeamSizes.back() wrong??");
+    ABORT_IF(inputN * vocabSize < N, "Cannot select {} best of {} scores??", N, inputN * vocabSize);
 
     size_t maxSize = N * dimBatch;
     h_res.resize(maxSize);
     h_res_idx.resize(maxSize);
 
-    selectNBest(scores->data(), batchFirstElementIdxs, cumulativeBeamSizes);
+    // scores of all beam entries of a batch entry are consecutive
+    selectNBest(scores->data(), dimBatch, inputN * vocabSize, (int)N);
     getPairs(/*cumulativeBeamSizes.back(),*/ outKeys, outPathScores);
   }
 
@@ -2,17 +2,9 @@
 
 namespace marian {
 
-std::string OutputPrinter::getAlignment(const Ptr<Hypothesis>& hyp) {
-  data::SoftAlignment align;
-  auto last = hyp;
-  // get soft alignments for each target word starting from the last one
-  while(last->getPrevHyp().get() != nullptr) {
-    align.push_back(last->getAlignment());
-    last = last->getPrevHyp();
-  }
-
-  // reverse alignments
-  std::reverse(align.begin(), align.end());
+std::string OutputPrinter::getAlignment(const Hypothesis* hyp) {
+  // get soft alignments for each target word
+  data::SoftAlignment align = hyp->tracebackAlignment();
 
   if(alignment_ == "soft") {
     return data::SoftAlignToString(align);
@@ -24,6 +24,12 @@ public:
 
   template <class OStream>
   void print(Ptr<History> history, OStream& best1, OStream& bestn) {
+    print(history, history->getLineNum(), best1, bestn);
+  }
+
+  // as above, with the given line number in the N-best list
+  template <class OStream>
+  void print(Ptr<History> history, size_t lineNum, OStream& best1, OStream& bestn) {
     const auto& nbl = history->nBest(nbest_);
 
     for(size_t i = 0; i < nbl.size(); ++i) {
@@ -35,17 +41,18 @@ public:
         std::reverse(words.begin(), words.end());
 
       std::string translation = vocab_->decode(words);
-      bestn << history->getLineNum() << " ||| " << translation;
+      bestn << lineNum << " ||| " << translation;
 
       if(!alignment_.empty())
         bestn << " ||| " << getAlignment(hypo);
 
       bestn << " |||";
-      if(hypo->getScoreBreakdown().empty()) {
+      auto scoreBreakdown = hypo->getScoreBreakdown();
+      if(scoreBreakdown.empty()) {
         bestn << " F0=" << hypo->getPathScore();
       } else {
-        for(size_t j = 0; j < hypo->getScoreBreakdown().size(); ++j) {
-          bestn << " F" << j << "= " << hypo->getScoreBreakdown()[j];
+        for(size_t j = 0; j < scoreBreakdown.size(); ++j) {
+          bestn << " F" << j << "= " << scoreBreakdown[j];
         }
       }
 
@@ -82,7 +89,7 @@ private:
   std::string alignment_;
   float alignmentThreshold_{0.f};
 
-  std::string getAlignment(const Ptr<Hypothesis>& hyp);
+  std::string getAlignment(const Hypothesis* hyp);
 
   float getAlignmentThreshold(const std::string& str) {
     try {
@@ -2,6 +2,7 @@
 
 #include "marian.h"
 
+#include "3rd_party/threadpool.h"
 #include "data/shortlist.h"
 #include "models/model_factory.h"
 
@@ -12,6 +13,14 @@ public:
   virtual Logits getLogProbs() const = 0;
 
   virtual void blacklist(Expr /*totalCosts*/, Ptr<data::CorpusBatch> /*batch*/){};
+
+  // tensors that are carried over to the next step; used when replaying recorded steps
+  virtual std::vector<Expr> getStateExprs() const { return {}; }
+
+  // append the batch entries of another state; used for continuous batching
+  virtual Ptr<ScorerState> merge(Ptr<ScorerState> /*other*/) const {
+    ABORT("Merging of scorer states is not supported");
+  }
 };
 
 class Scorer {
@@ -19,6 +28,9 @@ protected:
   std::string name_;
   float weight_;
 
+  Ptr<ExpressionGraph> graph_; // own graph and thread of an ensemble member, see setGraph()
+  Ptr<ThreadPool> thread_;
+
 public:
   Scorer(const std::string& name, float weight)
       : name_(name), weight_(weight) {}
@@ -26,13 +38,23 @@ public:
   std::string getName() { return name_; }
   float getWeight() { return weight_; }
 
+  // Lets this scorer run on its own graph and thread, so that the steps of ensemble members can
+  // be computed concurrently (--parallel-ensemble). Callers pass getGraph() to the functions below.
+  void setGraph(Ptr<ExpressionGraph> graph) {
+    graph_ = graph;
+    thread_ = New<ThreadPool>(1);
+  }
+  Ptr<ExpressionGraph> getGraph() { return graph_; }   // nullptr if the scorer has no own graph
+  Ptr<ThreadPool> getThread() { return thread_; }
+
   virtual void clear(Ptr<ExpressionGraph>) = 0;
   virtual Ptr<ScorerState> startState(Ptr<ExpressionGraph>,
                                       Ptr<data::CorpusBatch>)
       = 0;
   virtual Ptr<ScorerState> step(Ptr<ExpressionGraph>,
                                 Ptr<ScorerState>,
-                                const std::vector<IndexType>&,
+                                const std::vector<IndexType>&, // hypIndices
+                                const std::vector<IndexType>&, // batchIndices
                                 const Words&,
                                 int dimBatch,
                                 int beamSize)
@@ -44,6 +66,12 @@ public:
   virtual Ptr<data::Shortlist> getShortlist() { return nullptr; };
 
   virtual std::vector<float> getAlignment() { return {}; };
+
+  // whether a recorded step graph may be replayed for later steps, see ExpressionGraph::replay()
+  virtual bool stepsAreReplayable() { return false; }
+
+  // whether new sentences can join a running search, see ScorerState::merge()
+  virtual bool statesAreMergeable() { return false; }
 };
 
 class ScorerWrapperState : public ScorerState {
@@ -60,6 +88,13 @@ public:
   virtual void blacklist(Expr totalCosts, Ptr<data::CorpusBatch> batch) override {
     state_->blacklist(totalCosts, batch);
   }
+
+  virtual std::vector<Expr> getStateExprs() const override { return state_->getStateExprs(); }
+
+  virtual Ptr<ScorerState> merge(Ptr<ScorerState> other) const override {
+    auto otherWrapper = std::dynamic_pointer_cast<ScorerWrapperState>(other);
+    return New<ScorerWrapperState>(state_->merge(otherWrapper->getState()));
+  }
 };
 
 // class to wrap IEncoderDecoder in a Scorer interface
@@ -109,12 +144,13 @@ public:
   virtual Ptr<ScorerState> step(Ptr<ExpressionGraph> graph,
                                 Ptr<ScorerState> state,
                                 const std::vector<IndexType>& hypIndices,
+                                const std::vector<IndexType>& batchIndices,
                                 const Words& words,
                                 int dimBatch,
                                 int beamSize) override {
     graph->switchParams(getName());
     auto wrapperState = std::dynamic_pointer_cast<ScorerWrapperState>(state);
-    auto newState = encdec_->step(graph, wrapperState->getState(), hypIndices, words, dimBatch, beamSize);
+    auto newState = encdec_->step(graph, wrapperState->getState(), hypIndices, batchIndices, words, dimBatch, beamSize);
     return New<ScorerWrapperState>(newState);
   }
 
@@ -129,9 +165,14 @@ public:
 
   virtual std::vector<float> getAlignment() override {
     // This is called during decoding, where alignments only exist for the last time step. Hence front().
-    // This makes as copy. @TODO: It should be OK to return this as a const&.
-    return encdec_->getAlignment().front(); // [beam depth * max src length * batch size]
+    // Only the one step is copied out of the graph, and moved on from there.
+    auto alignments = encdec_->getAlignment();
+    return std::move(alignments.front()); // [beam depth * max src length * batch size]
   }
+
+  virtual bool stepsAreReplayable() override { return encdec_->stepsAreReplayable(); }
+
+  virtual bool statesAreMergeable() override { return encdec_->statesAreMergeable(); }
 };
 
 Ptr<Scorer> scorerByType(const std::string& fname,
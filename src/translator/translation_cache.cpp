@@ -0,0 +1,262 @@
+#include "translation_cache.h"
+#include "common/file_stream.h"
+#include "common/filesystem.h"
+#include "common/logging.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace marian {
+
+namespace {
+
+const uint64_t CACHE_FILE_MAGIC = 0x31454843414354ULL; // "TCACHE1"
+const size_t LOG_STATS_EVERY = 10000;                 // lookups
+
+// Options that change the printed translation of a sentence
+const std::vector<std::string> FINGERPRINT_OPTIONS = {
+  "models", "vocabs", "dim-vocabs", "weights", "beam-size", "normalize", "word-penalty",
+  "max-length", "max-length-factor", "max-length-crop", "allow-unk", "shortlist",
+  "shortlist-per-sentence", "output-sampling", "beam-early-stop", "beam-threshold-relative",
+  "beam-threshold-absolute", "alignment", "word-scores", "no-spm-decode", "skip-cost",
+  "gemm-type", "gemm-isa", "quantize-range", "optimize", "precision"
+};
+
+// Options with files that can change while their paths stay the same, e.g. retrained models.
+// The size and modification time of each file are part of the fingerprint.
+const std::vector<std::string> FINGERPRINT_FILES = {"models", "vocabs", "shortlist"};
+
+std::string createFingerprint(Ptr<Options> options) {
+  std::stringstream ss;
+  for(const auto& key : FINGERPRINT_OPTIONS)
+    if(options->has(key))
+      ss << key << ": " << options->getYaml()[key] << "\n";
+  for(const auto& key : FINGERPRINT_FILES) {
+    if(!options->has(key))
+      continue;
+    for(const auto& path : options->get<std::vector<std::string>>(key)) // --shortlist also has numbers
+      if(filesystem::exists(path) && !filesystem::isDirectory(path))
+        ss << path << ": " << filesystem::fileSize(path) << " bytes, modified "
+           << filesystem::lastWriteTime(path) << "\n";
+  }
+  return ss.str();
+}
+
+void writeUInt64(std::ostream& out, uint64_t value) {
+  out.write((const char*)&value, sizeof(value));
+}
+
+void writeString(std::ostream& out, const std::string& s) {
+  writeUInt64(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+// Reads cache files without aborting, so that a damaged or truncated file does not stop the
+// server. Strings cannot be longer than the rest of the file, so that a damaged length does not
+// allocate an arbitrary amount of memory. Once a read fails, all further reads fail.
+class CacheFileReader {
+private:
+  std::istream& in_;
+  uint64_t bytesLeft_;
+
+public:
+  CacheFileReader(std::istream& in, uint64_t fileBytes) : in_(in), bytesLeft_(fileBytes) {}
+
+  bool read(uint64_t& value) {
+    if(!in_ || bytesLeft_ < sizeof(value))
+      return fail();
+    in_.read((char*)&value, sizeof(value));
+    bytesLeft_ -= sizeof(value);
+    return (bool)in_;
+  }
+
+  bool read(std::string& s) {
+    uint64_t size;
+    if(!read(size) || size > bytesLeft_)
+      return fail();
+    s.resize(size);
+    in_.read(&s[0], size);
+    bytesLeft_ -= size;
+    return (bool)in_;
+  }
+
+private:
+  bool fail() {
+    in_.setstate(std::ios::failbit);
+    return false;
+  }
+};
+
+}  // namespace
+
+const size_t TranslationCache::NUM_SHARDS;
+
+TranslationCache::TranslationCache(Ptr<Options> options, size_t maxBytes)
+    : maxShardBytes_(maxBytes / NUM_SHARDS), fingerprint_(createFingerprint(options)) {
+  for(size_t i = 0; i < NUM_SHARDS; ++i)
+    shards_.emplace_back(new Shard());
+}
+
+TranslationCache::~TranslationCache() {
+  logStats();
+}
+
+std::string TranslationCache::normalize(const std::string& line) {
+  std::string normalized;
+  normalized.reserve(line.size());
+  bool space = false;
+  for(char c : line) {
+    if(std::isspace((unsigned char)c)) {
+      space = !normalized.empty();
+    } else {
+      if(space)
+        normalized.push_back(' ');
+      normalized.push_back(c);
+      space = false;
+    }
+  }
+  return normalized;
+}
+
+bool TranslationCache::lookup(const std::string& key, std::string& translation) {
+  bool found = false;
+  {
+    auto& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if(it != shard.index.end()) {
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      translation = it->second->second;
+      found = true;
+    }
+  }
+
+  size_t lookups = (found ? ++hits_ + misses_ : hits_ + ++misses_);
+  if(lookups % LOG_STATS_EVERY == 0)
+    logStats();
+  return found;
+}
+
+void TranslationCache::insert(const std::string& key, const std::string& translation) {
+  auto& shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  insert(shard, key, translation);
+}
+
+void TranslationCache::insert(Shard& shard, const std::string& key, const std::string& translation) {
+  size_t bytes = entryBytes(key, translation);
+  if(bytes > maxShardBytes_)
+    return;
+
+  auto it = shard.index.find(key);
+  if(it != shard.index.end()) {
+    shard.bytes -= entryBytes(key, it->second->second);
+    shard.entries.erase(it->second);
+    shard.index.erase(it);
+  }
+
+  shard.entries.emplace_front(key, translation);
+  shard.index[key] = shard.entries.begin();
+  shard.bytes += bytes;
+
+  while(shard.bytes > maxShardBytes_) {
+    const auto& lru = shard.entries.back();
+    shard.bytes -= entryBytes(lru.first, lru.second);
+    shard.index.erase(lru.first);
+    shard.entries.pop_back();
+  }
+}
+
+size_t TranslationCache::size() {
+  size_t total = 0;
+  for(auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->entries.size();
+  }
+  return total;
+}
+
+void TranslationCache::load(const std::string& fileName) {
+  if(!filesystem::exists(fileName)) {
+    LOG(info, "[cache] Translation cache file {} does not exist yet", fileName);
+    return;
+  }
+
+  io::InputFileStream file(fileName);
+  CacheFileReader in(file, filesystem::fileSize(fileName));
+  uint64_t magic;
+  if(!in.read(magic) || magic != CACHE_FILE_MAGIC) {
+    LOG(warn, "[cache] {} is not a translation cache file, ignoring it", fileName);
+    return;
+  }
+  std::string fingerprint;
+  if(!in.read(fingerprint) || fingerprint != fingerprint_) {
+    LOG(warn, "[cache] Translation cache file {} was written with different options, ignoring it", fileName);
+    return;
+  }
+
+  // entries are only inserted once the whole file has been read
+  uint64_t count;
+  std::vector<Entry> entries;
+  bool complete = in.read(count);
+  for(uint64_t i = 0; i < count && complete; ++i) {
+    Entry entry;
+    complete = in.read(entry.first) && in.read(entry.second);
+    entries.push_back(std::move(entry));
+  }
+  if(!complete) {
+    LOG(warn, "[cache] Translation cache file {} is truncated or damaged, starting with an empty cache", fileName);
+    return;
+  }
+
+  for(const auto& entry : entries)
+    insert(entry.first, entry.second);
+  LOG(info, "[cache] Loaded {} translations from {}", size(), fileName);
+}
+
+void TranslationCache::save(const std::string& fileName) {
+  // write to a temporary file first, so that an interrupted save does not destroy the old cache
+  std::string tempName = fileName + ".tmp";
+  std::vector<Entry> entries;
+  for(auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    entries.insert(entries.end(), shard->entries.rbegin(), shard->entries.rend());
+  }
+
+  // called when the server shuts down, so failures are only logged
+  {
+    std::ofstream out(tempName, std::ios::binary);
+    writeUInt64(out, CACHE_FILE_MAGIC);
+    writeString(out, fingerprint_);
+    writeUInt64(out, entries.size());
+    for(const auto& entry : entries) {
+      writeString(out, entry.first);
+      writeString(out, entry.second);
+    }
+    out.close();
+    if(!out) {
+      LOG(warn, "[cache] Could not write translation cache file {}", tempName);
+      std::remove(tempName.c_str());
+      return;
+    }
+  }
+  if(std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+    LOG(warn, "[cache] Error {} ({}) renaming {} to {}, translation cache not saved",
+        errno, strerror(errno), tempName, fileName);
+    return;
+  }
+  LOG(info, "[cache] Saved {} translations to {}", entries.size(), fileName);
+}
+
+void TranslationCache::logStats() {
+  size_t hits = hits_, misses = misses_;
+  size_t lookups = hits + misses;
+  if(lookups == 0)
+    return;
+  LOG(info, "[cache] {} lookups, {} hits ({:.1f}%), {} misses, {} entries",
+      lookups, hits, 100.0 * hits / lookups, misses, size());
+}
+
+}  // namespace marian
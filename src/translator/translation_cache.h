@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * @brief Bounded cache of sentence translations for TranslateService
+ *
+ * Maps normalized source sentences to their printed translations. The cache is split into shards,
+ * each with its own lock and least-recently-used list, so that concurrent requests rarely wait
+ * for each other. The memory limit is divided evenly between the shards; the least recently used
+ * entries of a shard are evicted when it is exceeded.
+ *
+ * The cache belongs to one set of options, which is summarized in a fingerprint of all options
+ * that influence the output and of the size and modification time of the model, vocabulary and
+ * shortlist files. The fingerprint is stored with the cache file, and files that were
+ * written with different options are ignored when loading.
+ */
+class TranslationCache {
+public:
+  static const size_t NUM_SHARDS = 16;
+  static const size_t ENTRY_OVERHEAD = 64; // approximate bytes for list node, map bucket and strings
+
+  // shard of the cache that holds the given key
+  static size_t shardIndex(const std::string& key) { return std::hash<std::string>()(key) % NUM_SHARDS; }
+
+  static size_t entryBytes(const std::string& key, const std::string& value) {
+    return key.size() + value.size() + ENTRY_OVERHEAD;
+  }
+
+private:
+  typedef std::pair<std::string, std::string> Entry; // (normalized source, translation)
+
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes{0};
+  };
+
+  std::vector<UPtr<Shard>> shards_;
+  size_t maxShardBytes_;
+  std::string fingerprint_;
+
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+
+  Shard& shardFor(const std::string& key) { return *shards_[shardIndex(key)]; }
+
+  // add or refresh an entry; shard.mutex must be held
+  void insert(Shard& shard, const std::string& key, const std::string& translation);
+
+public:
+  // maxBytes is the memory limit of all entries together, i.e. each shard gets maxBytes / NUM_SHARDS
+  TranslationCache(Ptr<Options> options, size_t maxBytes);
+  ~TranslationCache();
+
+  // source text as used for cache keys: leading, trailing and repeated whitespace removed
+  static std::string normalize(const std::string& line);
+
+  // Looks up the translation of a normalized source sentence; returns false if it is not cached
+  bool lookup(const std::string& key, std::string& translation);
+  // Adds the translation of a normalized source sentence
+  void insert(const std::string& key, const std::string& translation);
+
+  size_t size();
+
+  // Fills the cache from a file written by save() with the same options, if it exists. Truncated
+  // or damaged files are ignored with a warning.
+  void load(const std::string& fileName);
+  // Writes all entries to a file, least recently used first, so that load() preserves the order.
+  // Failures are logged as warnings, as the cache is saved when the server shuts down.
+  void save(const std::string& fileName);
+
+  void logStats();
+};
+
+}  // namespace marian
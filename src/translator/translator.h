@@ -6,15 +6,105 @@
 #include "data/text_input.h"
 
 #include "3rd_party/threadpool.h"
+#include "graph/auto_tuner.h"
 #include "translator/history.h"
 #include "translator/output_collector.h"
 #include "translator/output_printer.h"
+#include "translator/translation_cache.h"
 
 #include "models/model_task.h"
 #include "translator/scorers.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 namespace marian {
 
+// Graph for translation on the given device
+inline Ptr<ExpressionGraph> createTranslationGraph(Ptr<Options> options, DeviceId device) {
+  auto graph = New<ExpressionGraph>(true);
+  graph->setDevice(device);
+  graph->setShorttermMemoization(!options->get<bool>("no-shortterm-memoization", false));
+  graph->setElementwiseFusion(options->get<bool>("fuse-elementwise", false));
+  graph->getBackend()->setClip(options->get<float>("clip-gemm"));
+  if (device.type == DeviceType::cpu) {
+    graph->getBackend()->setOptimized(options->get<bool>("optimize"));
+    graph->getBackend()->setGemmType(options->get<std::string>("gemm-type"));
+    graph->getBackend()->setGemmIsa(options->get<std::string>("gemm-isa"));
+    if(options->hasAndNotEmpty("gemm-autotune-file"))
+      AutoTunerState::global()->useFile(options->get<std::string>("gemm-autotune-file"),
+                                        options->get<size_t>("cpu-threads"));
+  }
+  graph->reserveWorkspaceMB(options->get<size_t>("workspace"));
+  return graph;
+}
+
+// Loads the scorers into the graph. With --parallel-ensemble, ensemble members after the first
+// get their own graph and thread instead, see Scorer::setGraph().
+inline void initScorers(Ptr<Options> options, const std::vector<Ptr<Scorer>>& scorers, Ptr<ExpressionGraph> graph) {
+  bool parallel = options->get<bool>("parallel-ensemble", false) && scorers.size() > 1;
+  if(parallel && graph->getDeviceId().type != DeviceType::cpu) {
+    LOG_ONCE(warn, "[translate] --parallel-ensemble is only supported on CPU, it will be disabled");
+    parallel = false;
+  }
+
+  for(size_t i = 0; i < scorers.size(); ++i) {
+    if(parallel && i > 0) {
+      auto scorerGraph = createTranslationGraph(options, graph->getDeviceId());
+      scorers[i]->setGraph(scorerGraph);
+      scorers[i]->init(scorerGraph);
+      scorerGraph->forward();
+    } else {
+      scorers[i]->init(graph);
+    }
+  }
+}
+
+// Whether to decode with --continuous-batching, which is only possible for some models and options
+template <class Search>
+bool useContinuousBatching(Ptr<Options> options, const std::vector<Ptr<Scorer>>& scorers, Ptr<Vocab> trgVocab) {
+  if(options->get<size_t>("continuous-batching", 0) == 0)
+    return false;
+  if(New<Search>(options, scorers, trgVocab)->supportsContinuousBatching())
+    return true;
+  LOG(warn, "[translate] Continuous batching is not supported for this model and these options, it will be disabled");
+  return false;
+}
+
+// Continuous batching: one worker per device keeps its beam search running and takes new
+// batches from the shared batch generator whenever sentences finish.
+template <class Search, class BatchGenerator>
+void translateContinuous(BatchGenerator& batchGenerator,
+                         Ptr<Options> options,
+                         const std::vector<Ptr<ExpressionGraph>>& graphs,
+                         const std::vector<std::vector<Ptr<Scorer>>>& scorers,
+                         Ptr<Vocab> trgVocab,
+                         const std::function<void(Ptr<History>)>& onFinished) {
+  std::mutex mutex;
+  auto it = batchGenerator.begin();
+  auto feed = [&]() -> Ptr<data::CorpusBatch> {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(it == batchGenerator.end())
+      return nullptr;
+    auto batch = *it;
+    ++it;
+    return batch;
+  };
+
+  ThreadPool threadPool(graphs.size(), graphs.size()); // joins the workers before the above go out of scope
+  for(size_t id = 0; id < graphs.size(); ++id) {
+    auto task = [&](size_t id) {
+      auto search = New<Search>(options, scorers[id], trgVocab);
+      search->searchContinuous(graphs[id], feed, onFinished);
+    };
+    threadPool.enqueue(task, id);
+  }
+}
+
 template <class Search>
 class Translate : public ModelTask {
 private:
@@ -55,19 +145,12 @@ public:
     size_t id = 0;
     for(auto device : devices) {
       auto task = [&](DeviceId device, size_t id) {
-        auto graph = New<ExpressionGraph>(true);
-        graph->setDevice(device);
-        graph->getBackend()->setClip(options_->get<float>("clip-gemm"));
-        if (device.type == DeviceType::cpu) {
-          graph->getBackend()->setOptimized(options_->get<bool>("optimize"));
-          graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type"));
-        }
-        graph->reserveWorkspaceMB(options_->get<size_t>("workspace"));
+        auto graph = createTranslationGraph(options_, device);
         graphs_[id] = graph;
 
         auto scorers = createScorers(options_);
+        initScorers(options_, scorers, graph);
         for(auto scorer : scorers) {
-          scorer->init(graph);
           if(shortlistGenerator_)
             scorer->setShortlistGenerator(shortlistGenerator_);
         }
@@ -93,6 +176,19 @@ public:
 
     bg.prepare(false);
 
+    if(useContinuousBatching<Search>(options_, scorers_[0], trgVocab_)) {
+      translateContinuous<Search>(bg, options_, graphs_, scorers_, trgVocab_, [&](Ptr<History> history) {
+        std::stringstream best1;
+        std::stringstream bestn;
+        printer->print(history, best1, bestn);
+        collector->Write((long)history->getLineNum(),
+                         best1.str(),
+                         bestn.str(),
+                         options_->get<bool>("n-best"));
+      });
+      return;
+    }
+
     for(auto batch : bg) {
       auto task = [=](size_t id) {
         thread_local Ptr<ExpressionGraph> graph;
@@ -145,9 +241,45 @@ private:
   Ptr<Vocab> trgVocab_;
 
   size_t numDevices_;
+  bool continuousBatching_{false};
+  Ptr<OutputPrinter> printer_;
+
+  UPtr<TranslationCache> cache_;
+  std::string cacheFile_;
+
+  // a request whose sentences are translated by the continuous batching workers
+  struct Request {
+    Ptr<StringCollector> collector{New<StringCollector>()};
+    size_t pending{0}; // number of sentences that are not translated yet
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+
+  // Continuous batching: run() queues the batches of its request, and one worker per device
+  // admits them into its running beam search whenever sentences finish. Sentence ids are unique
+  // across requests, so that finished sentences find their request.
+  std::mutex queueMutex_;
+  std::condition_variable queueChanged_;
+  std::deque<Ptr<data::CorpusBatch>> queue_;
+  std::unordered_map<size_t, std::pair<Ptr<Request>, size_t>> sentences_; // sentence id -> request and line number in it
+  size_t nextSentenceId_{0};
+  bool stopped_{false};
+  std::vector<std::thread> workers_;
 
 public:
-  virtual ~TranslateService() {}
+  virtual ~TranslateService() {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      stopped_ = true;
+    }
+    queueChanged_.notify_all();
+    for(auto& worker : workers_)
+      worker.join();
+
+    if(cache_ && !cacheFile_.empty())
+      cache_->save(cacheFile_);
+    AutoTunerState::global()->flush();
+  }
 
   TranslateService(Ptr<Options> options) : options_(options) {
     // initialize vocabs
@@ -171,33 +303,93 @@ public:
 
     // initialize scorers
     for(auto device : devices) {
-      auto graph = New<ExpressionGraph>(true);
-      graph->setDevice(device);
-      graph->getBackend()->setClip(options_->get<float>("clip-gemm"));
-      if (device.type == DeviceType::cpu) {
-        graph->getBackend()->setOptimized(options_->get<bool>("optimize"));
-        graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type"));
-      }
-      graph->reserveWorkspaceMB(options_->get<size_t>("workspace"));
+      auto graph = createTranslationGraph(options_, device);
       graphs_.push_back(graph);
 
       auto scorers = createScorers(options_);
-      for(auto scorer : scorers)
-        scorer->init(graph);
+      initScorers(options_, scorers, graph);
       scorers_.push_back(scorers);
     }
+
+    printer_ = New<OutputPrinter>(options_, trgVocab_);
+
+    // With continuous batching, the sentences of concurrent requests share the running searches.
+    continuousBatching_ = useContinuousBatching<Search>(options_, scorers_[0], trgVocab_);
+    if(continuousBatching_)
+      for(size_t id = 0; id < numDevices_; ++id)
+        workers_.emplace_back([this, id]() { work(id); });
+
+    size_t cacheMB = options_->get<size_t>("translation-cache", 0);
+    if(cacheMB > 0 && options_->get<bool>("n-best")) {
+      // n-best lists contain the line number of the sentence within the request
+      LOG(warn, "[cache] Translation cache is not used with --n-best");
+    } else if(cacheMB > 0) {
+      cache_.reset(new TranslationCache(options_, cacheMB * 1024 * 1024));
+      cacheFile_ = options_->get<std::string>("translation-cache-file", "");
+      if(!cacheFile_.empty())
+        cache_->load(cacheFile_);
+    }
   }
 
+  // Number of requests that may be passed to run() at the same time. With continuous batching,
+  // their sentences are translated together; otherwise requests are translated one by one.
+  size_t maxConcurrentRequests() const {
+    return continuousBatching_ ? std::max(options_->get<size_t>("continuous-batching"), (size_t)1) : 1;
+  }
+
+  // Translates each line of the input. With a translation cache, cached lines are taken from the
+  // cache, and only the others are translated and added to it.
   std::string run(const std::string& input) override {
+    if(!cache_)
+      return utils::join(translate(input), "\n");
+
+    std::vector<std::string> keys;
+    std::vector<std::string> translations;
+    std::vector<size_t> misses; // line numbers of lines that are not cached
+    std::vector<std::string> missLines;
+
+    std::istringstream lines(input);
+    std::string line;
+    while(std::getline(lines, line)) {
+      std::string translation;
+      keys.push_back(TranslationCache::normalize(line));
+      if(!cache_->lookup(keys.back(), translation)) {
+        misses.push_back(translations.size());
+        missLines.push_back(line);
+      }
+      translations.push_back(translation);
+    }
+
+    if(!missLines.empty()) {
+      auto missTranslations = translate(utils::join(missLines, "\n"));
+      if(missTranslations.size() != misses.size()) {
+        // the lines cannot be matched to their translations; translate the request without the cache
+        LOG(warn, "[cache] Expected {} translations, got {}; translating the request without the cache",
+            misses.size(), missTranslations.size());
+        return utils::join(translate(input), "\n");
+      }
+      for(size_t i = 0; i < misses.size(); ++i) {
+        translations[misses[i]] = missTranslations[i];
+        cache_->insert(keys[misses[i]], missTranslations[i]);
+      }
+    }
+    return utils::join(translations, "\n");
+  }
+
+private:
+  std::vector<std::string> translate(const std::string& input) {
     auto corpus_ = New<data::TextInput>(std::vector<std::string>({input}), srcVocabs_, options_);
     data::BatchGenerator<data::TextInput> batchGenerator(corpus_, options_);
 
+    batchGenerator.prepare(false);
+
+    if(continuousBatching_)
+      return translateQueued(batchGenerator);
+
     auto collector = New<StringCollector>();
     auto printer = New<OutputPrinter>(options_, trgVocab_);
     size_t batchId = 0;
 
-    batchGenerator.prepare(false);
-
     {
       ThreadPool threadPool_(numDevices_, numDevices_);
 
@@ -228,8 +420,86 @@ public:
       }
     }
 
-    auto translations = collector->collect(options_->get<bool>("n-best"));
-    return utils::join(translations, "\n");
+    return collector->collect(options_->get<bool>("n-best"));
+  }
+
+  // Queues the batches of a request for the continuous batching workers and waits until all of
+  // its sentences are translated.
+  std::vector<std::string> translateQueued(data::BatchGenerator<data::TextInput>& batchGenerator) {
+    auto request = New<Request>();
+    std::vector<Ptr<data::CorpusBatch>> batches;
+    for(auto batch : batchGenerator) {
+      batches.push_back(batch);
+      request->pending += batch->size();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      for(auto batch : batches) {
+        std::vector<size_t> sentenceIds;
+        for(auto lineNum : batch->getSentenceIds()) {
+          sentences_[nextSentenceId_] = std::make_pair(request, lineNum);
+          sentenceIds.push_back(nextSentenceId_++);
+        }
+        batch->setSentenceIds(sentenceIds);
+        queue_.push_back(batch);
+      }
+    }
+    queueChanged_.notify_all();
+
+    std::unique_lock<std::mutex> lock(request->mutex);
+    request->finished.wait(lock, [&]() { return request->pending == 0; });
+    return request->collector->collect(options_->get<bool>("n-best"));
+  }
+
+  // continuous batching worker of device 'id', see translateQueued()
+  void work(size_t id) {
+    auto search = New<Search>(options_, scorers_[id], trgVocab_);
+
+    // batches that can join the running search; does not wait for new requests
+    auto feed = [this]() -> Ptr<data::CorpusBatch> {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      if(queue_.empty())
+        return nullptr;
+      auto batch = queue_.front();
+      queue_.pop_front();
+      return batch;
+    };
+
+    auto onFinished = [this](Ptr<History> history) {
+      Ptr<Request> request;
+      size_t lineNum;
+      {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        auto it = sentences_.find(history->getLineNum());
+        std::tie(request, lineNum) = it->second;
+        sentences_.erase(it);
+      }
+
+      std::stringstream best1;
+      std::stringstream bestn;
+      printer_->print(history, lineNum, best1, bestn);
+      request->collector->add((long)lineNum, best1.str(), bestn.str());
+
+      std::lock_guard<std::mutex> lock(request->mutex);
+      if(--request->pending == 0)
+        request->finished.notify_all();
+    };
+
+    for(;;) {
+      Ptr<data::CorpusBatch> batch;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex_);
+        queueChanged_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+        if(stopped_)
+          return;
+        batch = queue_.front();
+        queue_.pop_front();
+      }
+      for(auto history : search->search(graphs_[id], batch, feed, onFinished))
+        if(history)
+          onFinished(history);
+    }
   }
 };
 }  // namespace marian